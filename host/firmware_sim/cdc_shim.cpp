@@ -0,0 +1,198 @@
+/*
+#######################################################################
+#                                                                     #
+# cdc_shim.cpp                                                        #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  TinyUSB CDC device API backed by a pseudo-terminal
+
+  Buffer sizes match tusb_config.h so that fast_serial sees the same chunking as
+  on the device. Writes are only sent to the terminal on flush, like USB packets.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "firmware_sim.h"
+
+#include "tusb.h"
+
+namespace
+{
+
+int master_fd = -1;
+// Kept open so the terminal survives clients disconnecting
+int slave_fd = -1;
+
+// Both cores may print (in DEBUG mode), so the buffers are shared
+std::mutex cdc_mutex;
+std::deque<uint8_t> rx_buffer;
+std::deque<uint8_t> tx_buffer;
+
+// Move any pending input from the terminal into the RX buffer (cdc_mutex must be held).
+// If the buffer is empty, wait briefly for data rather than spinning, as the firmware
+// polls continuously while waiting for a command.
+void receive(int timeout_ms)
+{
+    if (master_fd < 0 || rx_buffer.size() >= CFG_TUD_CDC_RX_BUFSIZE)
+    {
+        return;
+    }
+    struct pollfd pfd = {master_fd, POLLIN, 0};
+    if (poll(&pfd, 1, rx_buffer.empty() ? timeout_ms : 0) <= 0 || !(pfd.revents & POLLIN))
+    {
+        return;
+    }
+    uint8_t data[CFG_TUD_CDC_RX_BUFSIZE];
+    ssize_t count = read(master_fd, data, CFG_TUD_CDC_RX_BUFSIZE - rx_buffer.size());
+    if (count > 0)
+    {
+        rx_buffer.insert(rx_buffer.end(), data, data + count);
+    }
+}
+
+} // namespace
+
+std::string firmware_sim_open_pty(const firmware_sim_options &options)
+{
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0)
+    {
+        perror("Could not create pseudo-terminal");
+        return "";
+    }
+    std::string path = ptsname(master_fd);
+    slave_fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (slave_fd < 0)
+    {
+        perror("Could not open pseudo-terminal");
+        return "";
+    }
+
+    // A USB CDC port is a raw byte pipe (no echo or line editing)
+    struct termios settings;
+    tcgetattr(slave_fd, &settings);
+    cfmakeraw(&settings);
+    tcsetattr(slave_fd, TCSANOW, &settings);
+
+    if (!options.link_path.empty())
+    {
+        unlink(options.link_path.c_str());
+        if (symlink(path.c_str(), options.link_path.c_str()) != 0)
+        {
+            perror("Could not create link to pseudo-terminal");
+        }
+    }
+    return path;
+}
+
+bool tusb_init(void)
+{
+    return master_fd >= 0;
+}
+
+void tud_task(void)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    receive(0);
+}
+
+uint32_t tud_cdc_available(void)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    receive(1);
+    return rx_buffer.size();
+}
+
+uint32_t tud_cdc_read(void *buffer, uint32_t bufsize)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    uint32_t count = 0;
+    uint8_t *out = static_cast<uint8_t *>(buffer);
+    while (count < bufsize && !rx_buffer.empty())
+    {
+        out[count++] = rx_buffer.front();
+        rx_buffer.pop_front();
+    }
+    return count;
+}
+
+int32_t tud_cdc_read_char(void)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    if (rx_buffer.empty())
+    {
+        return -1;
+    }
+    uint8_t c = rx_buffer.front();
+    rx_buffer.pop_front();
+    return c;
+}
+
+void tud_cdc_read_flush(void)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    rx_buffer.clear();
+}
+
+uint32_t tud_cdc_write(const void *buffer, uint32_t bufsize)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    const uint8_t *in = static_cast<const uint8_t *>(buffer);
+    uint32_t count = 0;
+    while (count < bufsize && tx_buffer.size() < CFG_TUD_CDC_TX_BUFSIZE)
+    {
+        tx_buffer.push_back(in[count++]);
+    }
+    return count;
+}
+
+uint32_t tud_cdc_write_available(void)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    return CFG_TUD_CDC_TX_BUFSIZE - tx_buffer.size();
+}
+
+uint32_t tud_cdc_write_flush(void)
+{
+    std::lock_guard<std::mutex> lock(cdc_mutex);
+    uint8_t data[CFG_TUD_CDC_TX_BUFSIZE];
+    uint32_t count = 0;
+    while (!tx_buffer.empty())
+    {
+        data[count++] = tx_buffer.front();
+        tx_buffer.pop_front();
+    }
+    uint32_t written = 0;
+    while (written < count)
+    {
+        ssize_t result = write(master_fd, data + written, count - written);
+        if (result < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (result > 0)
+        {
+            written += result;
+        }
+    }
+    return written;
+}
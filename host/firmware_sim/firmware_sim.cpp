@@ -0,0 +1,90 @@
+/*
+#######################################################################
+#                                                                     #
+# firmware_sim.cpp                                                    #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Runs the PrawnBlaster firmware on the host, with the PIO and DMA emulated and the
+  USB serial port mapped to a pseudo-terminal:
+
+      prawnblaster_sim [--link <path>] [--trigger-period <cycles>] [--trigger-width <cycles>]
+                       [--edges <file>]
+
+  Connect to the printed terminal (or --link) with any serial client, exactly as you
+  would to the device. Triggers are delivered to every pin the PIO is using as an
+  input, either periodically (--trigger-period) or on each SIGUSR1. With --edges, every
+  GPIO edge is logged as "<cycle> <pin> <level>".
+ */
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "firmware_sim.h"
+
+namespace
+{
+
+void handle_sigusr1(int)
+{
+    firmware_sim_request_trigger();
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: prawnblaster_sim [--link <path>] [--trigger-period <cycles>] [--trigger-width <cycles>] [--edges <file>]\n");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    firmware_sim_options options;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--link") == 0)
+        {
+            options.link_path = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--trigger-period") == 0)
+        {
+            options.trigger_period = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--trigger-width") == 0)
+        {
+            options.trigger_width = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--edges") == 0)
+        {
+            options.edge_log_path = argv[++i];
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::string path = firmware_sim_open_pty(options);
+    if (path.empty())
+    {
+        return 1;
+    }
+    printf("PrawnBlaster simulator listening on %s\n", path.c_str());
+    fflush(stdout);
+
+    signal(SIGUSR1, handle_sigusr1);
+    firmware_sim_start_emulator(options);
+    return prawnblaster_main();
+}
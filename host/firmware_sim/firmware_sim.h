@@ -0,0 +1,48 @@
+/*
+#######################################################################
+#                                                                     #
+# firmware_sim.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Glue between the simulator front end (firmware_sim.cpp) and the SDK shims
+  (hal_shim.cpp for the hardware, cdc_shim.cpp for the USB serial port).
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct firmware_sim_options
+{
+    // Symlink to create pointing at the pseudo-terminal (optional)
+    std::string link_path;
+    // Pulse every PIO input pin this often (in system clock cycles, 0 to disable)
+    uint64_t trigger_period = 0;
+    // Width of trigger pulses (in system clock cycles)
+    uint64_t trigger_width = 20;
+    // File to log edges on the pseudoclock outputs to (optional)
+    std::string edge_log_path;
+};
+
+// Start the thread that clocks the emulated PIO blocks and DMA channels
+void firmware_sim_start_emulator(const firmware_sim_options &options);
+
+// Request a single trigger pulse on every PIO input pin (async-signal-safe)
+void firmware_sim_request_trigger();
+
+// Create the pseudo-terminal the USB serial port is mapped to. Returns the path of
+// the terminal to connect to, or an empty string on failure.
+std::string firmware_sim_open_pty(const firmware_sim_options &options);
+
+// The firmware's main(), renamed when compiled for the simulator
+int prawnblaster_main();
@@ -0,0 +1,1189 @@
+/*
+#######################################################################
+#                                                                     #
+# hal_shim.cpp                                                        #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Implementation of the pico SDK shim on top of the PIO emulator
+
+  The emulator is owned by a background thread that clocks it as fast as it can
+  whenever there is something to do, and sleeps while everything is stalled. The
+  firmware's cores (core 0 is the main thread, core 1 a second thread) talk to it
+  through the SDK functions below, which take emulator_mutex.
+
+  DMA channel registers are mirrored into dma_shim_channels after every batch of
+  cycles so that the firmware's busy/transfer_count polling does not contend for
+  the lock.
+
+  Interrupts are raised at the same time (DMA completion, and PIO RX FIFO not empty
+  if data arrived during the batch) and their handlers are called on the emulator
+  thread with emulator_mutex released.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "firmware_sim.h"
+#include "pio_emulator.h"
+
+#include "pico/bootrom.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "hardware/structs/systick.h"
+
+pio_hw_t pio_shim_blocks[2] = {};
+dma_channel_hw_t dma_shim_channels[NUM_DMA_CHANNELS] = {};
+
+namespace
+{
+
+// Cycles run between checks for work from the firmware
+const uint64_t emulator_batch_cycles = 1024;
+
+pio_emulator emulator;
+std::mutex emulator_mutex;
+std::condition_variable emulator_wake;
+
+firmware_sim_options sim_options;
+std::atomic<bool> trigger_requested(false);
+uint64_t next_trigger_cycle = 0;
+FILE *edge_log = nullptr;
+
+uint32_t claimed_sms[2];
+uint32_t claimed_dma_channels;
+
+uint32_t clk_sys_khz = 125000;
+resus_callback_t resus_callback = nullptr;
+
+irq_handler_t irq_handlers[32];
+std::atomic<uint32_t> irq_enabled(0);
+// DMA_IRQ_1 enable and status (INTE1/INTS1)
+std::atomic<uint32_t> dma_irq1_enabled(0);
+std::atomic<uint32_t> dma_irq1_status(0);
+bool dma_was_busy[NUM_DMA_CHANNELS];
+uint32_t dma_last_transfer_count[NUM_DMA_CHANNELS];
+// Channels that finished during the last batch and still read as busy until their
+// interrupt handler has run (on the RP2040 the handler runs before the firmware can see
+// that the channel has finished)
+uint32_t dma_busy_until_dispatched;
+// PIO IRQ0 enable (INTE0) and the RX FIFO not empty flags of the last batch
+std::atomic<uint32_t> pio_irq0_enabled[2];
+uint32_t pio_rx_not_empty[2];
+
+std::mutex event_mutex;
+std::condition_variable event_signalled;
+bool event_flag = false;
+
+// Whether this core has disabled interrupts, holding emulator_mutex
+thread_local bool interrupts_disabled = false;
+
+thread_local uint core_num = 0;
+std::mutex fifo_mutex;
+std::condition_variable fifo_changed;
+// Inter-core FIFOs, indexed by the core that reads from them
+std::deque<uint32_t> core_fifos[2];
+const size_t core_fifo_depth = 8;
+
+int block_index(PIO pio)
+{
+    return pio == pio1 ? 1 : 0;
+}
+
+bool valid_pin(uint gpio)
+{
+    return gpio < PIO_EMU_NUM_GPIOS;
+}
+
+// Update the register mirror and interrupt flags (emulator_mutex must be held)
+void mirror_dma_registers()
+{
+    for (int block = 0; block < 2; block++)
+    {
+        pio_rx_not_empty[block] = 0;
+        for (int sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++)
+        {
+            if (!emulator.sm(block, sm).rx_fifo.empty())
+            {
+                pio_rx_not_empty[block] |= 1u << (pis_sm0_rx_fifo_not_empty + sm);
+            }
+        }
+    }
+    for (int ch = 0; ch < NUM_DMA_CHANNELS; ch++)
+    {
+        const pio_emu_dma_channel &channel = emulator.dma(ch);
+        // A DMA that drained an RX FIFO during the batch means the FIFO was not empty at some point
+        if (channel.read.type == PIO_EMU_DMA_RX_FIFO && channel.transfer_count != dma_last_transfer_count[ch])
+        {
+            pio_rx_not_empty[channel.read.block] |= 1u << (pis_sm0_rx_fifo_not_empty + channel.read.sm);
+        }
+        if (dma_was_busy[ch] && !channel.busy && channel.transfer_count == 0)
+        {
+            dma_irq1_status |= 1u << ch;
+            if ((dma_irq1_enabled & (1u << ch)) && (irq_enabled & (1u << DMA_IRQ_1)) && irq_handlers[DMA_IRQ_1])
+            {
+                dma_busy_until_dispatched |= 1u << ch;
+            }
+        }
+        dma_was_busy[ch] = channel.busy;
+        dma_last_transfer_count[ch] = channel.transfer_count;
+        dma_shim_channels[ch].transfer_count = channel.transfer_count;
+        if (channel.busy || (dma_busy_until_dispatched & (1u << ch)))
+        {
+            dma_shim_channels[ch].ctrl_trig |= DMA_CH0_CTRL_TRIG_BUSY_BITS;
+        }
+        else
+        {
+            dma_shim_channels[ch].ctrl_trig &= ~DMA_CH0_CTRL_TRIG_BUSY_BITS;
+        }
+    }
+}
+
+// Pulse every pin that is currently a PIO input (emulator_mutex must be held)
+void schedule_trigger_pulse()
+{
+    uint64_t now = emulator.cycle();
+    for (int pin = 0; pin < PIO_EMU_NUM_GPIOS; pin++)
+    {
+        pio_emu_gpio_function function = emulator.gpio_get_function(pin);
+        if (function != PIO_EMU_GPIO_FUNC_PIO0 && function != PIO_EMU_GPIO_FUNC_PIO1)
+        {
+            continue;
+        }
+        int pio = function == PIO_EMU_GPIO_FUNC_PIO0 ? 0 : 1;
+        if (emulator.block(pio).pin_directions & (1u << pin))
+        {
+            continue;
+        }
+        // Active low for inverted inputs
+        int active = emulator.gpio_input_inverted(pin) ? 0 : 1;
+        emulator.gpio_schedule_input(now, pin, active);
+        emulator.gpio_schedule_input(now + sim_options.trigger_width, pin, !active);
+    }
+}
+
+// Interrupts that are currently asserted and enabled
+uint32_t pending_irqs()
+{
+    uint32_t pending = 0;
+    if (dma_irq1_status & dma_irq1_enabled)
+    {
+        pending |= 1u << DMA_IRQ_1;
+    }
+    if (pio_rx_not_empty[0] & pio_irq0_enabled[0])
+    {
+        pending |= 1u << PIO0_IRQ_0;
+    }
+    if (pio_rx_not_empty[1] & pio_irq0_enabled[1])
+    {
+        pending |= 1u << PIO1_IRQ_0;
+    }
+    return pending & irq_enabled;
+}
+
+// Call the handlers of the pending interrupts (emulator_mutex must not be held)
+void dispatch_irqs(uint32_t pending)
+{
+    for (int num = 0; num < 32; num++)
+    {
+        if ((pending & (1u << num)) && irq_handlers[num])
+        {
+            irq_handlers[num]();
+        }
+    }
+}
+
+void emulator_thread()
+{
+    std::unique_lock<std::mutex> lock(emulator_mutex);
+    while (true)
+    {
+        if (trigger_requested.exchange(false))
+        {
+            schedule_trigger_pulse();
+        }
+        if (sim_options.trigger_period > 0 && emulator.cycle() >= next_trigger_cycle)
+        {
+            schedule_trigger_pulse();
+            next_trigger_cycle = emulator.cycle() + sim_options.trigger_period;
+        }
+
+        // With periodic triggers, time has to keep moving while the pseudoclocks wait for them
+        bool idle = emulator.is_idle(sim_options.trigger_period == 0);
+        if (!idle)
+        {
+            emulator.step(emulator_batch_cycles);
+        }
+        mirror_dma_registers();
+        uint32_t pending = pending_irqs();
+
+        // Give the firmware a chance to get at the emulator
+        lock.unlock();
+        dispatch_irqs(pending);
+        std::this_thread::yield();
+        lock.lock();
+        for (int ch = 0; ch < NUM_DMA_CHANNELS; ch++)
+        {
+            if (dma_busy_until_dispatched & (1u << ch))
+            {
+                dma_shim_channels[ch].ctrl_trig &= ~DMA_CH0_CTRL_TRIG_BUSY_BITS;
+            }
+        }
+        dma_busy_until_dispatched = 0;
+        if (idle)
+        {
+            emulator_wake.wait_for(lock, std::chrono::milliseconds(5));
+        }
+    }
+}
+
+// Run a function on the emulator and wake the emulator thread (the call may have given it work)
+template <typename F>
+auto with_emulator(F f) -> decltype(f())
+{
+    if (interrupts_disabled)
+    {
+        return f();
+    }
+    std::lock_guard<std::mutex> lock(emulator_mutex);
+    struct waker
+    {
+        ~waker() { emulator_wake.notify_one(); }
+    } wake;
+    return f();
+}
+
+} // namespace
+
+//
+// Simulator control
+//
+
+void firmware_sim_start_emulator(const firmware_sim_options &options)
+{
+    sim_options = options;
+    if (!options.edge_log_path.empty())
+    {
+        edge_log = fopen(options.edge_log_path.c_str(), "w");
+        if (!edge_log)
+        {
+            fprintf(stderr, "Could not open %s for writing\n", options.edge_log_path.c_str());
+        }
+    }
+    if (edge_log)
+    {
+        emulator.watch_pins((1u << PIO_EMU_NUM_GPIOS) - 1);
+        emulator.on_edge = [](const pio_emu_edge &edge) {
+            fprintf(edge_log, "%llu %d %d\n", static_cast<unsigned long long>(edge.cycle), edge.pin, edge.level);
+            fflush(edge_log);
+        };
+    }
+    std::thread(emulator_thread).detach();
+}
+
+void firmware_sim_request_trigger()
+{
+    trigger_requested = true;
+}
+
+//
+// pico/mutex.h
+//
+
+void mutex_init(mutex_t *mtx)
+{
+    pthread_mutex_init(&mtx->lock, nullptr);
+}
+
+void mutex_enter_blocking(mutex_t *mtx)
+{
+    pthread_mutex_lock(&mtx->lock);
+}
+
+void mutex_exit(mutex_t *mtx)
+{
+    pthread_mutex_unlock(&mtx->lock);
+}
+
+//
+// pico/stdlib.h and hardware/clocks.h
+//
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+    clk_sys_khz = freq_khz;
+    return true;
+}
+
+uint64_t time_us_64(void)
+{
+    static const auto boot = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+uint32_t time_us_32(void)
+{
+    return static_cast<uint32_t>(time_us_64());
+}
+
+void sleep_us(uint64_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void sleep_ms(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+bool clock_configure_gpin(enum clock_index clk_index, uint gpio, uint32_t src_freq, uint32_t freq)
+{
+    if (clk_index == clk_sys)
+    {
+        clk_sys_khz = freq / KHZ;
+    }
+    return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+    switch (clk_index)
+    {
+    case clk_usb:
+    case clk_adc:
+        return 48 * MHZ;
+    case clk_rtc:
+        return 46875;
+    case clk_ref:
+        return 12 * MHZ;
+    default:
+        return clk_sys_khz * KHZ;
+    }
+}
+
+uint32_t frequency_count_khz(uint src)
+{
+    switch (src)
+    {
+    case CLOCKS_FC0_SRC_VALUE_PLL_USB_CLKSRC_PRIMARY:
+        return clock_get_hz(clk_usb) / KHZ;
+    case CLOCKS_FC0_SRC_VALUE_ROSC_CLKSRC:
+        return 6500;
+    case CLOCKS_FC0_SRC_VALUE_CLK_USB:
+        return clock_get_hz(clk_usb) / KHZ;
+    case CLOCKS_FC0_SRC_VALUE_CLK_ADC:
+        return clock_get_hz(clk_adc) / KHZ;
+    case CLOCKS_FC0_SRC_VALUE_CLK_RTC:
+        return clock_get_hz(clk_rtc) / KHZ;
+    default:
+        return clk_sys_khz;
+    }
+}
+
+void clocks_enable_resus(resus_callback_t callback)
+{
+    // The emulated clock never fails
+    resus_callback = callback;
+}
+
+//
+// hardware/irq.h, hardware/sync.h and hardware/structs/systick.h
+//
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    if (enabled)
+    {
+        irq_enabled |= 1u << num;
+    }
+    else
+    {
+        irq_enabled &= ~(1u << num);
+    }
+}
+
+void __wfe(void)
+{
+    std::unique_lock<std::mutex> lock(event_mutex);
+    // Like the real thing this may return early, callers have to check their condition again
+    event_signalled.wait_for(lock, std::chrono::milliseconds(10), []() { return event_flag; });
+    event_flag = false;
+}
+
+void __sev(void)
+{
+    std::lock_guard<std::mutex> lock(event_mutex);
+    event_flag = true;
+    event_signalled.notify_all();
+}
+
+void __dmb(void)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+uint32_t save_and_disable_interrupts(void)
+{
+    if (interrupts_disabled)
+    {
+        return 1;
+    }
+    emulator_mutex.lock();
+    interrupts_disabled = true;
+    return 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    if (status == 0 && interrupts_disabled)
+    {
+        interrupts_disabled = false;
+        emulator_mutex.unlock();
+        emulator_wake.notify_one();
+    }
+}
+
+namespace
+{
+
+spin_lock_t spin_locks[NUM_SPIN_LOCKS];
+std::atomic_flag spin_lock_flags[NUM_SPIN_LOCKS];
+uint32_t claimed_spin_locks;
+
+} // namespace
+
+int spin_lock_claim_unused(bool required)
+{
+    for (int i = 0; i < NUM_SPIN_LOCKS; i++)
+    {
+        if (!(claimed_spin_locks & (1u << i)))
+        {
+            claimed_spin_locks |= 1u << i;
+            return i;
+        }
+    }
+    if (required)
+    {
+        fprintf(stderr, "No spin locks are available\n");
+        abort();
+    }
+    return -1;
+}
+
+spin_lock_t *spin_lock_instance(uint lock_num)
+{
+    return &spin_locks[lock_num];
+}
+
+uint32_t spin_lock_blocking(spin_lock_t *lock)
+{
+    std::atomic_flag &flag = spin_lock_flags[lock - spin_locks];
+    while (flag.test_and_set(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+    return 0;
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+    spin_lock_flags[lock - spin_locks].clear(std::memory_order_release);
+}
+
+systick_hw_t *systick_shim_sample(void)
+{
+    static thread_local systick_hw_t registers = {};
+    static const auto boot = std::chrono::steady_clock::now();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - boot).count();
+    uint64_t cycles = ns * clk_sys_khz / 1000000;
+    registers.cvr = 0x00ffffff - (cycles & 0x00ffffff);
+    return &registers;
+}
+
+//
+// hardware/timer.h
+//
+
+namespace
+{
+
+const int num_alarms = 4;
+// Held while a callback runs, so that an alarm is never cancelled half way through one
+std::recursive_mutex alarm_mutex;
+std::condition_variable_any alarm_changed;
+uint32_t claimed_alarms;
+hardware_alarm_callback_t alarm_callbacks[num_alarms];
+bool alarm_armed[num_alarms];
+absolute_time_t alarm_targets[num_alarms];
+
+void alarm_thread()
+{
+    std::unique_lock<std::recursive_mutex> lock(alarm_mutex);
+    while (true)
+    {
+        int next = -1;
+        for (int i = 0; i < num_alarms; i++)
+        {
+            if (alarm_armed[i] && (next < 0 || alarm_targets[i] < alarm_targets[next]))
+            {
+                next = i;
+            }
+        }
+        if (next < 0)
+        {
+            alarm_changed.wait(lock);
+            continue;
+        }
+        uint64_t now = time_us_64();
+        if (now < alarm_targets[next])
+        {
+            alarm_changed.wait_for(lock, std::chrono::microseconds(alarm_targets[next] - now));
+            continue;
+        }
+        alarm_armed[next] = false;
+        if (alarm_callbacks[next])
+        {
+            alarm_callbacks[next](next);
+        }
+        __sev();
+    }
+}
+
+} // namespace
+
+int hardware_alarm_claim_unused(bool required)
+{
+    std::lock_guard<std::recursive_mutex> lock(alarm_mutex);
+    if (claimed_alarms == 0)
+    {
+        std::thread(alarm_thread).detach();
+    }
+    for (int i = 0; i < num_alarms; i++)
+    {
+        if (!(claimed_alarms & (1u << i)))
+        {
+            claimed_alarms |= 1u << i;
+            return i;
+        }
+    }
+    if (required)
+    {
+        fprintf(stderr, "No hardware alarms are available\n");
+        abort();
+    }
+    return -1;
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback)
+{
+    std::lock_guard<std::recursive_mutex> lock(alarm_mutex);
+    alarm_callbacks[alarm_num] = callback;
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t)
+{
+    std::lock_guard<std::recursive_mutex> lock(alarm_mutex);
+    // Like the SDK, a target that has already passed is not set
+    if (t <= time_us_64())
+    {
+        return true;
+    }
+    alarm_targets[alarm_num] = t;
+    alarm_armed[alarm_num] = true;
+    alarm_changed.notify_all();
+    return false;
+}
+
+void hardware_alarm_cancel(uint alarm_num)
+{
+    std::lock_guard<std::recursive_mutex> lock(alarm_mutex);
+    alarm_armed[alarm_num] = false;
+    alarm_changed.notify_all();
+}
+
+//
+// pico/multicore.h
+//
+
+void multicore_launch_core1(void (*entry)(void))
+{
+    std::thread([entry]() {
+        core_num = 1;
+        entry();
+    }).detach();
+}
+
+void multicore_fifo_push_blocking(uint32_t data)
+{
+    std::unique_lock<std::mutex> lock(fifo_mutex);
+    std::deque<uint32_t> &fifo = core_fifos[1 - core_num];
+    fifo_changed.wait(lock, [&]() { return fifo.size() < core_fifo_depth; });
+    fifo.push_back(data);
+    fifo_changed.notify_all();
+}
+
+uint32_t multicore_fifo_pop_blocking(void)
+{
+    std::unique_lock<std::mutex> lock(fifo_mutex);
+    std::deque<uint32_t> &fifo = core_fifos[core_num];
+    fifo_changed.wait(lock, [&]() { return !fifo.empty(); });
+    uint32_t data = fifo.front();
+    fifo.pop_front();
+    fifo_changed.notify_all();
+    return data;
+}
+
+uint get_core_num(void)
+{
+    return core_num;
+}
+
+//
+// pico/bootrom.h and pico/unique_id.h
+//
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask)
+{
+    fprintf(stderr, "Firmware requested a reboot into the bootloader, exiting\n");
+    exit(0);
+}
+
+void pico_get_unique_board_id_string(char *id_out, uint len)
+{
+    snprintf(id_out, len, "%s", "E6605838830000SIM");
+}
+
+//
+// hardware/gpio.h
+//
+
+void gpio_init(uint gpio)
+{
+    if (!valid_pin(gpio))
+    {
+        return;
+    }
+    with_emulator([&]() {
+        emulator.gpio_set_sio_dir(gpio, false);
+        emulator.gpio_set_sio_value(gpio, 0);
+        emulator.gpio_set_function(gpio, PIO_EMU_GPIO_FUNC_SIO);
+    });
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+    if (!valid_pin(gpio))
+    {
+        return;
+    }
+    pio_emu_gpio_function function;
+    switch (fn)
+    {
+    case GPIO_FUNC_SIO:
+        function = PIO_EMU_GPIO_FUNC_SIO;
+        break;
+    case GPIO_FUNC_PIO0:
+        function = PIO_EMU_GPIO_FUNC_PIO0;
+        break;
+    case GPIO_FUNC_PIO1:
+        function = PIO_EMU_GPIO_FUNC_PIO1;
+        break;
+    default:
+        // Peripherals that are not emulated (e.g. clock inputs) leave the pin undriven
+        function = PIO_EMU_GPIO_FUNC_NULL;
+        break;
+    }
+    with_emulator([&]() {
+        emulator.gpio_set_function(gpio, function);
+        // Like the SDK, this writes the whole control register, which clears the overrides
+        // (but the external trigger source keeps its idle level, see gpio_set_inover)
+        emulator.gpio_set_output_inverted(gpio, false);
+        emulator.gpio_set_input_inverted(gpio, false);
+    });
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+    if (valid_pin(gpio))
+    {
+        with_emulator([&]() { emulator.gpio_set_sio_dir(gpio, out); });
+    }
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    if (valid_pin(gpio))
+    {
+        with_emulator([&]() { emulator.gpio_set_sio_value(gpio, value); });
+    }
+}
+
+bool gpio_get(uint gpio)
+{
+    if (!valid_pin(gpio))
+    {
+        return false;
+    }
+    return with_emulator([&]() { return emulator.gpio_get(gpio) != 0; });
+}
+
+void gpio_set_outover(uint gpio, uint value)
+{
+    if (valid_pin(gpio))
+    {
+        with_emulator([&]() { emulator.gpio_set_output_inverted(gpio, value == GPIO_OVERRIDE_INVERT); });
+    }
+}
+
+void gpio_set_inover(uint gpio, uint value)
+{
+    if (valid_pin(gpio))
+    {
+        with_emulator([&]() {
+            bool inverted = value == GPIO_OVERRIDE_INVERT;
+            // The simulated trigger source idles at the inactive level (only seen if nothing
+            // on the chip drives the pin)
+            if (inverted != emulator.gpio_input_inverted(gpio))
+            {
+                emulator.gpio_drive_input(gpio, inverted);
+            }
+            emulator.gpio_set_input_inverted(gpio, inverted);
+        });
+    }
+}
+
+//
+// hardware/pio.h
+//
+
+pio_sm_config pio_get_default_sm_config(void)
+{
+    pio_sm_config c = {};
+    c.wrap_target = 0;
+    c.wrap = PIO_EMU_INSTRUCTION_COUNT - 1;
+    c.in_shift_right = true;
+    c.out_shift_right = true;
+    c.clkdiv_int = 1;
+    c.clkdiv_frac = 0;
+    return c;
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap)
+{
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs)
+{
+    c->sideset_bits = bit_count;
+    c->sideset_optional = optional;
+    c->sideset_pindirs = pindirs;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base)
+{
+    c->sideset_base = sideset_base;
+}
+
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count)
+{
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count)
+{
+    c->set_base = set_base;
+    c->set_count = set_count;
+}
+
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base)
+{
+    c->in_base = in_base;
+}
+
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin)
+{
+    c->jmp_pin = pin;
+}
+
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold)
+{
+    // Autopush is not used by the firmware and not emulated
+    c->in_shift_right = shift_right;
+}
+
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold)
+{
+    // Autopull is not used by the firmware and not emulated
+    c->out_shift_right = shift_right;
+}
+
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac)
+{
+    c->clkdiv_int = div_int;
+    c->clkdiv_frac = div_frac;
+}
+
+namespace
+{
+
+pio_program_info program_info(const pio_program_t *program)
+{
+    pio_program_info info;
+    info.instructions.assign(program->instructions, program->instructions + program->length);
+    info.origin = program->origin;
+    return info;
+}
+
+} // namespace
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program)
+{
+    return with_emulator([&]() {
+        int offset = emulator.add_program(block_index(pio), program_info(program));
+        if (offset < 0)
+        {
+            return false;
+        }
+        emulator.remove_program(block_index(pio), program_info(program), offset);
+        return true;
+    });
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+    int offset = with_emulator([&]() { return emulator.add_program(block_index(pio), program_info(program)); });
+    if (offset < 0)
+    {
+        fprintf(stderr, "No program space\n");
+        abort();
+    }
+    return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset)
+{
+    with_emulator([&]() { emulator.remove_program(block_index(pio), program_info(program), loaded_offset); });
+}
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+    gpio_set_function(pin, pio == pio1 ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0);
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out)
+{
+    with_emulator([&]() { emulator.sm_set_pindirs(block_index(pio), pin_base, pin_count, is_out); });
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+    pio_emu_sm_config emu_config;
+    emu_config.wrap_target = config->wrap_target;
+    emu_config.wrap = config->wrap;
+    emu_config.side_set_bits = config->sideset_bits;
+    emu_config.side_set_opt = config->sideset_optional;
+    emu_config.side_set_pindirs = config->sideset_pindirs;
+    emu_config.side_set_base = config->sideset_base;
+    emu_config.out_base = config->out_base;
+    emu_config.out_count = config->out_count;
+    emu_config.set_base = config->set_base;
+    emu_config.set_count = config->set_count;
+    emu_config.in_base = config->in_base;
+    emu_config.jmp_pin = config->jmp_pin;
+    emu_config.in_shift_right = config->in_shift_right;
+    emu_config.out_shift_right = config->out_shift_right;
+    emu_config.clkdiv_int = config->clkdiv_int;
+    emu_config.clkdiv_frac = config->clkdiv_frac;
+    with_emulator([&]() { emulator.sm_init(block_index(pio), sm, initial_pc, emu_config); });
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+    with_emulator([&]() { emulator.sm_set_enabled(block_index(pio), sm, enabled); });
+}
+
+void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled)
+{
+    with_emulator([&]() {
+        for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++)
+        {
+            if (mask & (1u << sm))
+            {
+                emulator.sm_set_enabled(block_index(pio), sm, enabled);
+            }
+        }
+    });
+}
+
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask)
+{
+    with_emulator([&]() { emulator.enable_sm_mask_in_sync(block_index(pio), mask); });
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr)
+{
+    with_emulator([&]() { emulator.sm_exec(block_index(pio), sm, instr); });
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data)
+{
+    while (!with_emulator([&]() { return emulator.sm_put(block_index(pio), sm, data); }))
+    {
+        std::this_thread::yield();
+    }
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm)
+{
+    uint32_t data = 0;
+    with_emulator([&]() { return emulator.sm_get(block_index(pio), sm, &data); });
+    return data;
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm)
+{
+    return with_emulator([&]() { return static_cast<uint>(emulator.sm(block_index(pio), sm).rx_fifo.size()); });
+}
+
+pio_shim_fdebug::operator uint32_t() const
+{
+    int block = this == &pio_shim_blocks[1].fdebug ? 1 : 0;
+    return with_emulator([&]() { return emulator.block(block).fdebug; });
+}
+
+pio_shim_fdebug &pio_shim_fdebug::operator=(uint32_t clear_mask)
+{
+    int block = this == &pio_shim_blocks[1].fdebug ? 1 : 0;
+    with_emulator([&]() { emulator.block(block).fdebug &= ~clear_mask; });
+    return *this;
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm)
+{
+    return with_emulator([&]() { return static_cast<uint>(emulator.sm(block_index(pio), sm).tx_fifo.size()); });
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+    with_emulator([&]() { emulator.sm_clear_fifos(block_index(pio), sm); });
+}
+
+void pio_sm_drain_tx_fifo(PIO pio, uint sm)
+{
+    // The SDK executes "pull noblock" until the FIFO is empty, the net effect is an empty FIFO
+    with_emulator([&]() { emulator.sm(block_index(pio), sm).tx_fifo.clear(); });
+}
+
+void pio_claim_sm_mask(PIO pio, uint sm_mask)
+{
+    uint32_t &claimed = claimed_sms[block_index(pio)];
+    if (claimed & sm_mask)
+    {
+        fprintf(stderr, "PIO state machine already claimed\n");
+        abort();
+    }
+    claimed |= sm_mask;
+}
+
+void pio_sm_unclaim(PIO pio, uint sm)
+{
+    claimed_sms[block_index(pio)] &= ~(1u << sm);
+}
+
+bool pio_sm_is_claimed(PIO pio, uint sm)
+{
+    return claimed_sms[block_index(pio)] & (1u << sm);
+}
+
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled)
+{
+    pio_set_irq0_source_mask_enabled(pio, 1u << source, enabled);
+}
+
+void pio_set_irq0_source_mask_enabled(PIO pio, uint32_t source_mask, bool enabled)
+{
+    if (enabled)
+    {
+        pio_irq0_enabled[block_index(pio)] |= source_mask;
+        // The emulator thread checks for interrupts after the next batch
+        emulator_wake.notify_one();
+    }
+    else
+    {
+        pio_irq0_enabled[block_index(pio)] &= ~source_mask;
+    }
+}
+
+//
+// hardware/dma.h
+//
+
+int dma_claim_unused_channel(bool required)
+{
+    for (int ch = 0; ch < NUM_DMA_CHANNELS; ch++)
+    {
+        if (!(claimed_dma_channels & (1u << ch)))
+        {
+            claimed_dma_channels |= 1u << ch;
+            return ch;
+        }
+    }
+    if (required)
+    {
+        fprintf(stderr, "No DMA channels are available\n");
+        abort();
+    }
+    return -1;
+}
+
+void dma_channel_unclaim(uint channel)
+{
+    claimed_dma_channels &= ~(1u << channel);
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    dma_channel_config c;
+    c.read_increment = true;
+    c.write_increment = false;
+    c.dreq = DREQ_FORCE;
+    c.size = DMA_SIZE_32;
+    return c;
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+    c->read_increment = incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+    c->write_increment = incr;
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+    c->dreq = dreq;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+    c->size = size;
+}
+
+namespace
+{
+
+// Map a bus address onto an emulator DMA endpoint (PIO FIFO registers or memory)
+pio_emu_dma_endpoint dma_endpoint(const volatile void *address)
+{
+    pio_emu_dma_endpoint endpoint;
+    for (int block = 0; block < 2; block++)
+    {
+        for (int sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++)
+        {
+            if (address == &pio_shim_blocks[block].txf[sm])
+            {
+                endpoint.type = PIO_EMU_DMA_TX_FIFO;
+                endpoint.block = block;
+                endpoint.sm = sm;
+                return endpoint;
+            }
+            if (address == &pio_shim_blocks[block].rxf[sm])
+            {
+                endpoint.type = PIO_EMU_DMA_RX_FIFO;
+                endpoint.block = block;
+                endpoint.sm = sm;
+                return endpoint;
+            }
+        }
+    }
+    endpoint.type = PIO_EMU_DMA_MEMORY;
+    endpoint.address = const_cast<uint32_t *>(static_cast<const volatile uint32_t *>(address));
+    return endpoint;
+}
+
+} // namespace
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    if (config->size != DMA_SIZE_32)
+    {
+        fprintf(stderr, "Only 32 bit DMA transfers are emulated\n");
+        abort();
+    }
+    with_emulator([&]() {
+        pio_emu_dma_channel &ch = emulator.dma(channel);
+        ch.read = dma_endpoint(read_addr);
+        ch.write = dma_endpoint(write_addr);
+        ch.read_increment = config->read_increment;
+        ch.write_increment = config->write_increment;
+        ch.transfer_count = transfer_count;
+        if (trigger)
+        {
+            emulator.dma_start(channel);
+        }
+        mirror_dma_registers();
+    });
+}
+
+void dma_channel_abort(uint channel)
+{
+    with_emulator([&]() {
+        emulator.dma_abort(channel);
+        mirror_dma_registers();
+    });
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled)
+{
+    if (enabled)
+    {
+        dma_irq1_enabled |= 1u << channel;
+    }
+    else
+    {
+        dma_irq1_enabled &= ~(1u << channel);
+    }
+}
+
+bool dma_channel_get_irq1_status(uint channel)
+{
+    return dma_irq1_status & (1u << channel);
+}
+
+void dma_channel_acknowledge_irq1(uint channel)
+{
+    dma_irq1_status &= ~(1u << channel);
+}
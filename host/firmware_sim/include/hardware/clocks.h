@@ -0,0 +1,60 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/clocks.h                                                   #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_CLOCKS_H
+#define _HARDWARE_CLOCKS_H
+
+#include "pico/types.h"
+
+#define KHZ 1000
+#define MHZ 1000000
+
+enum clock_index
+{
+    clk_gpout0 = 0,
+    clk_gpout1,
+    clk_gpout2,
+    clk_gpout3,
+    clk_ref,
+    clk_sys,
+    clk_peri,
+    clk_usb,
+    clk_adc,
+    clk_rtc,
+    CLK_COUNT
+};
+
+// Frequency counter sources (from hardware/regs/clocks.h)
+#define CLOCKS_FC0_SRC_VALUE_PLL_SYS_CLKSRC_PRIMARY 0x01
+#define CLOCKS_FC0_SRC_VALUE_PLL_USB_CLKSRC_PRIMARY 0x02
+#define CLOCKS_FC0_SRC_VALUE_ROSC_CLKSRC 0x03
+#define CLOCKS_FC0_SRC_VALUE_CLK_SYS 0x09
+#define CLOCKS_FC0_SRC_VALUE_CLK_PERI 0x0a
+#define CLOCKS_FC0_SRC_VALUE_CLK_USB 0x0b
+#define CLOCKS_FC0_SRC_VALUE_CLK_ADC 0x0c
+#define CLOCKS_FC0_SRC_VALUE_CLK_RTC 0x0d
+
+typedef void (*resus_callback_t)(void);
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+bool clock_configure_gpin(enum clock_index clk_index, uint gpio, uint32_t src_freq, uint32_t freq);
+uint32_t clock_get_hz(enum clock_index clk_index);
+uint32_t frequency_count_khz(uint src);
+void clocks_enable_resus(resus_callback_t resus_callback);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
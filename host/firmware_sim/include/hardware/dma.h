@@ -0,0 +1,99 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/dma.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_DMA_H
+#define _HARDWARE_DMA_H
+
+#include "pico/types.h"
+
+#define NUM_DMA_CHANNELS 12
+
+#define DMA_CH0_CTRL_TRIG_BUSY_BITS 0x01000000u
+
+enum dreq_num_rp2040
+{
+    DREQ_PIO0_TX0 = 0,
+    DREQ_PIO0_TX1 = 1,
+    DREQ_PIO0_TX2 = 2,
+    DREQ_PIO0_TX3 = 3,
+    DREQ_PIO0_RX0 = 4,
+    DREQ_PIO0_RX1 = 5,
+    DREQ_PIO0_RX2 = 6,
+    DREQ_PIO0_RX3 = 7,
+    DREQ_PIO1_TX0 = 8,
+    DREQ_PIO1_TX1 = 9,
+    DREQ_PIO1_TX2 = 10,
+    DREQ_PIO1_TX3 = 11,
+    DREQ_PIO1_RX0 = 12,
+    DREQ_PIO1_RX1 = 13,
+    DREQ_PIO1_RX2 = 14,
+    DREQ_PIO1_RX3 = 15,
+    DREQ_FORCE = 0x3f,
+};
+
+enum dma_channel_transfer_size
+{
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+// Mirror of the channel registers, kept up to date by the emulator thread
+typedef struct
+{
+    io_rw_32 read_addr;
+    io_rw_32 write_addr;
+    io_rw_32 transfer_count;
+    io_rw_32 ctrl_trig;
+} dma_channel_hw_t;
+
+extern dma_channel_hw_t dma_shim_channels[NUM_DMA_CHANNELS];
+
+typedef struct
+{
+    bool read_increment;
+    bool write_increment;
+    uint dreq;
+    enum dma_channel_transfer_size size;
+} dma_channel_config;
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_abort(uint channel);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
+
+PICO_SHIM_EXTERN_C_END
+
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel)
+{
+    return &dma_shim_channels[channel];
+}
+
+static inline bool dma_channel_is_busy(uint channel)
+{
+    return !!(dma_channel_hw_addr(channel)->ctrl_trig & DMA_CH0_CTRL_TRIG_BUSY_BITS);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/irq.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_IRQ_H
+#define _HARDWARE_IRQ_H
+
+#include "pico/types.h"
+
+// Handlers are called from the emulator thread, which stands in for the core that
+// enabled them (hal_shim.cpp)
+#define __isr
+
+enum irq_num_rp2040
+{
+    PIO0_IRQ_0 = 7,
+    PIO0_IRQ_1 = 8,
+    PIO1_IRQ_0 = 9,
+    PIO1_IRQ_1 = 10,
+    DMA_IRQ_0 = 11,
+    DMA_IRQ_1 = 12,
+};
+
+typedef void (*irq_handler_t)(void);
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,139 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/pio.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_PIO_H
+#define _HARDWARE_PIO_H
+
+#include "pico/types.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/pio_instructions.h"
+
+#define NUM_PIO_STATE_MACHINES 4
+
+#define PIO_FDEBUG_TXSTALL_LSB 24
+
+// FDEBUG reads the emulator's flags, and writing 1s clears them (hal_shim.cpp)
+struct pio_shim_fdebug
+{
+    operator uint32_t() const;
+    pio_shim_fdebug &operator=(uint32_t clear_mask);
+};
+
+// The FIFO registers are only used as DMA addresses; hal_shim.cpp maps them onto the emulator
+typedef struct
+{
+    io_rw_32 ctrl;
+    io_ro_32 fstat;
+    pio_shim_fdebug fdebug;
+    io_ro_32 flevel;
+    io_wo_32 txf[NUM_PIO_STATE_MACHINES];
+    io_ro_32 rxf[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t pio_shim_blocks[2];
+#define pio0_hw (&pio_shim_blocks[0])
+#define pio1_hw (&pio_shim_blocks[1])
+#define pio0 pio0_hw
+#define pio1 pio1_hw
+
+typedef struct pio_program
+{
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+typedef struct
+{
+    uint wrap_target;
+    uint wrap;
+    uint sideset_bits;
+    bool sideset_optional;
+    bool sideset_pindirs;
+    uint sideset_base;
+    uint out_base;
+    uint out_count;
+    uint set_base;
+    uint set_count;
+    uint in_base;
+    uint jmp_pin;
+    bool in_shift_right;
+    bool out_shift_right;
+    uint16_t clkdiv_int;
+    uint8_t clkdiv_frac;
+} pio_sm_config;
+
+enum pio_interrupt_source
+{
+    pis_sm0_rx_fifo_not_empty = 0,
+    pis_sm1_rx_fifo_not_empty = 1,
+    pis_sm2_rx_fifo_not_empty = 2,
+    pis_sm3_rx_fifo_not_empty = 3,
+};
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count);
+void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count);
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base);
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin);
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold);
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold);
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac);
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+void pio_gpio_init(PIO pio, uint pin);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled);
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+static inline bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) { return pio_sm_get_tx_fifo_level(pio, sm) >= 4; }
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_drain_tx_fifo(PIO pio, uint sm);
+void pio_claim_sm_mask(PIO pio, uint sm_mask);
+void pio_sm_unclaim(PIO pio, uint sm);
+bool pio_sm_is_claimed(PIO pio, uint sm);
+// Only the RX FIFO not empty sources are emulated
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled);
+void pio_set_irq0_source_mask_enabled(PIO pio, uint32_t source_mask, bool enabled);
+
+PICO_SHIM_EXTERN_C_END
+
+static inline uint pio_get_index(PIO pio)
+{
+    return pio == pio1 ? 1 : 0;
+}
+
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return (pio == pio1 ? DREQ_PIO1_TX0 : DREQ_PIO0_TX0) + sm + (is_tx ? 0 : NUM_PIO_STATE_MACHINES);
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/pio_instructions.h                                         #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_PIO_INSTRUCTIONS_H
+#define _HARDWARE_PIO_INSTRUCTIONS_H
+
+#include "pico/types.h"
+
+// Only the encoders used by the firmware (same encodings as the SDK)
+
+static inline uint pio_encode_jmp(uint addr)
+{
+    return 0x0000u | (addr & 0x1fu);
+}
+
+static inline uint pio_encode_sideset_opt(uint sideset_bit_count, uint value)
+{
+    return 0x1000u | value << (12u - sideset_bit_count);
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/pll.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_PLL_H
+#define _HARDWARE_PLL_H
+
+// Nothing in here is used directly by the firmware
+
+#include "pico/types.h"
+
+#endif
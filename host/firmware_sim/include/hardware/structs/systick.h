@@ -0,0 +1,38 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/structs/systick.h                                          #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_STRUCTS_SYSTICK_H
+#define _HARDWARE_STRUCTS_SYSTICK_H
+
+#include "pico/types.h"
+
+typedef struct
+{
+    io_rw_32 csr;
+    io_rw_32 rvr;
+    io_rw_32 cvr;
+    io_ro_32 calib;
+} systick_hw_t;
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+// Returns the registers with cvr counting down from 0xffffff at clk_sys (on the host clock)
+systick_hw_t *systick_shim_sample(void);
+
+PICO_SHIM_EXTERN_C_END
+
+#define systick_hw (systick_shim_sample())
+
+#endif
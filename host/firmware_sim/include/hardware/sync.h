@@ -0,0 +1,44 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/sync.h                                                     #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_SYNC_H
+#define _HARDWARE_SYNC_H
+
+#include "pico/types.h"
+
+#define NUM_SPIN_LOCKS 32
+
+typedef volatile uint32_t spin_lock_t;
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+// Sleep until an event (__sev or an interrupt) has happened since the last __wfe
+void __wfe(void);
+void __sev(void);
+void __dmb(void);
+
+// The emulator is held while interrupts are disabled (which also holds back the
+// interrupt handlers), so no PIO cycles pass until they are restored
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+int spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_instance(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,34 @@
+/*
+#######################################################################
+#                                                                     #
+# hardware/timer.h                                                    #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _HARDWARE_TIMER_H
+#define _HARDWARE_TIMER_H
+
+#include "pico/types.h"
+
+// Callbacks are called from a thread of their own, which stands in for the alarm's IRQ
+// (hal_shim.cpp). Returning from one wakes the cores from __wfe, like an interrupt would.
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+void hardware_alarm_cancel(uint alarm_num);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
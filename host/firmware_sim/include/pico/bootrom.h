@@ -0,0 +1,28 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/bootrom.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_BOOTROM_H
+#define _PICO_BOOTROM_H
+
+#include "pico/types.h"
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+// Exits the simulator (there is no bootloader to reboot into)
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,31 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/multicore.h                                                    #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_MULTICORE_H
+#define _PICO_MULTICORE_H
+
+#include "pico/types.h"
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+// Core 1 runs on its own host thread
+void multicore_launch_core1(void (*entry)(void));
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking(void);
+uint get_core_num(void);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
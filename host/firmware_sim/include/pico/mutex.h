@@ -0,0 +1,36 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/mutex.h                                                        #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_MUTEX_H
+#define _PICO_MUTEX_H
+
+#include <pthread.h>
+
+#include "pico/types.h"
+
+typedef struct
+{
+    pthread_mutex_t lock;
+} mutex_t;
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+void mutex_init(mutex_t *mtx);
+void mutex_enter_blocking(mutex_t *mtx);
+void mutex_exit(mutex_t *mtx);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,27 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/platform.h                                                     #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_PLATFORM_H
+#define _PICO_PLATFORM_H
+
+#include "pico/types.h"
+
+// There is no flash on the host, so code placement is ignored
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+
+static inline void tight_loop_contents(void) {}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/stdlib.h                                                       #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_STDLIB_H
+#define _PICO_STDLIB_H
+
+#include <stdio.h>
+
+#include "pico/types.h"
+#include "pico/platform.h"
+#include "pico/mutex.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,33 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/time.h                                                         #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_TIME_H
+#define _PICO_TIME_H
+
+#include "pico/types.h"
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+
+PICO_SHIM_EXTERN_C_END
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us)
+{
+    return time_us_64() + us;
+}
+
+#endif
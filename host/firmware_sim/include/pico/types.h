@@ -0,0 +1,47 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/types.h                                                        #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Host stand in for the parts of the pico SDK used by the PrawnBlaster firmware.
+
+  Only the functions and types the firmware actually uses are provided. They are
+  implemented by hal_shim.cpp on top of the PIO emulator (see host/pio_emulator).
+ */
+#ifndef _PICO_TYPES_H
+#define _PICO_TYPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+// Microseconds since boot
+typedef uint64_t absolute_time_t;
+
+typedef volatile uint32_t io_rw_32;
+typedef const volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
+
+#ifdef __cplusplus
+#define PICO_SHIM_EXTERN_C_BEGIN extern "C" {
+#define PICO_SHIM_EXTERN_C_END }
+#else
+#define PICO_SHIM_EXTERN_C_BEGIN
+#define PICO_SHIM_EXTERN_C_END
+#endif
+
+#define PICO_NO_HARDWARE 0
+
+#endif
@@ -0,0 +1,29 @@
+/*
+#######################################################################
+#                                                                     #
+# pico/unique_id.h                                                    #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#ifndef _PICO_UNIQUE_ID_H
+#define _PICO_UNIQUE_ID_H
+
+#include "pico/types.h"
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+void pico_get_unique_board_id_string(char *id_out, uint len);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,91 @@
+/*
+#######################################################################
+#                                                                     #
+# tusb.h                                                              #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Host stand in for the TinyUSB CDC device API used by fast_serial.
+
+  The CDC interface is backed by a pseudo-terminal (see cdc_shim.cpp). The descriptor
+  types and macros are only here so that fast_serial.c compiles unmodified.
+ */
+#ifndef _TUSB_H_
+#define _TUSB_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/types.h"
+
+#define CFG_TUD_ENDPOINT0_SIZE 64
+#define CFG_TUD_CDC_RX_BUFSIZE 64
+#define CFG_TUD_CDC_TX_BUFSIZE 64
+
+typedef struct __attribute__((packed))
+{
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t iManufacturer;
+    uint8_t iProduct;
+    uint8_t iSerialNumber;
+    uint8_t bNumConfigurations;
+} tusb_desc_device_t;
+
+#define TUSB_DESC_DEVICE 0x01
+#define TUSB_DESC_CONFIGURATION 0x02
+#define TUSB_DESC_STRING 0x03
+#define TUSB_CLASS_MISC 0xef
+#define MISC_SUBCLASS_COMMON 2
+#define MISC_PROTOCOL_IAD 1
+
+#define TU_U16_LOW(u16) ((uint8_t)((u16)&0xff))
+#define TU_U16_HIGH(u16) ((uint8_t)(((u16) >> 8) & 0xff))
+
+#define TUD_CONFIG_DESC_LEN (9)
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma) \
+    9, TUSB_DESC_CONFIGURATION, TU_U16_LOW(_total_len), TU_U16_HIGH(_total_len), _itfcount, config_num, _stridx, (1 << 7) | (_attribute), (_power_ma) / 2
+
+// The CDC descriptor contents are irrelevant on the host, only the length is kept
+#define TUD_CDC_DESC_LEN (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
+#define TUD_CDC_DESCRIPTOR(_itfnum, _stridx, _ep_notif, _ep_notif_size, _epout, _epin, _epsize) \
+    8, 0x0b, _itfnum, 2, 0x02, 0x02, 0, 0, 9, 0x04, _itfnum, 0, 1, 0x02, 0x02, 0, _stridx,      \
+        5, 0x24, 0x00, 0x20, 0x01, 5, 0x24, 0x01, 0, (uint8_t)((_itfnum) + 1), 4, 0x24, 0x02, 2, \
+        5, 0x24, 0x06, _itfnum, (uint8_t)((_itfnum) + 1), 7, 0x05, _ep_notif, 0x03,               \
+        TU_U16_LOW(_ep_notif_size), TU_U16_HIGH(_ep_notif_size), 16, 9, 0x04,                     \
+        (uint8_t)((_itfnum) + 1), 0, 2, 0x0a, 0, 0, 0, 7, 0x05, _epout, 0x02, TU_U16_LOW(_epsize), \
+        TU_U16_HIGH(_epsize), 0, 7, 0x05, _epin, 0x02, TU_U16_LOW(_epsize), TU_U16_HIGH(_epsize), 0
+
+PICO_SHIM_EXTERN_C_BEGIN
+
+bool tusb_init(void);
+void tud_task(void);
+
+uint32_t tud_cdc_available(void);
+uint32_t tud_cdc_read(void *buffer, uint32_t bufsize);
+int32_t tud_cdc_read_char(void);
+void tud_cdc_read_flush(void);
+uint32_t tud_cdc_write(const void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_available(void);
+uint32_t tud_cdc_write_flush(void);
+
+PICO_SHIM_EXTERN_C_END
+
+#endif
@@ -0,0 +1,253 @@
+/*
+#######################################################################
+#                                                                     #
+# status_stress.cpp                                                   #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Stress test of the state shared between the firmware's two cores
+
+  Runs the firmware's own status functions (get_status, set_status and
+  status_compare_and_set) and wait count snapshots (set_num_processed_waits and
+  get_num_processed_waits) on two threads, which follow the same protocol as
+  core 0 (start/abort/getwait) and core 1 (running shots):
+      status_stress [--rounds <n>] [--seed <n>]
+
+  Every round, core 0 starts a shot and may try to abort it at a random point
+  while reading the wait counts core 1 keeps publishing. It checks that:
+    - an abort that was accepted always ends in ABORTED, and a shot that was not
+      aborted in STOPPED (no abort is lost, and none is reported for a stopped shot)
+    - core 1 only fails to start a shot when an abort was requested
+    - every wait count snapshot is consistent (not torn between two updates)
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "hardware/sync.h"
+
+// From prawnblaster.cpp
+#define STOPPED 0
+#define TRANSITION_TO_RUNNING 1
+#define RUNNING 2
+#define ABORT_REQUESTED 3
+#define ABORTING 4
+#define ABORTED 5
+#define TRANSITION_TO_STOP 6
+#define MAX_PSEUDOCLOCKS 6
+
+extern spin_lock_t *status_lock;
+int get_status();
+bool status_compare_and_set(int expected, int new_status);
+void set_status(int new_status);
+void set_num_processed_waits(unsigned int shot, const int *counts);
+int get_num_processed_waits(int pseudoclock, unsigned int *shot);
+
+namespace
+{
+
+// Core 0 asks core 1 to run a shot by bumping this (the firmware uses the multicore FIFO)
+std::atomic<unsigned> start_requests(0);
+std::atomic<bool> finished(false);
+std::atomic<unsigned> failures(0);
+
+// Wait count published in update number update for a pseudoclock (any function that
+// differs between updates and pseudoclocks will do)
+int wait_count_for(unsigned update, int pseudoclock)
+{
+    return static_cast<int>((update % 100000) * MAX_PSEUDOCLOCKS + pseudoclock);
+}
+
+void fail(const std::string &message)
+{
+    if (failures++ < 10)
+    {
+        fprintf(stderr, "%s\n", message.c_str());
+    }
+}
+
+// Busy wait. Yielding lets the other thread run in between even with a single CPU.
+void spin(unsigned iterations)
+{
+    for (volatile unsigned i = 0; i < iterations; i++)
+    {
+        if (i % 16 == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Mirrors core1_entry: start the shot unless it was aborted first, publish wait counts
+// while it runs, then move to ABORTING or TRANSITION_TO_STOP (whichever applies) and finish
+void core1(uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    unsigned handled = 0;
+    unsigned update = 0;
+    while (true)
+    {
+        while (start_requests.load() == handled)
+        {
+            if (finished.load())
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        handled++;
+
+        if (status_compare_and_set(TRANSITION_TO_RUNNING, RUNNING))
+        {
+            unsigned updates = std::uniform_int_distribution<unsigned>(0, 50)(rng);
+            for (unsigned u = 0; u < updates && get_status() == RUNNING; u++)
+            {
+                int counts[MAX_PSEUDOCLOCKS];
+                update++;
+                for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+                {
+                    counts[i] = wait_count_for(update, i);
+                }
+                set_num_processed_waits(update, counts);
+                spin(std::uniform_int_distribution<unsigned>(0, 200)(rng));
+            }
+        }
+        else if (get_status() != ABORT_REQUESTED)
+        {
+            fail("core 1 could not start a shot in status " + std::to_string(get_status()));
+        }
+
+        bool aborting;
+        while (true)
+        {
+            if (status_compare_and_set(ABORT_REQUESTED, ABORTING))
+            {
+                aborting = true;
+                break;
+            }
+            if (status_compare_and_set(RUNNING, TRANSITION_TO_STOP))
+            {
+                aborting = false;
+                break;
+            }
+        }
+        set_status(aborting ? ABORTED : STOPPED);
+    }
+}
+
+// Check one snapshot of the wait counts (as getwait would take it)
+void check_wait_counts(int pseudoclock, unsigned &last_update)
+{
+    unsigned update;
+    int count = get_num_processed_waits(pseudoclock, &update);
+    if (update == 0)
+    {
+        // Nothing published yet
+        return;
+    }
+    if (count != wait_count_for(update, pseudoclock))
+    {
+        fail("torn wait count snapshot: update " + std::to_string(update) + " pseudoclock " + std::to_string(pseudoclock) + " count " + std::to_string(count));
+    }
+    if (update < last_update)
+    {
+        fail("wait count snapshot went backwards from update " + std::to_string(last_update) + " to " + std::to_string(update));
+    }
+    last_update = update;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned rounds = 20000;
+    uint64_t seed = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--rounds" && i + 1 < argc)
+        {
+            rounds = static_cast<unsigned>(strtoul(argv[++i], nullptr, 0));
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = strtoull(argv[++i], nullptr, 0);
+        }
+        else
+        {
+            fprintf(stderr, "usage: status_stress [--rounds <n>] [--seed <n>]\n");
+            return 2;
+        }
+    }
+
+    // As in the firmware's main()
+    status_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    set_status(STOPPED);
+
+    std::thread core1_thread(core1, seed + 1);
+    std::mt19937_64 rng(seed);
+    unsigned aborted = 0;
+    unsigned last_update = 0;
+    for (unsigned round = 0; round < rounds && failures.load() == 0; round++)
+    {
+        // "start": the status is STOPPED or ABORTED here
+        set_status(TRANSITION_TO_RUNNING);
+        start_requests++;
+
+        // "abort" (as often as not), after a random delay during which "getwait" is used
+        bool try_abort = std::uniform_int_distribution<int>(0, 1)(rng);
+        unsigned delay = std::uniform_int_distribution<unsigned>(0, 2000)(rng);
+        int pseudoclock = 0;
+        for (unsigned spent = 0; spent < delay; spent += 50)
+        {
+            check_wait_counts(pseudoclock, last_update);
+            pseudoclock = (pseudoclock + 1) % MAX_PSEUDOCLOCKS;
+            spin(50);
+        }
+        bool abort_accepted = false;
+        if (try_abort)
+        {
+            abort_accepted = status_compare_and_set(RUNNING, ABORT_REQUESTED) || status_compare_and_set(TRANSITION_TO_RUNNING, ABORT_REQUESTED);
+        }
+
+        int status;
+        auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((status = get_status()) != STOPPED && status != ABORTED && std::chrono::steady_clock::now() < give_up)
+        {
+            check_wait_counts(pseudoclock, last_update);
+            pseudoclock = (pseudoclock + 1) % MAX_PSEUDOCLOCKS;
+            std::this_thread::yield();
+        }
+        if (status != STOPPED && status != ABORTED)
+        {
+            fail("round " + std::to_string(round) + ": the shot never finished (status " + std::to_string(status) + ")");
+            // core 1 may be stuck too
+            core1_thread.detach();
+            return 1;
+        }
+        if (status != (abort_accepted ? ABORTED : STOPPED))
+        {
+            fail("round " + std::to_string(round) + ": abort " + (abort_accepted ? "accepted" : try_abort ? "rejected" : "not requested") + " but the shot ended in status " + std::to_string(status));
+        }
+        aborted += abort_accepted;
+    }
+    finished = true;
+    core1_thread.join();
+
+    printf("%u rounds (%u aborted), %u failures\n", rounds, aborted, failures.load());
+    return failures.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,419 @@
+/*
+#######################################################################
+#                                                                     #
+# prawnblaster_bench.cpp                                              #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Serial protocol benchmarks for libprawnblaster
+
+      prawnblaster_bench [--port <path>] [--instructions <n>] [--shots <n>] [--polls <n>] [--json]
+
+  Without --port, a firmware simulator (prawnblaster_sim) is started and the
+  benchmark runs against its pseudo-terminal. The workloads are:
+
+      set-blocking       upload with "set", waiting for each "ok"
+      set-pipelined      upload with "set", all queued at once
+      setb-handshake     upload with "setb", waiting for "ready" before each payload
+      setb-pipelined     upload with "setb", payloads sent straight after the command
+      setb-coalesced     setb-pipelined with coalescing on, for a table of repeated instructions
+      get-blocking       read the table back with "get", one at a time
+      get-pipelined      read the table back with "get", all queued at once
+      getwait-readback   read back the 400 waits of a shot (one pipelined request per shot)
+      status-poll        "status", one at a time
+      shots-sequential   start, wait for the shot, read the waits, upload the next table
+      shots-overlapped   as above, with the readback and the next upload queued together
+
+  For each, the throughput and (where each operation is timed on its own) the
+  latency percentiles are reported, one line per workload, or as one JSON object
+  per line with --json. Uploads default to a full table.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "prawnblaster_client.h"
+#include "simulator_process.h"
+
+namespace
+{
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Throughput of a workload, and the time each operation took if they were timed one by one
+struct bench_result
+{
+    const char *name;
+    const char *unit;
+    size_t count = 0;
+    double seconds = 0;
+    std::vector<double> latencies;
+};
+
+bool json_output = false;
+
+// Nearest rank percentile, in microseconds
+double percentile(const std::vector<double> &sorted, double p)
+{
+    size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.5);
+    return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)] * 1e6;
+}
+
+void report(bench_result result)
+{
+    std::sort(result.latencies.begin(), result.latencies.end());
+    double rate = result.count / result.seconds;
+    if (json_output)
+    {
+        printf("{\"workload\": \"%s\", \"unit\": \"%s\", \"count\": %zu, \"seconds\": %.6f, \"rate\": %.1f", result.name, result.unit, result.count, result.seconds, rate);
+        if (!result.latencies.empty())
+        {
+            printf(", \"latency_us\": {\"samples\": %zu, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}", result.latencies.size(), percentile(result.latencies, 50), percentile(result.latencies, 90), percentile(result.latencies, 99), result.latencies.back() * 1e6);
+        }
+        printf("}\n");
+    }
+    else
+    {
+        printf("%-18s %8zu %-12s in %7.3f s: %10.1f/s", result.name, result.count, result.unit, result.seconds, rate);
+        if (!result.latencies.empty())
+        {
+            printf("  latency p50 %.0f us, p90 %.0f us, p99 %.0f us, max %.0f us", percentile(result.latencies, 50), percentile(result.latencies, 90), percentile(result.latencies, 99), result.latencies.back() * 1e6);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+std::vector<prawnblaster_instruction> make_table(size_t length, size_t wait_every, size_t repeat = 1)
+{
+    std::vector<prawnblaster_instruction> table;
+    for (size_t i = 0; i + 1 < length; i++)
+    {
+        size_t n = i / repeat;
+        if (wait_every && n % wait_every == wait_every - 1)
+        {
+            // Nothing triggers the simulator, so these time out
+            table.push_back(prawnblaster_instruction::wait(10));
+        }
+        else
+        {
+            table.push_back(prawnblaster_instruction::pulses(5 + n % 7, 1 + n % 3));
+        }
+    }
+    table.push_back(prawnblaster_instruction::stop());
+    return table;
+}
+
+std::string set_command(size_t addr, const prawnblaster_instruction &instruction)
+{
+    return "set 0 " + std::to_string(addr) + " " + std::to_string(instruction.half_period) + " " + std::to_string(instruction.reps);
+}
+
+void bench_set_blocking(prawnblaster_client &device, const std::vector<prawnblaster_instruction> &table)
+{
+    bench_result result{"set-blocking", "instructions"};
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        auto sent = bench_clock::now();
+        device.command_ok(set_command(i, table[i])).get();
+        result.latencies.push_back(seconds_since(sent));
+    }
+    result.seconds = seconds_since(start);
+    result.count = table.size();
+    report(result);
+}
+
+void bench_set_pipelined(prawnblaster_client &device, const std::vector<prawnblaster_instruction> &table)
+{
+    bench_result result{"set-pipelined", "instructions"};
+    auto start = bench_clock::now();
+    std::string data;
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        data += set_command(i, table[i]) + "\n";
+    }
+    for (const std::string &line : device.request(std::move(data), static_cast<int>(table.size())).get())
+    {
+        if (line != "ok")
+        {
+            throw prawnblaster_error("set: " + line);
+        }
+    }
+    result.seconds = seconds_since(start);
+    result.count = table.size();
+    report(result);
+}
+
+void bench_setb_handshake(prawnblaster_client &device, const std::vector<prawnblaster_instruction> &table)
+{
+    bench_result result{"setb-handshake", "instructions"};
+    auto start = bench_clock::now();
+    for (size_t first = 0; first < table.size(); first += prawnblaster_client::upload_chunk_size)
+    {
+        auto sent = bench_clock::now();
+        size_t count = std::min<size_t>(prawnblaster_client::upload_chunk_size, table.size() - first);
+        if (device.command("setb 0 " + std::to_string(first) + " " + std::to_string(count)).get() != "ready")
+        {
+            throw prawnblaster_error("setb was not accepted");
+        }
+        if (device.request(prawnblaster_setb_payload(&table[first], count), 1).get()[0] != "ok")
+        {
+            throw prawnblaster_error("setb payload was not accepted");
+        }
+        result.latencies.push_back(seconds_since(sent));
+    }
+    result.seconds = seconds_since(start);
+    result.count = table.size();
+    report(result);
+}
+
+void bench_setb_pipelined(prawnblaster_client &device, const std::vector<prawnblaster_instruction> &table, bool coalesced)
+{
+    bench_result result{coalesced ? "setb-coalesced" : "setb-pipelined", "instructions"};
+    if (coalesced)
+    {
+        device.set_coalescing(0, true).get();
+    }
+    auto start = bench_clock::now();
+    device.upload(0, table).get();
+    result.seconds = seconds_since(start);
+    result.count = table.size();
+    if (coalesced)
+    {
+        device.set_coalescing(0, false).get();
+    }
+    report(result);
+}
+
+// Check each "get" response against the table that was uploaded
+void check_get(const std::string &line, const prawnblaster_instruction &expected, size_t addr)
+{
+    if (line != std::to_string(expected.half_period) + " " + std::to_string(expected.reps))
+    {
+        throw prawnblaster_error("get 0 " + std::to_string(addr) + ": " + line);
+    }
+}
+
+void bench_get(prawnblaster_client &device, const std::vector<prawnblaster_instruction> &table, bool pipelined)
+{
+    bench_result result{pipelined ? "get-pipelined" : "get-blocking", "instructions"};
+    auto start = bench_clock::now();
+    if (pipelined)
+    {
+        std::string data;
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            data += "get 0 " + std::to_string(i) + "\n";
+        }
+        std::vector<std::string> lines = device.request(std::move(data), static_cast<int>(table.size())).get();
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            check_get(lines[i], table[i], i);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            auto sent = bench_clock::now();
+            std::string line = device.command("get 0 " + std::to_string(i)).get();
+            result.latencies.push_back(seconds_since(sent));
+            check_get(line, table[i], i);
+        }
+    }
+    result.seconds = seconds_since(start);
+    result.count = table.size();
+    report(result);
+}
+
+// One value per wait plus one for the stop instruction
+int count_waits(const std::vector<prawnblaster_instruction> &table)
+{
+    int wait_count = 1;
+    for (const prawnblaster_instruction &instruction : table)
+    {
+        wait_count += instruction.is_wait() ? 1 : 0;
+    }
+    return wait_count;
+}
+
+void bench_getwait_readback(prawnblaster_client &device, int shots)
+{
+    // 400 waits, each between two pulses
+    const int waits = 400;
+    std::vector<prawnblaster_instruction> table = make_table(2 * waits + 2, 2);
+    int wait_count = count_waits(table);
+    device.upload(0, table).get();
+
+    bench_result result{"getwait-readback", "waits"};
+    for (int shot = 0; shot < shots; shot++)
+    {
+        device.start().get();
+        device.wait_for_shot();
+        auto sent = bench_clock::now();
+        device.read_waits(0, wait_count).get();
+        double elapsed = seconds_since(sent);
+        result.latencies.push_back(elapsed);
+        result.seconds += elapsed;
+        result.count += wait_count;
+    }
+    report(result);
+}
+
+void bench_status(prawnblaster_client &device, int polls)
+{
+    bench_result result{"status-poll", "commands"};
+    auto start = bench_clock::now();
+    for (int i = 0; i < polls; i++)
+    {
+        auto sent = bench_clock::now();
+        device.status().get();
+        result.latencies.push_back(seconds_since(sent));
+    }
+    result.seconds = seconds_since(start);
+    result.count = polls;
+    report(result);
+}
+
+void bench_shots(prawnblaster_client &device, int shots, bool overlap)
+{
+    const size_t wait_every = 100;
+    std::vector<prawnblaster_instruction> table = make_table(1000, wait_every);
+    int wait_count = count_waits(table);
+
+    bench_result result{overlap ? "shots-overlapped" : "shots-sequential", "shots"};
+    auto start = bench_clock::now();
+    device.upload(0, table).get();
+    for (int shot = 0; shot < shots; shot++)
+    {
+        auto shot_start = bench_clock::now();
+        device.start().get();
+        device.wait_for_shot();
+        bool last = shot == shots - 1;
+        if (overlap)
+        {
+            // Queue the readback and the next upload together, then collect both
+            auto waits = device.read_waits(0, wait_count);
+            std::future<void> upload;
+            if (!last)
+            {
+                upload = device.upload(0, table);
+            }
+            waits.get();
+            if (!last)
+            {
+                upload.get();
+            }
+        }
+        else
+        {
+            device.read_waits(0, wait_count).get();
+            if (!last)
+            {
+                device.upload(0, table).get();
+            }
+        }
+        result.latencies.push_back(seconds_since(shot_start));
+    }
+    result.seconds = seconds_since(start);
+    result.count = shots;
+    report(result);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string port;
+    size_t instructions = PRAWNBLASTER_MAX_INSTRUCTIONS - 1;
+    int shots = 50;
+    int polls = 1000;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--port") == 0)
+        {
+            port = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--instructions") == 0)
+        {
+            instructions = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--shots") == 0)
+        {
+            shots = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--polls") == 0)
+        {
+            polls = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            json_output = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: prawnblaster_bench [--port <path>] [--instructions <n>] [--shots <n>] [--polls <n>] [--json]\n");
+            return 2;
+        }
+    }
+
+    try
+    {
+        std::unique_ptr<simulator_process> simulator;
+        if (port.empty())
+        {
+            simulator.reset(new simulator_process(PRAWNBLASTER_SIM_PATH));
+            port = simulator->port;
+            if (!json_output)
+            {
+                printf("Using simulator on %s\n", port.c_str());
+            }
+        }
+        prawnblaster_client device(port);
+        std::string version = device.command("version").get();
+        if (!json_output)
+        {
+            printf("%s\n", version.c_str());
+        }
+
+        std::vector<prawnblaster_instruction> table = make_table(instructions, 0);
+        bench_set_blocking(device, table);
+        bench_set_pipelined(device, table);
+        bench_setb_handshake(device, table);
+        bench_setb_pipelined(device, table, false);
+        bench_get(device, table, false);
+        bench_get(device, table, true);
+        bench_setb_pipelined(device, make_table(instructions, 0, 8), true);
+        bench_getwait_readback(device, shots);
+        bench_status(device, polls);
+        bench_shots(device, shots, false);
+        bench_shots(device, shots, true);
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,777 @@
+/*
+#######################################################################
+#                                                                     #
+# prawnblaster_client.cpp                                             #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#include "prawnblaster_client.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "pseudoclock_encoding.h"
+
+namespace
+{
+
+// Bytes read from or written to the port per system call
+const size_t io_chunk_size = 16384;
+
+void append_u32_le(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+void append_u64_le(std::string &out, uint64_t value)
+{
+    append_u32_le(out, static_cast<uint32_t>(value));
+    append_u32_le(out, static_cast<uint32_t>(value >> 32));
+}
+
+void expect_ok(const std::string &command, const std::string &response)
+{
+    if (response != "ok")
+    {
+        throw prawnblaster_error(command + ": " + response);
+    }
+}
+
+// Check an instruction whose half period is in cycles of the divided clock
+void validate_divided(uint32_t half_period, uint32_t reps, uint32_t clock_divider)
+{
+    uint32_t words[2];
+    std::string units = clock_divider == PRAWNBLASTER_CLOCK_DIVIDER_ONE ? "" : " divided clock cycles";
+    switch (pseudoclock_encode(half_period, reps, words))
+    {
+    case PSEUDOCLOCK_ENCODE_OK:
+        return;
+    case PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT:
+        throw prawnblaster_error("half-period too short (" + std::to_string(half_period) + " < " + std::to_string(PSEUDOCLOCK_NON_LOOP_PATH_LENGTH) + units + ")");
+    default:
+        throw prawnblaster_error("invalid wait timeout (" + std::to_string(half_period) + " < " + std::to_string(PSEUDOCLOCK_MIN_WAIT_LENGTH) + units + ")");
+    }
+}
+
+// Decode the responses to a batch of "getwait"/"getshotwait"/"getexactwait" commands
+std::future<std::vector<uint32_t>> parse_waits(const std::string &command, std::future<std::vector<std::string>> response)
+{
+    return std::async(std::launch::deferred, [command, response = std::move(response)]() mutable {
+        std::vector<uint32_t> waits;
+        for (const std::string &line : response.get())
+        {
+            char *end;
+            unsigned long value = strtoul(line.c_str(), &end, 10);
+            if (line.empty() || *end != '\0')
+            {
+                throw prawnblaster_error(command + ": " + line);
+            }
+            waits.push_back(static_cast<uint32_t>(value));
+        }
+        return waits;
+    });
+}
+
+} // namespace
+
+void prawnblaster_validate(const prawnblaster_instruction &instruction, uint32_t clock_divider)
+{
+    uint32_t half_period;
+    if (!pseudoclock_divide_half_period(instruction.half_period, instruction.reps, clock_divider, &half_period))
+    {
+        throw prawnblaster_error("invalid wait timeout (" + std::to_string(half_period) + " < " + std::to_string(PSEUDOCLOCK_MIN_WAIT_LENGTH) + " divided clock cycles)");
+    }
+    validate_divided(half_period, instruction.reps, clock_divider);
+}
+
+void prawnblaster_validate(const prawnblaster_instruction64 &instruction, uint32_t clock_divider)
+{
+    uint64_t half_period;
+    if (!pseudoclock_divide_half_period64(instruction.half_period, instruction.reps, clock_divider, &half_period))
+    {
+        throw prawnblaster_error("invalid wait timeout (" + std::to_string(half_period) + " < " + std::to_string(PSEUDOCLOCK_MIN_WAIT_LENGTH) + " divided clock cycles)");
+    }
+    if (half_period > UINT32_MAX)
+    {
+        std::string units = clock_divider == PRAWNBLASTER_CLOCK_DIVIDER_ONE ? "" : " divided clock cycles";
+        throw prawnblaster_error("half-period too long (" + std::to_string(half_period) + " > " + std::to_string(UINT32_MAX) + units + ")");
+    }
+    // Every part of a split instruction has at least one rep
+    uint32_t reps = static_cast<uint32_t>(std::min<uint64_t>(instruction.reps, PSEUDOCLOCK_MAX_REPS));
+    validate_divided(static_cast<uint32_t>(half_period), reps, clock_divider);
+}
+
+std::string prawnblaster_setb_payload(const prawnblaster_instruction *instructions, size_t count)
+{
+    std::string payload;
+    payload.reserve(8 * count);
+    for (size_t i = 0; i < count; i++)
+    {
+        append_u32_le(payload, instructions[i].half_period);
+        append_u32_le(payload, instructions[i].reps);
+    }
+    return payload;
+}
+
+std::string prawnblaster_setb64_payload(const prawnblaster_instruction64 *instructions, size_t count)
+{
+    std::string payload;
+    payload.reserve(16 * count);
+    for (size_t i = 0; i < count; i++)
+    {
+        append_u64_le(payload, instructions[i].half_period);
+        append_u64_le(payload, instructions[i].reps);
+    }
+    return payload;
+}
+
+bool prawnblaster_parse_event(const std::string &line, prawnblaster_event &event)
+{
+    unsigned long time_us;
+    unsigned long value;
+    unsigned long index;
+    int pseudoclock;
+    if (sscanf(line.c_str(), "!status %lu %lu", &time_us, &value) == 2)
+    {
+        event = prawnblaster_event();
+        event.type = prawnblaster_event::STATUS;
+    }
+    else if (sscanf(line.c_str(), "!wait %lu %d %lu %lu", &time_us, &pseudoclock, &index, &value) == 4)
+    {
+        event = prawnblaster_event();
+        event.type = prawnblaster_event::WAIT;
+        event.pseudoclock = pseudoclock;
+        event.index = static_cast<uint32_t>(index);
+    }
+    else if (sscanf(line.c_str(), "!shot %lu %lu", &time_us, &index) == 2)
+    {
+        event = prawnblaster_event();
+        event.type = prawnblaster_event::SHOT;
+        event.index = static_cast<uint32_t>(index);
+        value = 0;
+    }
+    else if (sscanf(line.c_str(), "!lost %lu", &value) == 1)
+    {
+        event = prawnblaster_event();
+        event.type = prawnblaster_event::LOST;
+        time_us = 0;
+    }
+    else
+    {
+        return false;
+    }
+    event.time_us = static_cast<uint32_t>(time_us);
+    event.value = static_cast<uint32_t>(value);
+    return true;
+}
+
+prawnblaster_client::prawnblaster_client(const std::string &port)
+{
+    std::fill(std::begin(clock_dividers), std::end(clock_dividers), PRAWNBLASTER_CLOCK_DIVIDER_ONE);
+    fd = open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        throw prawnblaster_error("could not open " + port + ": " + strerror(errno));
+    }
+    // USB CDC ignores the baud rate, but the line discipline must not touch the data
+    struct termios settings;
+    if (tcgetattr(fd, &settings) == 0)
+    {
+        cfmakeraw(&settings);
+        tcsetattr(fd, TCSANOW, &settings);
+    }
+    if (pipe(wake_pipe) != 0)
+    {
+        close(fd);
+        throw prawnblaster_error(std::string("could not create pipe: ") + strerror(errno));
+    }
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    io_thread = std::thread(&prawnblaster_client::io_loop, this);
+}
+
+prawnblaster_client::~prawnblaster_client()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake();
+    io_thread.join();
+    fail_pending("connection closed");
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    close(fd);
+}
+
+void prawnblaster_client::wake()
+{
+    char c = 0;
+    (void)!write(wake_pipe[1], &c, 1);
+}
+
+std::future<std::vector<std::string>> prawnblaster_client::request(std::string data, int response_lines)
+{
+    return queue_request(std::move(data), std::string(), response_lines);
+}
+
+std::future<std::vector<std::string>> prawnblaster_client::queue_request(std::string data, std::string payload, int response_lines)
+{
+    std::future<std::vector<std::string>> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+        {
+            throw prawnblaster_error("connection closed");
+        }
+        bool awaits_ready = !payload.empty();
+        pending_response response;
+        response.lines = response_lines;
+        response.payload = std::move(payload);
+        result = response.promise.get_future();
+        if (response_lines > 0)
+        {
+            pending.push_back(std::move(response));
+        }
+        else
+        {
+            response.promise.set_value({});
+        }
+        queue_outgoing(std::move(data), awaits_ready);
+    }
+    wake();
+    return result;
+}
+
+void prawnblaster_client::queue_outgoing(std::string data, bool awaits_ready)
+{
+    // Nothing may overtake a payload that is still waiting for "ready"
+    if (awaiting_ready)
+    {
+        held.emplace_back(std::move(data), awaits_ready);
+        return;
+    }
+    outgoing += data;
+    awaiting_ready = awaits_ready;
+}
+
+void prawnblaster_client::release_held()
+{
+    awaiting_ready = false;
+    while (!held.empty() && !awaiting_ready)
+    {
+        outgoing += held.front().first;
+        awaiting_ready = held.front().second;
+        held.pop_front();
+    }
+}
+
+std::future<std::string> prawnblaster_client::command(const std::string &line)
+{
+    auto response = request(line + "\n", 1);
+    return std::async(std::launch::deferred, [response = std::move(response)]() mutable {
+        return response.get()[0];
+    });
+}
+
+std::future<void> prawnblaster_client::command_ok(const std::string &line)
+{
+    auto response = command(line);
+    return std::async(std::launch::deferred, [line, response = std::move(response)]() mutable {
+        expect_ok(line, response.get());
+    });
+}
+
+std::future<void> prawnblaster_client::upload(int pseudoclock, const std::vector<prawnblaster_instruction> &table, uint32_t start_addr)
+{
+    bool merged;
+    uint32_t clock_divider;
+    uint32_t max_instructions;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pseudoclock < 0 || pseudoclock >= num_pseudoclocks)
+        {
+            throw prawnblaster_error("pseudoclock " + std::to_string(pseudoclock) + " is not in use (" + std::to_string(num_pseudoclocks) + " pseudoclocks)");
+        }
+        merged = coalescing[pseudoclock];
+        clock_divider = clock_dividers[pseudoclock];
+        max_instructions = prawnblaster_instructions_per_pseudoclock(num_pseudoclocks);
+    }
+    // Coalesced tables are checked by the device, which knows how many slots they take
+    if (!merged && start_addr + table.size() > max_instructions)
+    {
+        throw prawnblaster_error("table does not fit in the device (" + std::to_string(start_addr) + " + " + std::to_string(table.size()) + " instructions, " + std::to_string(max_instructions) + " per pseudoclock)");
+    }
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        try
+        {
+            prawnblaster_validate(table[i], clock_divider);
+        }
+        catch (const prawnblaster_error &e)
+        {
+            throw prawnblaster_error("instruction " + std::to_string(i) + ": " + e.what());
+        }
+    }
+
+    // Each chunk gets "ready" and then "ok" once the payload has been processed
+    std::vector<std::future<std::vector<std::string>>> responses;
+    for (size_t first = 0; first < table.size(); first += upload_chunk_size)
+    {
+        size_t count = std::min<size_t>(upload_chunk_size, table.size() - first);
+        std::string data = "setb " + std::to_string(pseudoclock) + " " + std::to_string(start_addr + first) + " " + std::to_string(count) + "\n";
+        responses.push_back(queue_request(data, prawnblaster_setb_payload(&table[first], count), 2));
+    }
+    return std::async(std::launch::deferred, [responses = std::move(responses)]() mutable {
+        for (auto &response : responses)
+        {
+            // Only the error comes back if the command was rejected
+            std::vector<std::string> lines = response.get();
+            if (lines[0] != "ready")
+            {
+                throw prawnblaster_error("setb: " + lines[0]);
+            }
+            expect_ok("setb", lines[1]);
+        }
+    });
+}
+
+std::future<std::vector<uint32_t>> prawnblaster_client::upload_extended(int pseudoclock, const std::vector<prawnblaster_instruction64> &table, uint32_t start_addr)
+{
+    bool merged;
+    uint32_t clock_divider;
+    uint32_t max_instructions;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pseudoclock < 0 || pseudoclock >= num_pseudoclocks)
+        {
+            throw prawnblaster_error("pseudoclock " + std::to_string(pseudoclock) + " is not in use (" + std::to_string(num_pseudoclocks) + " pseudoclocks)");
+        }
+        merged = coalescing[pseudoclock];
+        clock_divider = clock_dividers[pseudoclock];
+        max_instructions = prawnblaster_instructions_per_pseudoclock(num_pseudoclocks);
+    }
+    // The device splits instructions the same way, so the addresses are known up front
+    // and every chunk can be sent straight away
+    std::vector<uint32_t> addresses;
+    uint64_t addr = start_addr;
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        try
+        {
+            prawnblaster_validate(table[i], clock_divider);
+        }
+        catch (const prawnblaster_error &e)
+        {
+            throw prawnblaster_error("instruction " + std::to_string(i) + ": " + e.what());
+        }
+        addresses.push_back(static_cast<uint32_t>(std::min<uint64_t>(addr, UINT32_MAX)));
+        addr += pseudoclock_split_count(table[i].reps);
+    }
+    if (!merged && addr > max_instructions)
+    {
+        throw prawnblaster_error("table does not fit in the device once split (" + std::to_string(addr) + " instructions, " + std::to_string(max_instructions) + " per pseudoclock)");
+    }
+
+    std::vector<std::pair<uint32_t, std::future<std::vector<std::string>>>> responses;
+    for (size_t first = 0; first < table.size(); first += upload_chunk_size)
+    {
+        size_t count = std::min<size_t>(upload_chunk_size, table.size() - first);
+        uint32_t next = first + count < table.size() ? addresses[first + count] : static_cast<uint32_t>(addr);
+        std::string data = "setb64 " + std::to_string(pseudoclock) + " " + std::to_string(addresses[first]) + " " + std::to_string(count) + "\n";
+        responses.emplace_back(next, queue_request(data, prawnblaster_setb64_payload(&table[first], count), 2));
+    }
+    return std::async(std::launch::deferred, [responses = std::move(responses), addresses]() mutable {
+        for (auto &response : responses)
+        {
+            std::vector<std::string> lines = response.second.get();
+            if (lines[0] != "ready")
+            {
+                throw prawnblaster_error("setb64: " + lines[0]);
+            }
+            if (lines[1] != "ok " + std::to_string(response.first))
+            {
+                throw prawnblaster_error("setb64: " + lines[1]);
+            }
+        }
+        return addresses;
+    });
+}
+
+std::future<uint32_t> prawnblaster_client::chirp(int pseudoclock, uint32_t start_addr, uint32_t half_period, int32_t delta, uint32_t count)
+{
+    if (count == 0)
+    {
+        throw prawnblaster_error("chirp: no pulses");
+    }
+    uint32_t clock_divider;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        clock_divider = clock_dividers[static_cast<unsigned>(pseudoclock) % PRAWNBLASTER_MAX_PSEUDOCLOCKS];
+    }
+    // The chirp is linear, so the first and last pulses are the shortest and longest
+    int64_t last = static_cast<int64_t>(half_period) + static_cast<int64_t>(delta) * (count - 1);
+    if (last < 0 || last > UINT32_MAX)
+    {
+        throw prawnblaster_error("chirp: half-period of the last pulse out of range (" + std::to_string(last) + ")");
+    }
+    try
+    {
+        prawnblaster_validate(prawnblaster_instruction::pulses(half_period, 1), clock_divider);
+        prawnblaster_validate(prawnblaster_instruction::pulses(static_cast<uint32_t>(last), 1), clock_divider);
+    }
+    catch (const prawnblaster_error &e)
+    {
+        throw prawnblaster_error(std::string("chirp: ") + e.what());
+    }
+
+    uint32_t next = start_addr + count;
+    auto response = command("chirp " + std::to_string(pseudoclock) + " " + std::to_string(start_addr) + " " + std::to_string(half_period) + " " + std::to_string(delta) + " " + std::to_string(count));
+    return std::async(std::launch::deferred, [response = std::move(response), next]() mutable {
+        std::string line = response.get();
+        if (line != "ok " + std::to_string(next))
+        {
+            throw prawnblaster_error("chirp: " + line);
+        }
+        return next;
+    });
+}
+
+std::future<void> prawnblaster_client::set_num_pseudoclocks(int count)
+{
+    if (count < 1 || count > PRAWNBLASTER_MAX_PSEUDOCLOCKS)
+    {
+        throw prawnblaster_error("setnumpseudoclocks: " + std::to_string(count) + " pseudoclocks");
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        num_pseudoclocks = count;
+        std::fill(std::begin(coalescing), std::end(coalescing), false);
+    }
+    return command_ok("setnumpseudoclocks " + std::to_string(count));
+}
+
+std::future<void> prawnblaster_client::set_coalescing(int pseudoclock, bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        coalescing[static_cast<unsigned>(pseudoclock) % PRAWNBLASTER_MAX_PSEUDOCLOCKS] = enabled;
+    }
+    return command_ok("setcoalesce " + std::to_string(pseudoclock) + " " + (enabled ? "1" : "0"));
+}
+
+std::future<void> prawnblaster_client::set_clock_divider(int pseudoclock, uint16_t div_int, uint8_t div_frac)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        clock_dividers[static_cast<unsigned>(pseudoclock) % PRAWNBLASTER_MAX_PSEUDOCLOCKS] = div_int * PRAWNBLASTER_CLOCK_DIVIDER_ONE + div_frac;
+    }
+    return command_ok("setclkdiv " + std::to_string(pseudoclock) + " " + std::to_string(div_int) + " " + std::to_string(div_frac));
+}
+
+std::future<void> prawnblaster_client::set_trigger(int pseudoclock, prawnblaster_trigger_mode mode)
+{
+    return command_ok("settrigger " + std::to_string(pseudoclock) + " " + std::to_string(static_cast<int>(mode)));
+}
+
+std::future<void> prawnblaster_client::set_output_inverted(int pseudoclock, bool inverted)
+{
+    return command_ok("setpolarity " + std::to_string(pseudoclock) + " " + (inverted ? "1" : "0"));
+}
+
+void prawnblaster_client::set_event_handler(std::function<void(const prawnblaster_event &)> handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    event_handler = std::move(handler);
+}
+
+std::future<prawnblaster_status> prawnblaster_client::status()
+{
+    auto response = command("status");
+    return std::async(std::launch::deferred, [response = std::move(response)]() mutable {
+        std::string line = response.get();
+        prawnblaster_status status;
+        if (sscanf(line.c_str(), "run-status:%d clock-status:%d", &status.run_status, &status.clock_status) != 2)
+        {
+            throw prawnblaster_error("status: " + line);
+        }
+        return status;
+    });
+}
+
+prawnblaster_status prawnblaster_client::wait_for_shot(std::chrono::milliseconds poll_interval)
+{
+    while (true)
+    {
+        prawnblaster_status current = status().get();
+        if (current.run_status == PRAWNBLASTER_STOPPED || current.run_status == PRAWNBLASTER_ABORTED)
+        {
+            return current;
+        }
+        std::this_thread::sleep_for(poll_interval);
+    }
+}
+
+std::future<std::vector<uint32_t>> prawnblaster_client::read_waits(int pseudoclock, int count)
+{
+    std::string data;
+    for (int i = 0; i < count; i++)
+    {
+        data += "getwait " + std::to_string(pseudoclock) + " " + std::to_string(i) + "\n";
+    }
+    return parse_waits("getwait", request(std::move(data), count));
+}
+
+std::future<std::vector<uint32_t>> prawnblaster_client::read_exact_waits(int pseudoclock, int count)
+{
+    std::string data;
+    for (int i = 0; i < count; i++)
+    {
+        data += "getexactwait " + std::to_string(pseudoclock) + " " + std::to_string(i) + "\n";
+    }
+    return parse_waits("getexactwait", request(std::move(data), count));
+}
+
+std::future<std::vector<uint32_t>> prawnblaster_client::read_shot_waits(int pseudoclock, uint32_t shot, int count)
+{
+    std::string data;
+    for (int i = 0; i < count; i++)
+    {
+        data += "getshotwait " + std::to_string(pseudoclock) + " " + std::to_string(shot) + " " + std::to_string(i) + "\n";
+    }
+    return parse_waits("getshotwait", request(std::move(data), count));
+}
+
+std::future<void> prawnblaster_client::hwstart(uint32_t shots)
+{
+    return command_ok(shots == 1 ? "hwstart" : "hwstart " + std::to_string(shots));
+}
+
+std::future<uint32_t> prawnblaster_client::shots_completed()
+{
+    auto response = command("getshots");
+    return std::async(std::launch::deferred, [response = std::move(response)]() mutable {
+        std::string line = response.get();
+        unsigned int completed;
+        unsigned int queued;
+        if (sscanf(line.c_str(), "completed:%u queued:%u", &completed, &queued) != 2)
+        {
+            throw prawnblaster_error("getshots: " + line);
+        }
+        return static_cast<uint32_t>(completed);
+    });
+}
+
+std::future<prawnblaster_health> prawnblaster_client::health(int pseudoclock)
+{
+    auto response = command("health " + std::to_string(pseudoclock));
+    return std::async(std::launch::deferred, [response = std::move(response)]() mutable {
+        std::string line = response.get();
+        prawnblaster_health health;
+        int first_instruction;
+        if (sscanf(line.c_str(), "stalls:%u first-instruction:%d shots:%u", &health.stalls, &first_instruction, &health.shots) != 3)
+        {
+            throw prawnblaster_error("health: " + line);
+        }
+        health.first_instruction = first_instruction;
+        return health;
+    });
+}
+
+std::future<void> prawnblaster_client::set_timestamps(int pseudoclock)
+{
+    return command_ok(pseudoclock < 0 ? "timestamps off" : "timestamps " + std::to_string(pseudoclock));
+}
+
+std::future<void> prawnblaster_client::set_capture(int pseudoclock)
+{
+    return command_ok(pseudoclock < 0 ? "capture off" : "capture " + std::to_string(pseudoclock));
+}
+
+std::future<std::vector<uint64_t>> prawnblaster_client::read_timestamps(int count)
+{
+    if (count < 0 || count > PRAWNBLASTER_MAX_TIMESTAMPS)
+    {
+        throw prawnblaster_error("invalid timestamp count");
+    }
+    auto response = request("gettimestamps 0 " + std::to_string(count) + "\n", count);
+    return std::async(std::launch::deferred, [response = std::move(response)]() mutable {
+        std::vector<uint64_t> timestamps;
+        for (const std::string &line : response.get())
+        {
+            char *end;
+            unsigned long long value = strtoull(line.c_str(), &end, 10);
+            if (line.empty() || *end != '\0')
+            {
+                throw prawnblaster_error("gettimestamps: " + line);
+            }
+            timestamps.push_back(static_cast<uint64_t>(value));
+        }
+        return timestamps;
+    });
+}
+
+void prawnblaster_client::io_loop()
+{
+    char buffer[io_chunk_size];
+    while (true)
+    {
+        bool want_write;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+            {
+                return;
+            }
+            want_write = outgoing_offset < outgoing.size();
+        }
+
+        struct pollfd fds[2] = {
+            {fd, static_cast<short>(POLLIN | (want_write ? POLLOUT : 0)), 0},
+            {wake_pipe[0], POLLIN, 0},
+        };
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fail_pending(std::string("poll failed: ") + strerror(errno));
+            return;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            while (read(wake_pipe[0], buffer, sizeof(buffer)) > 0)
+            {
+            }
+        }
+
+        if (fds[0].revents & POLLOUT)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t count = std::min(io_chunk_size, outgoing.size() - outgoing_offset);
+            ssize_t written = write(fd, outgoing.data() + outgoing_offset, count);
+            if (written > 0)
+            {
+                outgoing_offset += written;
+                if (outgoing_offset == outgoing.size())
+                {
+                    outgoing.clear();
+                    outgoing_offset = 0;
+                }
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            ssize_t count = read(fd, buffer, sizeof(buffer));
+            if (count > 0)
+            {
+                std::vector<prawnblaster_event> events;
+                std::function<void(const prawnblaster_event &)> handler;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (ssize_t i = 0; i < count; i++)
+                    {
+                        if (buffer[i] == '\n')
+                        {
+                            handle_line(partial_line, events);
+                            partial_line.clear();
+                        }
+                        else if (buffer[i] != '\r')
+                        {
+                            partial_line += buffer[i];
+                        }
+                    }
+                    handler = event_handler;
+                }
+                // Outside of the lock, so that the handler can queue commands
+                for (const prawnblaster_event &event : events)
+                {
+                    if (handler)
+                    {
+                        handler(event);
+                    }
+                }
+            }
+        }
+        else if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+        {
+            fail_pending("connection lost");
+            return;
+        }
+    }
+}
+
+void prawnblaster_client::handle_line(const std::string &line, std::vector<prawnblaster_event> &events)
+{
+    if (!line.empty() && line[0] == '!')
+    {
+        prawnblaster_event event;
+        if (prawnblaster_parse_event(line, event))
+        {
+            events.push_back(event);
+        }
+        return;
+    }
+    // Other lines nobody asked for are dropped (there should not be any outside of debug mode)
+    if (line.empty() || pending.empty())
+    {
+        return;
+    }
+    pending_response &response = pending.front();
+    response.received.push_back(line);
+    if (!response.payload.empty())
+    {
+        if (line == "ready")
+        {
+            outgoing += response.payload;
+            response.payload = std::string();
+            release_held();
+            return;
+        }
+        // The command was rejected: nothing more will come for it, and the payload must not
+        // be sent (the device would read it as commands)
+        response.lines = 1;
+        response.payload = std::string();
+        release_held();
+    }
+    if (static_cast<int>(response.received.size()) == response.lines)
+    {
+        response.promise.set_value(std::move(response.received));
+        pending.pop_front();
+    }
+}
+
+void prawnblaster_client::fail_pending(const std::string &reason)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (pending_response &response : pending)
+    {
+        response.promise.set_exception(std::make_exception_ptr(prawnblaster_error(reason)));
+    }
+    pending.clear();
+    held.clear();
+    awaiting_ready = false;
+}
@@ -0,0 +1,302 @@
+/*
+#######################################################################
+#                                                                     #
+# prawnblaster_client.h                                               #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  C++ client for the PrawnBlaster serial protocol
+
+  Commands are pipelined: every call queues its bytes immediately and returns a
+  future for the response, so uploads, shot control and wait readback can all be
+  in flight at once. The device processes commands strictly in order, so the
+  responses are matched to requests in order too. A background thread does all of
+  the I/O on the (non-blocking) serial port.
+
+  Tables are validated on the host with the firmware's own encoding rules before
+  being sent with "setb", so a rejected instruction never reaches the device.
+
+      prawnblaster_client device("/dev/ttyACM0");
+      std::vector<prawnblaster_instruction> table = {
+          prawnblaster_instruction::pulses(50, 1000),
+          prawnblaster_instruction::wait(1000000),
+          prawnblaster_instruction::pulses(10, 5),
+          prawnblaster_instruction::stop(),
+      };
+      device.upload(0, table).get();
+      device.start().get();
+
+  With "events on", the device also sends lines starting with "!" whenever the run
+  status changes or a wait completes. These are never mistaken for responses: they
+  are parsed and passed to the event handler instead (see set_event_handler).
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct prawnblaster_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// One pseudoclock instruction, in the units of the "set" command (system clock cycles)
+struct prawnblaster_instruction
+{
+    uint32_t half_period = 0;
+    uint32_t reps = 0;
+
+    // reps clock pulses, each high for half_period and low for half_period
+    static prawnblaster_instruction pulses(uint32_t half_period, uint32_t reps) { return {half_period, reps}; }
+    // Wait for a trigger, timing out after timeout clock cycles
+    static prawnblaster_instruction wait(uint32_t timeout) { return {timeout, 0}; }
+    // Wait for a trigger without a timeout (a single instruction, unlike two waits in a row)
+    static prawnblaster_instruction indefinite_wait() { return {1, 0}; }
+    static prawnblaster_instruction stop() { return {0, 0}; }
+
+    bool is_stop() const { return reps == 0 && half_period == 0; }
+    bool is_wait() const { return reps == 0 && half_period != 0; }
+};
+
+// An instruction for "setb64", which may be longer than a single instruction on the device.
+// Instructions with more than 2^32-1 reps are split into as few instructions as possible.
+// The half period only has to fit in 32 bits once divided by the clock divider.
+struct prawnblaster_instruction64
+{
+    uint64_t half_period = 0;
+    uint64_t reps = 0;
+};
+
+// Clock dividers (see prawnblaster_client::set_clock_divider) are in 1/256ths
+const uint32_t PRAWNBLASTER_CLOCK_DIVIDER_ONE = 256;
+
+// Throws prawnblaster_error if the instruction would be rejected by the firmware (for a
+// pseudoclock with the given clock divider)
+void prawnblaster_validate(const prawnblaster_instruction &instruction, uint32_t clock_divider = PRAWNBLASTER_CLOCK_DIVIDER_ONE);
+void prawnblaster_validate(const prawnblaster_instruction64 &instruction, uint32_t clock_divider = PRAWNBLASTER_CLOCK_DIVIDER_ONE);
+
+// Binary payload of a "setb" command (half period then reps, each a little endian uint32)
+std::string prawnblaster_setb_payload(const prawnblaster_instruction *instructions, size_t count);
+// Binary payload of a "setb64" command (half period then reps, each a little endian uint64)
+std::string prawnblaster_setb64_payload(const prawnblaster_instruction64 *instructions, size_t count);
+
+enum prawnblaster_run_status
+{
+    PRAWNBLASTER_STOPPED = 0,
+    PRAWNBLASTER_TRANSITION_TO_RUNNING = 1,
+    PRAWNBLASTER_RUNNING = 2,
+    PRAWNBLASTER_ABORT_REQUESTED = 3,
+    PRAWNBLASTER_ABORTING = 4,
+    PRAWNBLASTER_ABORTED = 5,
+    PRAWNBLASTER_TRANSITION_TO_STOP = 6,
+};
+
+struct prawnblaster_status
+{
+    int run_status;
+    int clock_status;
+};
+
+// TX FIFO underruns of a pseudoclock, as reported by "health"
+struct prawnblaster_health
+{
+    // Checks during the current (or last) shot that found the pseudoclock stalled
+    uint32_t stalls = 0;
+    // Instruction it was waiting for at the first of them, or -1 if there were none
+    int32_t first_instruction = -1;
+    // Shots of the current (or last) queue with at least one stall
+    uint32_t shots = 0;
+};
+
+// An unsolicited event sent in event mode ("events on")
+struct prawnblaster_event
+{
+    enum event_type
+    {
+        // The run status changed to value (a prawnblaster_run_status)
+        STATUS,
+        // Wait number index of pseudoclock completed, value is as reported by "getwait"
+        WAIT,
+        // Shot number index of a queue finished (see hwstart)
+        SHOT,
+        // value events were dropped because the device's queue was full
+        LOST,
+    };
+
+    event_type type;
+    // Device time (microseconds since boot, wraps every ~71 minutes); 0 for LOST
+    uint32_t time_us = 0;
+    int pseudoclock = 0;
+    uint32_t index = 0;
+    uint32_t value = 0;
+};
+
+// Parse an event line (starting with "!"). Returns false if it is not a valid event.
+bool prawnblaster_parse_event(const std::string &line, prawnblaster_event &event);
+
+// What ends a wait (see prawnblaster_client::set_trigger)
+enum prawnblaster_trigger_mode
+{
+    PRAWNBLASTER_TRIGGER_HIGH = 0,
+    PRAWNBLASTER_TRIGGER_LOW = 1,
+    PRAWNBLASTER_TRIGGER_RISING = 2,
+    PRAWNBLASTER_TRIGGER_FALLING = 3,
+};
+
+// Size of the instruction table on the device (shared by all pseudoclocks)
+const uint32_t PRAWNBLASTER_MAX_INSTRUCTIONS = 30000;
+
+// Most pseudoclocks the device can run at once (4 for firmware built with PRAWNBLASTER_BANKED_SRAM)
+const int PRAWNBLASTER_MAX_PSEUDOCLOCKS = 6;
+
+// Size of each pseudoclock's share of the instruction table when num_pseudoclocks are in use
+// (firmware built with PRAWNBLASTER_BANKED_SRAM has smaller tables, which only it checks)
+inline uint32_t prawnblaster_instructions_per_pseudoclock(int num_pseudoclocks)
+{
+    return PRAWNBLASTER_MAX_INSTRUCTIONS / static_cast<uint32_t>(num_pseudoclocks);
+}
+
+// Number of timestamps the device can record per shot
+const int PRAWNBLASTER_MAX_TIMESTAMPS = 400;
+
+// The value "getwait" reports for a wait that timed out
+const uint32_t PRAWNBLASTER_WAIT_TIMED_OUT = 0xffffffffu;
+
+class prawnblaster_client
+{
+public:
+    // Open a serial port (or pseudo-terminal) connected to a PrawnBlaster
+    explicit prawnblaster_client(const std::string &port);
+    ~prawnblaster_client();
+
+    prawnblaster_client(const prawnblaster_client &) = delete;
+    prawnblaster_client &operator=(const prawnblaster_client &) = delete;
+
+    // Queue raw bytes and collect the given number of response lines (without line endings)
+    std::future<std::vector<std::string>> request(std::string data, int response_lines);
+    // Send a command that replies with a single line
+    std::future<std::string> command(const std::string &line);
+    // Send a command that replies with "ok"
+    std::future<void> command_ok(const std::string &line);
+
+    // Upload a table with pipelined "setb" commands. The binary payload of each is only sent
+    // once the device has replied "ready" (anything queued after it is held back until then),
+    // so a rejected command fails the upload instead of its payload being read as commands.
+    std::future<void> upload(int pseudoclock, const std::vector<prawnblaster_instruction> &table, uint32_t start_addr = 0);
+    // Upload a table with pipelined "setb64" commands (sent as for upload). Returns the
+    // address on the device of (the first part of) each instruction.
+    std::future<std::vector<uint32_t>> upload_extended(int pseudoclock, const std::vector<prawnblaster_instruction64> &table, uint32_t start_addr = 0);
+    // Store a frequency sweep of count clock pulses at consecutive addresses ("chirp"): the
+    // first has a half period of half_period and each following one is delta longer. Only
+    // the command is sent, the device expands it. Returns the address after the last pulse.
+    std::future<uint32_t> chirp(int pseudoclock, uint32_t start_addr, uint32_t half_period, int32_t delta, uint32_t count);
+    // Set the number of pseudoclocks in use ("setnumpseudoclocks"). This clears the tables and
+    // turns coalescing off. Uploads are checked against each pseudoclock's share of the table
+    // (prawnblaster_instructions_per_pseudoclock), so use this rather than a raw command.
+    std::future<void> set_num_pseudoclocks(int count);
+    // Merge consecutive identical instructions on the device as they are uploaded ("setcoalesce").
+    // Tables must then be uploaded in order from address 0, but may be longer than the
+    // pseudoclock's share of the table as long as they fit once merged.
+    std::future<void> set_coalescing(int pseudoclock, bool enabled);
+    // Run a pseudoclock at the system clock divided by div_int + div_frac/256 ("setclkdiv").
+    // Instructions stay in system clock cycles, but are rounded to whole divided cycles
+    // (and must be at least as long in divided cycles). Set it before uploading the table:
+    // changing it clears the table on the device.
+    std::future<void> set_clock_divider(int pseudoclock, uint16_t div_int, uint8_t div_frac = 0);
+    // Set the level or edge of the trigger input that ends a wait ("settrigger")
+    std::future<void> set_trigger(int pseudoclock, prawnblaster_trigger_mode mode);
+    // Invert the output, so that it idles high ("setpolarity")
+    std::future<void> set_output_inverted(int pseudoclock, bool inverted);
+
+    std::future<void> start() { return command_ok("start"); }
+    // Run shots back to back, each on a hardware trigger (the device re-arms itself in between)
+    std::future<void> hwstart(uint32_t shots = 1);
+    std::future<void> abort() { return command_ok("abort"); }
+    std::future<prawnblaster_status> status();
+    // Poll the status until the shot has finished (stopped or aborted)
+    prawnblaster_status wait_for_shot(std::chrono::milliseconds poll_interval = std::chrono::milliseconds(1));
+
+    // Read back the first count waits of a pseudoclock (values as reported by "getwait")
+    std::future<std::vector<uint32_t>> read_waits(int pseudoclock, int count);
+    // Read back the lengths of the first count waits of a pseudoclock to a single clock cycle
+    // ("getexactwait", which needs set_timestamps(pseudoclock) before the shot)
+    std::future<std::vector<uint32_t>> read_exact_waits(int pseudoclock, int count);
+    // Read back the first count waits of a pseudoclock for one shot of a queue ("getshotwait")
+    std::future<std::vector<uint32_t>> read_shot_waits(int pseudoclock, uint32_t shot, int count);
+    // Number of shots of the current (or last) queue that have finished
+    std::future<uint32_t> shots_completed();
+    // Whether DMA kept up with the pseudoclock's instructions ("health")
+    std::future<prawnblaster_health> health(int pseudoclock);
+
+    // Timestamp the rising edges of a pseudoclock's trigger input during shots ("timestamps"), or -1 for off
+    std::future<void> set_timestamps(int pseudoclock);
+    // Timestamp the rising edges of a pseudoclock's own output instead ("capture"), or -1 for off
+    std::future<void> set_capture(int pseudoclock);
+    // Read back the first count timestamps, in clock cycles from the first rising edge of
+    // the pseudoclock output (see "gettimestamps")
+    std::future<std::vector<uint64_t>> read_timestamps(int count);
+
+    // Turn event mode on or off ("events on"/"events off")
+    std::future<void> enable_events(bool enabled) { return command_ok(enabled ? "events on" : "events off"); }
+    // Called on the I/O thread for every event received. It may queue commands, but must
+    // not wait for their responses (they are delivered by the same thread).
+    void set_event_handler(std::function<void(const prawnblaster_event &)> handler);
+
+    // Instructions per "setb" command
+    static const uint32_t upload_chunk_size = 4096;
+
+private:
+    struct pending_response
+    {
+        int lines;
+        std::vector<std::string> received;
+        std::promise<std::vector<std::string>> promise;
+        // Binary payload to send once the first line is "ready" (if any)
+        std::string payload;
+    };
+
+    int fd = -1;
+    int wake_pipe[2] = {-1, -1};
+    std::thread io_thread;
+
+    std::mutex mutex;
+    std::string outgoing;
+    size_t outgoing_offset = 0;
+    std::deque<pending_response> pending;
+    // Data queued while a payload waits for "ready", and whether it also waits for "ready"
+    std::deque<std::pair<std::string, bool>> held;
+    bool awaiting_ready = false;
+    std::string partial_line;
+    bool stopping = false;
+    int num_pseudoclocks = 1;
+    bool coalescing[PRAWNBLASTER_MAX_PSEUDOCLOCKS] = {};
+    uint32_t clock_dividers[PRAWNBLASTER_MAX_PSEUDOCLOCKS];
+    std::function<void(const prawnblaster_event &)> event_handler;
+
+    // As request, but payload (if not empty) is only sent once the first line is "ready"
+    std::future<std::vector<std::string>> queue_request(std::string data, std::string payload, int response_lines);
+    // Called with the mutex held
+    void queue_outgoing(std::string data, bool awaits_ready);
+    void release_held();
+    void io_loop();
+    void wake();
+    void handle_line(const std::string &line, std::vector<prawnblaster_event> &events);
+    void fail_pending(const std::string &reason);
+};
@@ -0,0 +1,319 @@
+/*
+#######################################################################
+#                                                                     #
+# prawnblaster_verify.cpp                                             #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Check a pseudoclock's output against the timeline its table should produce
+
+      prawnblaster_verify [--port <path>] [--pseudoclock <n>] [--clkdiv <int>[:<frac>]] [--coalesce] [table.txt]
+
+  The table file has one "<half period> <reps>" instruction per line (in the units of
+  the "set" command, "#" starts a comment) and is uploaded before the shot (for a
+  pseudoclock other than 0, after setting the number of pseudoclocks so that it is in
+  use, which clears the tables of the others), with the given clock divider and with
+  coalescing on if --coalesce is given. It is then read back with "get" and compared
+  with what was uploaded (rounded to whole cycles of the divided clock). A table with
+  an indefinite wait is only read back, not run. Without a table file, the table already
+  on the device is read back and used instead (which must not have a clock divider). Without
+  --port, a firmware simulator (prawnblaster_sim) is started.
+
+  The device captures the rising edges of the output during one shot ("capture") and
+  these are compared, to the clock cycle, with the timeline computed by the PIO emulator
+  harness. No triggers are sent, so every wait must time out. Only the first
+  PRAWNBLASTER_MAX_TIMESTAMPS + 1 rising edges are checked. Exits with status 1 on the
+  first mismatch.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "prawnblaster_client.h"
+#include "pseudoclock_encoding.h"
+#include "pseudoclock_harness.h"
+#include "simulator_process.h"
+
+namespace
+{
+
+std::vector<prawnblaster_instruction> load_table(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw prawnblaster_error("could not open " + path);
+    }
+    std::vector<prawnblaster_instruction> table;
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++)
+    {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        prawnblaster_instruction instruction;
+        std::string extra;
+        if (!(fields >> instruction.half_period >> instruction.reps) || fields >> extra)
+        {
+            throw prawnblaster_error(path + ":" + std::to_string(number) + ": expected <half period> <reps>");
+        }
+        table.push_back(instruction);
+    }
+    if (table.empty() || !table.back().is_stop())
+    {
+        table.push_back(prawnblaster_instruction::stop());
+    }
+    return table;
+}
+
+// Read the table of a pseudoclock back with pipelined "get" commands, up to the first stop
+std::vector<prawnblaster_instruction> read_table(prawnblaster_client &device, int pseudoclock)
+{
+    const uint32_t chunk = 256;
+    std::vector<prawnblaster_instruction> table;
+    for (uint32_t addr = 0; addr < PRAWNBLASTER_MAX_INSTRUCTIONS; addr += chunk)
+    {
+        std::string data;
+        int count = static_cast<int>(std::min(chunk, PRAWNBLASTER_MAX_INSTRUCTIONS - addr));
+        for (int i = 0; i < count; i++)
+        {
+            data += "get " + std::to_string(pseudoclock) + " " + std::to_string(addr + i) + "\n";
+        }
+        for (const std::string &line : device.request(std::move(data), count).get())
+        {
+            prawnblaster_instruction instruction;
+            if (sscanf(line.c_str(), "%u %u", &instruction.half_period, &instruction.reps) != 2)
+            {
+                // "invalid address" past the end of a pseudoclock's share of the table
+                table.push_back(prawnblaster_instruction::stop());
+                return table;
+            }
+            table.push_back(instruction);
+            if (instruction.is_stop())
+            {
+                return table;
+            }
+        }
+    }
+    table.push_back(prawnblaster_instruction::stop());
+    return table;
+}
+
+// The instruction as stored by a pseudoclock with the given clock divider, in cycles of its state machine
+uint32_t divided_half_period(const prawnblaster_instruction &instruction, uint32_t clock_divider)
+{
+    uint32_t divided;
+    pseudoclock_divide_half_period(instruction.half_period, instruction.reps, clock_divider, &divided);
+    return divided;
+}
+
+// The instruction as "get" reports it for a pseudoclock with the given clock divider
+// (waits are stored in wait loops, so are rounded further)
+prawnblaster_instruction read_back(const prawnblaster_instruction &instruction, uint32_t clock_divider)
+{
+    uint32_t words[2];
+    prawnblaster_instruction stored;
+    pseudoclock_encode(divided_half_period(instruction, clock_divider), instruction.reps, words);
+    pseudoclock_decode(words, &stored.half_period, &stored.reps);
+    if (!stored.is_wait() || stored.half_period != PSEUDOCLOCK_INDEFINITE_WAIT)
+    {
+        stored.half_period = static_cast<uint32_t>(pseudoclock_multiply_cycles(stored.half_period, clock_divider));
+    }
+    return stored;
+}
+
+// The start of the table that produces at most edges rising edges, ending with a stop
+pseudoclock_run truncated_run(const std::vector<prawnblaster_instruction> &table, uint32_t clock_divider, uint64_t edges, uint64_t &max_cycles)
+{
+    pseudoclock_run run;
+    run.clock_divider = clock_divider;
+    max_cycles = 1000;
+    for (const prawnblaster_instruction &instruction : table)
+    {
+        if (instruction.is_stop() || edges == 0)
+        {
+            break;
+        }
+        uint32_t reps = static_cast<uint32_t>(std::min<uint64_t>(instruction.reps, edges));
+        run.instructions.push_back({divided_half_period(instruction, clock_divider), reps});
+        edges -= reps;
+        max_cycles += instruction.is_wait() ? instruction.half_period + 100 : 2ull * instruction.half_period * reps;
+    }
+    run.instructions.push_back({0, 0});
+    return run;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string port;
+    std::string table_path;
+    int pseudoclock = 0;
+    unsigned div_int = 1;
+    unsigned div_frac = 0;
+    bool coalesce = false;
+    bool usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--port") == 0)
+        {
+            port = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--pseudoclock") == 0)
+        {
+            pseudoclock = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--clkdiv") == 0)
+        {
+            int parsed = sscanf(argv[++i], "%u:%u", &div_int, &div_frac);
+            usage |= parsed < 1 || div_int < 1 || div_int > 65535 || div_frac > 255;
+        }
+        else if (strcmp(argv[i], "--coalesce") == 0)
+        {
+            coalesce = true;
+        }
+        else if (argv[i][0] != '-' && table_path.empty())
+        {
+            table_path = argv[i];
+        }
+        else
+        {
+            usage = true;
+        }
+    }
+    // The table on the device is only used as it is
+    usage |= table_path.empty() && (coalesce || div_int != 1 || div_frac != 0);
+    if (usage)
+    {
+        fprintf(stderr, "usage: prawnblaster_verify [--port <path>] [--pseudoclock <n>] [--clkdiv <int>[:<frac>]] [--coalesce] [table.txt]\n");
+        return 2;
+    }
+    uint32_t clock_divider = div_int * PRAWNBLASTER_CLOCK_DIVIDER_ONE + div_frac;
+
+    try
+    {
+        std::unique_ptr<simulator_process> simulator;
+        if (port.empty())
+        {
+            simulator.reset(new simulator_process(PRAWNBLASTER_SIM_PATH));
+            port = simulator->port;
+            printf("Using simulator on %s\n", port.c_str());
+        }
+        prawnblaster_client device(port);
+
+        std::vector<prawnblaster_instruction> table;
+        if (!table_path.empty())
+        {
+            table = load_table(table_path);
+            if (pseudoclock > 0)
+            {
+                device.set_num_pseudoclocks(pseudoclock + 1).get();
+            }
+            device.set_coalescing(pseudoclock, coalesce).get();
+            device.set_clock_divider(pseudoclock, static_cast<uint16_t>(div_int), static_cast<uint8_t>(div_frac)).get();
+            device.upload(pseudoclock, table).get();
+
+            std::vector<prawnblaster_instruction> stored = read_table(device, pseudoclock);
+            for (size_t i = 0; i < std::max(table.size(), stored.size()); i++)
+            {
+                prawnblaster_instruction expected = i < table.size() ? read_back(table[i], clock_divider) : prawnblaster_instruction::stop();
+                prawnblaster_instruction actual = i < stored.size() ? stored[i] : prawnblaster_instruction::stop();
+                if (actual.half_period != expected.half_period || actual.reps != expected.reps)
+                {
+                    printf("instruction %zu: expected to read back %u %u, got %u %u\n", i, expected.half_period, expected.reps, actual.half_period, actual.reps);
+                    return 1;
+                }
+            }
+            printf("ok: %zu instructions read back\n", table.size());
+        }
+        else
+        {
+            table = read_table(device, pseudoclock);
+        }
+        if (table.front().is_stop())
+        {
+            throw prawnblaster_error("the table of pseudoclock " + std::to_string(pseudoclock) + " is empty");
+        }
+
+        // The first rising edge is the reference of the capture, so is not recorded
+        pseudoclock_timeline expected;
+        std::string error;
+        uint64_t max_cycles;
+        pseudoclock_run run = truncated_run(table, clock_divider, PRAWNBLASTER_MAX_TIMESTAMPS + 1, max_cycles);
+        if (!expected_timeline(run, false, false, max_cycles, expected, error))
+        {
+            throw prawnblaster_error(error);
+        }
+        if (!expected.completed)
+        {
+            if (!table_path.empty())
+            {
+                printf("not run: the table does not finish without triggers (it has an indefinite wait)\n");
+                return 0;
+            }
+            throw prawnblaster_error("the table does not finish without triggers (it has an indefinite wait)");
+        }
+        std::vector<uint64_t> expected_edges;
+        for (const pseudoclock_edge &edge : expected.edges)
+        {
+            if (edge.level == 1)
+            {
+                expected_edges.push_back(edge.cycle);
+            }
+        }
+        for (size_t i = expected_edges.size(); i-- > 0;)
+        {
+            expected_edges[i] -= expected_edges[0];
+        }
+
+        device.set_capture(pseudoclock).get();
+        device.start().get();
+        device.wait_for_shot();
+        uint32_t count = std::stoul(device.command("gettimestampcount").get());
+        std::vector<uint64_t> captured = device.read_timestamps(static_cast<int>(count)).get();
+        device.set_capture(-1).get();
+        captured.insert(captured.begin(), 0);
+
+        size_t checked = std::min(captured.size(), expected_edges.size());
+        for (size_t i = 0; i < checked; i++)
+        {
+            if (captured[i] != expected_edges[i])
+            {
+                printf("rising edge %zu: expected at cycle %llu, captured at cycle %llu\n", i, static_cast<unsigned long long>(expected_edges[i]), static_cast<unsigned long long>(captured[i]));
+                return 1;
+            }
+        }
+        if (captured.size() != expected_edges.size())
+        {
+            printf("expected %zu rising edges, captured %zu\n", expected_edges.size(), captured.size());
+            return 1;
+        }
+        printf("ok: %zu rising edges match\n", checked);
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+#######################################################################
+#                                                                     #
+# simulator_process.h                                                 #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Runs the firmware simulator (prawnblaster_sim) as a child process for the duration
+  of a host tool, so that it can be used without any hardware
+ */
+#pragma once
+
+#include <csignal>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "prawnblaster_client.h"
+
+// prawnblaster_sim running as a child process
+struct simulator_process
+{
+    pid_t pid = -1;
+    std::string port;
+
+    explicit simulator_process(const std::string &path)
+    {
+        int out[2];
+        if (pipe(out) != 0)
+        {
+            throw prawnblaster_error("could not create pipe");
+        }
+        pid = fork();
+        if (pid == 0)
+        {
+            dup2(out[1], STDOUT_FILENO);
+            close(out[0]);
+            close(out[1]);
+            execl(path.c_str(), path.c_str(), static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        close(out[1]);
+        // The first line is "PrawnBlaster simulator listening on <port>"
+        std::string line;
+        char c;
+        while (read(out[0], &c, 1) == 1 && c != '\n')
+        {
+            line += c;
+        }
+        close(out[0]);
+        size_t space = line.rfind(' ');
+        if (pid < 0 || space == std::string::npos)
+        {
+            throw prawnblaster_error("could not start " + path);
+        }
+        port = line.substr(space + 1);
+    }
+
+    ~simulator_process()
+    {
+        if (pid > 0)
+        {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+};
@@ -0,0 +1,57 @@
+/*
+#######################################################################
+#                                                                     #
+# pio_asm.cpp                                                         #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Stand in for pioasm when building the firmware for the host simulator:
+      pio_asm <input.pio> <output.h>
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "pio_assembler.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: pio_asm <input.pio> <output.h>\n");
+        return 2;
+    }
+    std::ifstream input(argv[1]);
+    if (!input)
+    {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+    std::stringstream source;
+    source << input.rdbuf();
+
+    std::string header;
+    try
+    {
+        header = pio_generate_c_sdk_header(pio_assemble(source.str()));
+    }
+    catch (const pio_assembler_error &e)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], e.what());
+        return 1;
+    }
+
+    std::ofstream output(argv[2]);
+    output << header;
+    return output ? 0 : 1;
+}
@@ -0,0 +1,750 @@
+/*
+#######################################################################
+#                                                                     #
+# pio_assembler.cpp                                                   #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#include "pio_assembler.h"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+struct source_line
+{
+    int line_number;
+    std::vector<std::string> tokens;
+    std::string label;
+    bool label_public = false;
+    int delay = -1;
+    std::string delay_expression;
+    std::string side_set_expression;
+};
+
+std::string lower(std::string s)
+{
+    for (auto &c : s)
+    {
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+    return s;
+}
+
+std::string trim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos)
+    {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(start, end - start + 1);
+}
+
+std::string strip_comment(const std::string &line)
+{
+    size_t pos = line.find(';');
+    size_t pos2 = line.find("//");
+    if (pos2 < pos)
+    {
+        pos = pos2;
+    }
+    return pos == std::string::npos ? line : line.substr(0, pos);
+}
+
+std::vector<std::string> tokenize(const std::string &text)
+{
+    std::vector<std::string> tokens;
+    std::string current;
+    for (char c : text)
+    {
+        if (std::isspace(static_cast<unsigned char>(c)) || c == ',')
+        {
+            if (!current.empty())
+            {
+                tokens.push_back(current);
+                current.clear();
+            }
+        }
+        else
+        {
+            current += c;
+        }
+    }
+    if (!current.empty())
+    {
+        tokens.push_back(current);
+    }
+    return tokens;
+}
+
+class assembler
+{
+public:
+    assembler(const std::string &source) : source(source) {}
+
+    std::vector<pio_program_info> run()
+    {
+        parse();
+        for (auto &p : programs)
+        {
+            encode_program(p);
+        }
+        std::vector<pio_program_info> result;
+        for (auto &p : programs)
+        {
+            result.push_back(p.info);
+        }
+        return result;
+    }
+
+private:
+    struct program_state
+    {
+        pio_program_info info;
+        std::vector<source_line> lines;
+        std::map<std::string, int> defines;
+    };
+
+    const std::string &source;
+    std::vector<program_state> programs;
+    std::map<std::string, int> global_defines;
+
+    [[noreturn]] void fail(int line_number, const std::string &msg)
+    {
+        throw pio_assembler_error("line " + std::to_string(line_number) + ": " + msg);
+    }
+
+    int parse_integer(const std::string &text, int line_number, const program_state *program)
+    {
+        std::string t = trim(text);
+        if (t.empty())
+        {
+            fail(line_number, "expected a value");
+        }
+        bool negative = false;
+        if (t[0] == '-')
+        {
+            negative = true;
+            t = t.substr(1);
+        }
+        long value;
+        if (std::isdigit(static_cast<unsigned char>(t[0])))
+        {
+            try
+            {
+                size_t used;
+                if (t.size() > 2 && (t[1] == 'b' || t[1] == 'B') && t[0] == '0')
+                {
+                    value = std::stol(t.substr(2), &used, 2);
+                    used += 2;
+                }
+                else
+                {
+                    value = std::stol(t, &used, 0);
+                }
+                if (used != t.size())
+                {
+                    fail(line_number, "invalid number '" + text + "'");
+                }
+            }
+            catch (const std::logic_error &)
+            {
+                fail(line_number, "invalid number '" + text + "'");
+            }
+        }
+        else if (program && program->defines.count(t))
+        {
+            value = program->defines.at(t);
+        }
+        else if (program && program->info.labels.count(t))
+        {
+            value = program->info.labels.at(t);
+        }
+        else if (global_defines.count(t))
+        {
+            value = global_defines.at(t);
+        }
+        else
+        {
+            fail(line_number, "unknown symbol '" + text + "'");
+        }
+        return negative ? -value : value;
+    }
+
+    // First pass: split the source into programs, strip comments, collect labels and directives
+    void parse()
+    {
+        std::istringstream stream(source);
+        std::string raw;
+        int line_number = 0;
+        bool in_code_block = false;
+        bool code_block_is_c_sdk = false;
+        program_state *program = nullptr;
+
+        while (std::getline(stream, raw))
+        {
+            line_number++;
+            if (in_code_block)
+            {
+                if (trim(raw).rfind("%}", 0) == 0)
+                {
+                    in_code_block = false;
+                }
+                else if (code_block_is_c_sdk && program)
+                {
+                    program->info.c_sdk_block += raw + "\n";
+                }
+                continue;
+            }
+
+            std::string line = trim(strip_comment(raw));
+            if (line.empty())
+            {
+                continue;
+            }
+
+            if (line[0] == '%')
+            {
+                // Start of a language specific code block, e.g. "% c-sdk {"
+                std::vector<std::string> tokens = tokenize(line.substr(1));
+                in_code_block = true;
+                code_block_is_c_sdk = !tokens.empty() && tokens[0] == "c-sdk";
+                continue;
+            }
+
+            // Labels
+            source_line parsed;
+            parsed.line_number = line_number;
+            size_t colon = line.find(':');
+            if (colon != std::string::npos && line.find("::") != colon)
+            {
+                std::vector<std::string> label_tokens = tokenize(line.substr(0, colon));
+                if (label_tokens.size() == 2 && label_tokens[0] == "public")
+                {
+                    parsed.label_public = true;
+                    label_tokens.erase(label_tokens.begin());
+                }
+                if (label_tokens.size() != 1)
+                {
+                    fail(line_number, "invalid label");
+                }
+                parsed.label = label_tokens[0];
+                line = trim(line.substr(colon + 1));
+            }
+
+            // Directives
+            if (!line.empty() && line[0] == '.')
+            {
+                std::vector<std::string> tokens = tokenize(line);
+                std::string directive = lower(tokens[0]);
+                if (directive == ".program")
+                {
+                    if (tokens.size() != 2)
+                    {
+                        fail(line_number, ".program requires a name");
+                    }
+                    programs.emplace_back();
+                    program = &programs.back();
+                    program->info.name = tokens[1];
+                }
+                else if (directive == ".define")
+                {
+                    size_t i = 1;
+                    if (i < tokens.size() && tokens[i] == "public")
+                    {
+                        i++;
+                    }
+                    if (tokens.size() != i + 2)
+                    {
+                        fail(line_number, ".define requires a name and a value");
+                    }
+                    int value = parse_integer(tokens[i + 1], line_number, program);
+                    if (program)
+                    {
+                        program->defines[tokens[i]] = value;
+                        if (i == 2)
+                        {
+                            program->info.public_symbols[tokens[i]] = value;
+                        }
+                    }
+                    else
+                    {
+                        global_defines[tokens[i]] = value;
+                    }
+                }
+                else if (!program)
+                {
+                    fail(line_number, "directive outside of a program");
+                }
+                else if (directive == ".side_set")
+                {
+                    if (tokens.size() < 2)
+                    {
+                        fail(line_number, ".side_set requires a bit count");
+                    }
+                    program->info.side_set_bits = parse_integer(tokens[1], line_number, program);
+                    for (size_t i = 2; i < tokens.size(); i++)
+                    {
+                        if (tokens[i] == "opt")
+                        {
+                            program->info.side_set_opt = true;
+                        }
+                        else if (tokens[i] == "pindirs")
+                        {
+                            program->info.side_set_pindirs = true;
+                        }
+                        else
+                        {
+                            fail(line_number, "unknown .side_set option '" + tokens[i] + "'");
+                        }
+                    }
+                    if (program->info.side_set_opt)
+                    {
+                        // The enable bit takes up one of the delay/side-set bits
+                        program->info.side_set_bits += 1;
+                    }
+                    if (program->info.side_set_bits > 5)
+                    {
+                        fail(line_number, "too many side-set bits");
+                    }
+                }
+                else if (directive == ".wrap_target")
+                {
+                    program->info.wrap_target = count_instructions(*program);
+                }
+                else if (directive == ".wrap")
+                {
+                    program->info.wrap = count_instructions(*program) - 1;
+                }
+                else if (directive == ".origin")
+                {
+                    program->info.origin = parse_integer(tokens.at(1), line_number, program);
+                }
+                else if (directive == ".lang_opt")
+                {
+                    // Only relevant to other output languages
+                }
+                else if (directive == ".word")
+                {
+                    parsed.tokens = tokens;
+                }
+                else
+                {
+                    fail(line_number, "unknown directive " + directive);
+                }
+                if (parsed.tokens.empty())
+                {
+                    if (!parsed.label.empty())
+                    {
+                        fail(line_number, "label before directive");
+                    }
+                    continue;
+                }
+            }
+            else if (!line.empty())
+            {
+                // Delay
+                size_t open = line.find('[');
+                if (open != std::string::npos)
+                {
+                    size_t close = line.find(']', open);
+                    if (close == std::string::npos)
+                    {
+                        fail(line_number, "unterminated delay");
+                    }
+                    parsed.delay_expression = line.substr(open + 1, close - open - 1);
+                    line = line.substr(0, open) + " " + line.substr(close + 1);
+                }
+                std::vector<std::string> tokens = tokenize(line);
+                // Side-set
+                for (size_t i = 0; i < tokens.size(); i++)
+                {
+                    if (tokens[i] == "side" || tokens[i] == "sideset" || tokens[i] == "side_set")
+                    {
+                        if (i + 1 >= tokens.size())
+                        {
+                            fail(line_number, "side requires a value");
+                        }
+                        parsed.side_set_expression = tokens[i + 1];
+                        tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
+                        break;
+                    }
+                }
+                parsed.tokens = tokens;
+            }
+
+            if (!program)
+            {
+                fail(line_number, "instruction outside of a program");
+            }
+            if (!parsed.label.empty())
+            {
+                int address = count_instructions(*program);
+                if (program->info.labels.count(parsed.label))
+                {
+                    fail(line_number, "duplicate label " + parsed.label);
+                }
+                program->info.labels[parsed.label] = address;
+                if (parsed.label_public)
+                {
+                    program->info.public_symbols[parsed.label] = address;
+                }
+            }
+            if (!parsed.tokens.empty())
+            {
+                program->lines.push_back(parsed);
+            }
+        }
+        if (in_code_block)
+        {
+            fail(line_number, "unterminated code block");
+        }
+    }
+
+    int count_instructions(const program_state &program)
+    {
+        return static_cast<int>(program.lines.size());
+    }
+
+    int lookup(const std::map<std::string, int> &table, const std::string &key, const source_line &line, const std::string &what)
+    {
+        auto it = table.find(lower(key));
+        if (it == table.end())
+        {
+            fail(line.line_number, "invalid " + what + " '" + key + "'");
+        }
+        return it->second;
+    }
+
+    void encode_program(program_state &program)
+    {
+        pio_program_info &info = program.info;
+        int delay_bits = 5 - info.side_set_bits;
+        for (const source_line &line : program.lines)
+        {
+            const std::vector<std::string> &t = line.tokens;
+            std::string op = lower(t[0]);
+            uint16_t instruction = 0;
+
+            if (op == ".word")
+            {
+                info.instructions.push_back(static_cast<uint16_t>(parse_integer(t.at(1), line.line_number, &program)));
+                continue;
+            }
+
+            auto arg = [&](size_t i) -> const std::string & {
+                if (i >= t.size())
+                {
+                    fail(line.line_number, "missing operand for " + op);
+                }
+                return t[i];
+            };
+            auto value = [&](size_t i) { return parse_integer(arg(i), line.line_number, &program); };
+
+            if (op == "nop")
+            {
+                // mov y, y
+                instruction = 0xa042;
+            }
+            else if (op == "jmp")
+            {
+                static const std::map<std::string, int> conditions = {
+                    {"!x", 1}, {"x--", 2}, {"!y", 3}, {"y--", 4}, {"x!=y", 5}, {"pin", 6}, {"!osre", 7}};
+                int condition = 0;
+                size_t target = 1;
+                if (t.size() > 2)
+                {
+                    condition = lookup(conditions, arg(1), line, "jmp condition");
+                    target = 2;
+                }
+                instruction = (0 << 13) | (condition << 5) | (value(target) & 0x1f);
+            }
+            else if (op == "wait")
+            {
+                static const std::map<std::string, int> sources = {{"gpio", 0}, {"pin", 1}, {"irq", 2}};
+                int polarity = value(1);
+                int source = lookup(sources, arg(2), line, "wait source");
+                int index = value(3);
+                if (source == 2 && t.size() > 4 && lower(t[4]) == "rel")
+                {
+                    index |= 0x10;
+                }
+                instruction = (1 << 13) | ((polarity & 1) << 7) | (source << 5) | (index & 0x1f);
+            }
+            else if (op == "in")
+            {
+                static const std::map<std::string, int> sources = {
+                    {"pins", 0}, {"x", 1}, {"y", 2}, {"null", 3}, {"isr", 6}, {"osr", 7}};
+                int bits = value(2);
+                if (bits < 1 || bits > 32)
+                {
+                    fail(line.line_number, "bit count must be between 1 and 32");
+                }
+                instruction = (2 << 13) | (lookup(sources, arg(1), line, "in source") << 5) | (bits & 0x1f);
+            }
+            else if (op == "out")
+            {
+                static const std::map<std::string, int> destinations = {
+                    {"pins", 0}, {"x", 1}, {"y", 2}, {"null", 3}, {"pindirs", 4}, {"pc", 5}, {"isr", 6}, {"exec", 7}};
+                int bits = value(2);
+                if (bits < 1 || bits > 32)
+                {
+                    fail(line.line_number, "bit count must be between 1 and 32");
+                }
+                instruction = (3 << 13) | (lookup(destinations, arg(1), line, "out destination") << 5) | (bits & 0x1f);
+            }
+            else if (op == "push" || op == "pull")
+            {
+                bool is_pull = op == "pull";
+                int if_flag = 0;
+                int block = 1;
+                for (size_t i = 1; i < t.size(); i++)
+                {
+                    std::string option = lower(t[i]);
+                    if (option == "block")
+                    {
+                        block = 1;
+                    }
+                    else if (option == "noblock")
+                    {
+                        block = 0;
+                    }
+                    else if ((option == "iffull" && !is_pull) || (option == "ifempty" && is_pull))
+                    {
+                        if_flag = 1;
+                    }
+                    else
+                    {
+                        fail(line.line_number, "invalid " + op + " option '" + t[i] + "'");
+                    }
+                }
+                instruction = (4 << 13) | ((is_pull ? 1 : 0) << 7) | (if_flag << 6) | (block << 5);
+            }
+            else if (op == "mov")
+            {
+                static const std::map<std::string, int> destinations = {
+                    {"pins", 0}, {"x", 1}, {"y", 2}, {"exec", 4}, {"pc", 5}, {"isr", 6}, {"osr", 7}};
+                static const std::map<std::string, int> sources = {
+                    {"pins", 0}, {"x", 1}, {"y", 2}, {"null", 3}, {"status", 5}, {"isr", 6}, {"osr", 7}};
+                std::string source = arg(2);
+                int operation = 0;
+                if (source.rfind("::", 0) == 0)
+                {
+                    operation = 2;
+                    source = source.substr(2);
+                }
+                else if (source[0] == '!' || source[0] == '~')
+                {
+                    operation = 1;
+                    source = source.substr(1);
+                }
+                if (source.empty() && t.size() > 3)
+                {
+                    source = t[3];
+                }
+                instruction = (5 << 13) | (lookup(destinations, arg(1), line, "mov destination") << 5) | (operation << 3) | lookup(sources, source, line, "mov source");
+            }
+            else if (op == "irq")
+            {
+                int clear = 0;
+                int wait = 0;
+                size_t i = 1;
+                std::string mode = lower(arg(1));
+                if (mode == "set" || mode == "nowait")
+                {
+                    i++;
+                }
+                else if (mode == "wait")
+                {
+                    wait = 1;
+                    i++;
+                }
+                else if (mode == "clear")
+                {
+                    clear = 1;
+                    i++;
+                }
+                int index = value(i);
+                if (t.size() > i + 1 && lower(t[i + 1]) == "rel")
+                {
+                    index |= 0x10;
+                }
+                instruction = (6 << 13) | (clear << 6) | (wait << 5) | (index & 0x1f);
+            }
+            else if (op == "set")
+            {
+                static const std::map<std::string, int> destinations = {{"pins", 0}, {"x", 1}, {"y", 2}, {"pindirs", 4}};
+                int data = value(2);
+                if (data < 0 || data > 31)
+                {
+                    fail(line.line_number, "set value must be between 0 and 31");
+                }
+                instruction = (7 << 13) | (lookup(destinations, arg(1), line, "set destination") << 5) | data;
+            }
+            else
+            {
+                fail(line.line_number, "unknown instruction '" + t[0] + "'");
+            }
+
+            // Delay and side-set share bits 12:8
+            int field = 0;
+            if (!line.delay_expression.empty())
+            {
+                int delay = parse_integer(line.delay_expression, line.line_number, &program);
+                if (delay < 0 || delay >= (1 << delay_bits))
+                {
+                    fail(line.line_number, "delay out of range");
+                }
+                field |= delay;
+            }
+            if (!line.side_set_expression.empty())
+            {
+                int side_value_bits = info.side_set_bits - (info.side_set_opt ? 1 : 0);
+                if (side_value_bits == 0)
+                {
+                    fail(line.line_number, "side-set used without .side_set");
+                }
+                int side = parse_integer(line.side_set_expression, line.line_number, &program);
+                if (side < 0 || side >= (1 << side_value_bits))
+                {
+                    fail(line.line_number, "side-set value out of range");
+                }
+                field |= side << delay_bits;
+                if (info.side_set_opt)
+                {
+                    field |= 0x10;
+                }
+            }
+            else if (info.side_set_bits > 0 && !info.side_set_opt)
+            {
+                fail(line.line_number, "side-set is not optional for this program");
+            }
+            instruction |= field << 8;
+            info.instructions.push_back(instruction);
+        }
+
+        if (info.instructions.empty())
+        {
+            throw pio_assembler_error("program " + info.name + " has no instructions");
+        }
+        if (info.instructions.size() > 32)
+        {
+            throw pio_assembler_error("program " + info.name + " is too long (" + std::to_string(info.instructions.size()) + " > 32 instructions)");
+        }
+        if (info.wrap < 0)
+        {
+            info.wrap = static_cast<int>(info.instructions.size()) - 1;
+        }
+    }
+};
+
+} // namespace
+
+std::vector<pio_program_info> pio_assemble(const std::string &source)
+{
+    assembler a(source);
+    return a.run();
+}
+
+pio_program_info pio_assemble_file(const std::string &path, const std::string &program_name)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw pio_assembler_error("could not open " + path);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    for (auto &program : pio_assemble(contents.str()))
+    {
+        if (program.name == program_name)
+        {
+            return program;
+        }
+    }
+    throw pio_assembler_error("program " + program_name + " not found in " + path);
+}
+
+std::string pio_generate_c_sdk_header(const std::vector<pio_program_info> &programs)
+{
+    std::ostringstream out;
+    out << "// -------------------------------------------------- //\n"
+        << "// This file is autogenerated by pio_asm; do not edit! //\n"
+        << "// -------------------------------------------------- //\n\n"
+        << "#pragma once\n\n"
+        << "#if !PICO_NO_HARDWARE\n"
+        << "#include \"hardware/pio.h\"\n"
+        << "#endif\n";
+
+    for (const pio_program_info &program : programs)
+    {
+        const std::string &name = program.name;
+        out << "\n// " << std::string(name.size(), '-') << " //\n"
+            << "// " << name << " //\n"
+            << "// " << std::string(name.size(), '-') << " //\n\n"
+            << "#define " << name << "_wrap_target " << program.wrap_target << "\n"
+            << "#define " << name << "_wrap " << program.wrap << "\n";
+        for (const auto &symbol : program.public_symbols)
+        {
+            if (program.labels.count(symbol.first))
+            {
+                out << "#define " << name << "_offset_" << symbol.first << " " << symbol.second << "u\n";
+            }
+            else
+            {
+                out << "#define " << name << "_" << symbol.first << " " << symbol.second << "\n";
+            }
+        }
+        out << "\nstatic const uint16_t " << name << "_program_instructions[] = {\n";
+        for (size_t i = 0; i < program.instructions.size(); i++)
+        {
+            char word[16];
+            snprintf(word, sizeof(word), "0x%04x", program.instructions[i]);
+            if (static_cast<int>(i) == program.wrap_target)
+            {
+                out << "            //     .wrap_target\n";
+            }
+            out << "    " << word << ", // " << i << "\n";
+            if (static_cast<int>(i) == program.wrap)
+            {
+                out << "            //     .wrap\n";
+            }
+        }
+        out << "};\n\n"
+            << "#if !PICO_NO_HARDWARE\n"
+            << "static const struct pio_program " << name << "_program = {\n"
+            << "    .instructions = " << name << "_program_instructions,\n"
+            << "    .length = " << program.instructions.size() << ",\n"
+            << "    .origin = " << program.origin << ",\n"
+            << "};\n\n"
+            << "static inline pio_sm_config " << name << "_program_get_default_config(uint offset) {\n"
+            << "    pio_sm_config c = pio_get_default_sm_config();\n"
+            << "    sm_config_set_wrap(&c, offset + " << name << "_wrap_target, offset + " << name << "_wrap);\n";
+        if (program.side_set_bits > 0)
+        {
+            out << "    sm_config_set_sideset(&c, " << program.side_set_bits << ", " << (program.side_set_opt ? "true" : "false") << ", " << (program.side_set_pindirs ? "true" : "false") << ");\n";
+        }
+        out << "    return c;\n"
+            << "}\n";
+        if (!program.c_sdk_block.empty())
+        {
+            out << "\n" << program.c_sdk_block;
+        }
+        out << "#endif\n";
+    }
+    return out.str();
+}
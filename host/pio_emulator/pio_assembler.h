@@ -0,0 +1,64 @@
+/*
+#######################################################################
+#                                                                     #
+# pio_assembler.h                                                     #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Minimal assembler for RP2040 PIO programs
+
+  This understands the subset of the pioasm syntax used by the PrawnBlaster
+  (all instructions, labels, .program, .side_set, .wrap_target, .wrap, .origin,
+  .define and % c-sdk blocks) and produces the same machine code as pioasm.
+  It lets the host tools run the real pseudoclock.pio without needing the pico SDK.
+
+  Errors are reported by throwing pio_assembler_error.
+ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct pio_assembler_error : public std::runtime_error
+{
+    pio_assembler_error(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+struct pio_program_info
+{
+    std::string name;
+    std::vector<uint16_t> instructions;
+    int origin = -1;
+    // Addresses are relative to the start of the program
+    int wrap_target = 0;
+    int wrap = -1;
+    // Number of side-set bits, including the enable bit if side_set_opt is set
+    int side_set_bits = 0;
+    bool side_set_opt = false;
+    bool side_set_pindirs = false;
+    std::map<std::string, int> labels;
+    std::map<std::string, int> public_symbols;
+    // Contents of any "% c-sdk { ... %}" blocks
+    std::string c_sdk_block;
+};
+
+// Assemble all programs found in the source text
+std::vector<pio_program_info> pio_assemble(const std::string &source);
+
+// Assemble the named program from a .pio file on disk
+pio_program_info pio_assemble_file(const std::string &path, const std::string &program_name);
+
+// Write a header equivalent to the one pioasm generates for the c-sdk output format
+std::string pio_generate_c_sdk_header(const std::vector<pio_program_info> &programs);
@@ -0,0 +1,991 @@
+/*
+#######################################################################
+#                                                                     #
+# pio_emulator.cpp                                                    #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#include "pio_emulator.h"
+
+namespace
+{
+
+uint32_t bit_reverse(uint32_t value)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 32; i++)
+    {
+        result = (result << 1) | ((value >> i) & 1);
+    }
+    return result;
+}
+
+uint32_t rotate_right(uint32_t value, int shift)
+{
+    shift &= 31;
+    return shift == 0 ? value : (value >> shift) | (value << (32 - shift));
+}
+
+uint32_t mask_for(int count)
+{
+    return count >= 32 ? 0xffffffffu : ((1u << count) - 1);
+}
+
+} // namespace
+
+pio_emulator::pio_emulator()
+{
+}
+
+void pio_emulator::step(uint64_t cycles)
+{
+    for (uint64_t i = 0; i < cycles; i++)
+    {
+        step_once();
+    }
+}
+
+bool pio_emulator::is_idle(bool waits_are_idle) const
+{
+    if (!scheduled_inputs.empty())
+    {
+        return false;
+    }
+    for (uint32_t stage : sync_stages)
+    {
+        if (stage != (pad_levels ^ input_inverted))
+        {
+            return false;
+        }
+    }
+    for (const pio_emu_dma_channel &channel : dma_channels)
+    {
+        if (channel.busy)
+        {
+            return false;
+        }
+    }
+    for (const pio_emu_block &pio : blocks)
+    {
+        for (const pio_emu_state_machine &s : pio.sm)
+        {
+            if (!s.enabled)
+            {
+                continue;
+            }
+            if (s.exec_pending || s.delay > 0)
+            {
+                return false;
+            }
+            uint16_t instruction = s.executing_exec ? s.current_exec_instruction : pio.instruction_memory[s.pc];
+            int opcode = instruction >> 13;
+            if (s.stalled)
+            {
+                bool is_pull = opcode == 4 && (instruction & 0x80);
+                bool is_push = opcode == 4 && !(instruction & 0x80);
+                if ((opcode == 1 && !waits_are_idle) || (is_pull && !s.tx_fifo.empty()) || (is_push && s.rx_fifo.size() < PIO_EMU_FIFO_DEPTH))
+                {
+                    return false;
+                }
+                continue;
+            }
+            // Unconditional jump to itself
+            if (opcode == 0 && ((instruction >> 5) & 0x7) == 0 && (instruction & 0x1f) == s.pc && !s.executing_exec)
+            {
+                continue;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void pio_emulator::step_once()
+{
+    // External inputs for this cycle
+    while (!scheduled_inputs.empty() && scheduled_inputs.front().first <= current_cycle)
+    {
+        gpio_drive_input(scheduled_inputs.front().second.first, scheduled_inputs.front().second.second);
+        scheduled_inputs.pop_front();
+    }
+    update_pads();
+
+    // DMA transfers happen before the state machines run so that data written
+    // to a FIFO in this cycle can be pulled in this cycle
+    step_dma();
+
+    for (int b = 0; b < PIO_EMU_NUM_BLOCKS; b++)
+    {
+        for (int s = 0; s < PIO_EMU_NUM_SMS; s++)
+        {
+            if (blocks[b].sm[s].enabled)
+            {
+                step_sm(b, s);
+            }
+        }
+    }
+
+    update_pads();
+
+    // Shift the pads into the input synchronisers
+    for (int i = 0; i < PIO_EMU_INPUT_SYNC_CYCLES - 1; i++)
+    {
+        sync_stages[i] = sync_stages[i + 1];
+    }
+    sync_stages[PIO_EMU_INPUT_SYNC_CYCLES - 1] = pad_levels ^ input_inverted;
+
+    current_cycle++;
+}
+
+void pio_emulator::update_pads()
+{
+    uint32_t levels = 0;
+    for (int pin = 0; pin < PIO_EMU_NUM_GPIOS; pin++)
+    {
+        uint32_t bit = 1u << pin;
+        int level;
+        const pio_emu_block *pio = nullptr;
+        if (gpio_function[pin] == PIO_EMU_GPIO_FUNC_PIO0)
+        {
+            pio = &blocks[0];
+        }
+        else if (gpio_function[pin] == PIO_EMU_GPIO_FUNC_PIO1)
+        {
+            pio = &blocks[1];
+        }
+
+        if (pio && (pio->pin_directions & bit))
+        {
+            level = ((pio->pin_values ^ output_inverted) & bit) ? 1 : 0;
+        }
+        else if (gpio_function[pin] == PIO_EMU_GPIO_FUNC_SIO && (sio_directions & bit))
+        {
+            level = ((sio_values ^ output_inverted) & bit) ? 1 : 0;
+        }
+        else
+        {
+            // Undriven pins read as whatever is outside the chip (or low)
+            level = (external_driven & external_levels & bit) ? 1 : 0;
+        }
+        if (level)
+        {
+            levels |= bit;
+        }
+    }
+
+    uint32_t changed = (levels ^ pad_levels) & watched_pins;
+    pad_levels = levels;
+    for (int pin = 0; changed; pin++)
+    {
+        if (changed & (1u << pin))
+        {
+            changed &= ~(1u << pin);
+            pio_emu_edge edge = {current_cycle, pin, (int)((levels >> pin) & 1)};
+            edge_log.push_back(edge);
+            if (on_edge)
+            {
+                on_edge(edge);
+            }
+        }
+    }
+}
+
+//
+// DMA
+//
+
+bool pio_emulator::dma_dreq(const pio_emu_dma_channel &channel) const
+{
+    if (channel.write.type == PIO_EMU_DMA_TX_FIFO)
+    {
+        const pio_emu_state_machine &s = blocks[channel.write.block].sm[channel.write.sm];
+        if (s.tx_fifo.size() >= PIO_EMU_FIFO_DEPTH)
+        {
+            return false;
+        }
+    }
+    if (channel.read.type == PIO_EMU_DMA_RX_FIFO)
+    {
+        const pio_emu_state_machine &s = blocks[channel.read.block].sm[channel.read.sm];
+        if (s.rx_fifo.empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void pio_emulator::step_dma()
+{
+    // The bus can service one transfer per cycle. Channels are serviced round robin.
+    for (int i = 0; i < PIO_EMU_NUM_DMA_CHANNELS; i++)
+    {
+        int index = (dma_round_robin + i) % PIO_EMU_NUM_DMA_CHANNELS;
+        pio_emu_dma_channel &channel = dma_channels[index];
+        if (!channel.busy || !dma_dreq(channel))
+        {
+            continue;
+        }
+
+        uint32_t data = 0;
+        if (channel.read.type == PIO_EMU_DMA_RX_FIFO)
+        {
+            pio_emu_state_machine &s = blocks[channel.read.block].sm[channel.read.sm];
+            data = s.rx_fifo.front();
+            s.rx_fifo.pop_front();
+        }
+        else
+        {
+            data = *channel.read.address;
+            if (channel.read_increment)
+            {
+                channel.read.address++;
+            }
+        }
+
+        if (channel.write.type == PIO_EMU_DMA_TX_FIFO)
+        {
+            blocks[channel.write.block].sm[channel.write.sm].tx_fifo.push_back(data);
+        }
+        else
+        {
+            *channel.write.address = data;
+            if (channel.write_increment)
+            {
+                channel.write.address++;
+            }
+        }
+
+        channel.transfer_count--;
+        if (channel.transfer_count == 0)
+        {
+            channel.busy = false;
+            if (channel.on_complete)
+            {
+                channel.on_complete(index);
+            }
+        }
+        dma_round_robin = (index + 1) % PIO_EMU_NUM_DMA_CHANNELS;
+        break;
+    }
+}
+
+void pio_emulator::dma_start(int channel)
+{
+    dma_channels[channel].busy = dma_channels[channel].transfer_count > 0;
+}
+
+void pio_emulator::dma_abort(int channel)
+{
+    dma_channels[channel].busy = false;
+}
+
+//
+// GPIO
+//
+
+void pio_emulator::gpio_set_function(int pin, pio_emu_gpio_function function)
+{
+    gpio_function[pin] = function;
+    update_pads();
+}
+
+void pio_emulator::gpio_drive_input(int pin, int level)
+{
+    external_driven |= 1u << pin;
+    if (level)
+    {
+        external_levels |= 1u << pin;
+    }
+    else
+    {
+        external_levels &= ~(1u << pin);
+    }
+}
+
+void pio_emulator::gpio_set_output_inverted(int pin, bool inverted)
+{
+    if (inverted)
+    {
+        output_inverted |= 1u << pin;
+    }
+    else
+    {
+        output_inverted &= ~(1u << pin);
+    }
+    update_pads();
+}
+
+void pio_emulator::gpio_set_input_inverted(int pin, bool inverted)
+{
+    if (inverted)
+    {
+        input_inverted |= 1u << pin;
+    }
+    else
+    {
+        input_inverted &= ~(1u << pin);
+    }
+}
+
+void pio_emulator::gpio_schedule_input(uint64_t cycle, int pin, int level)
+{
+    // Keep the schedule sorted (stable for events on the same cycle)
+    auto it = scheduled_inputs.end();
+    while (it != scheduled_inputs.begin() && (it - 1)->first > cycle)
+    {
+        --it;
+    }
+    scheduled_inputs.insert(it, {cycle, {pin, level}});
+}
+
+void pio_emulator::gpio_set_sio_dir(int pin, bool output)
+{
+    if (output)
+    {
+        sio_directions |= 1u << pin;
+    }
+    else
+    {
+        sio_directions &= ~(1u << pin);
+    }
+    update_pads();
+}
+
+void pio_emulator::gpio_set_sio_value(int pin, int level)
+{
+    if (level)
+    {
+        sio_values |= 1u << pin;
+    }
+    else
+    {
+        sio_values &= ~(1u << pin);
+    }
+    update_pads();
+}
+
+//
+// PIO control
+//
+
+int pio_emulator::add_program(int block_index, const pio_program_info &program)
+{
+    pio_emu_block &pio = blocks[block_index];
+    int length = static_cast<int>(program.instructions.size());
+    uint32_t program_mask = mask_for(length);
+    int offset = -1;
+    if (program.origin >= 0)
+    {
+        if (program.origin + length <= PIO_EMU_INSTRUCTION_COUNT && !(pio.used_instruction_mask & (program_mask << program.origin)))
+        {
+            offset = program.origin;
+        }
+    }
+    else
+    {
+        // Same search order as the pico SDK (highest free offset first)
+        for (int i = PIO_EMU_INSTRUCTION_COUNT - length; i >= 0; i--)
+        {
+            if (!(pio.used_instruction_mask & (program_mask << i)))
+            {
+                offset = i;
+                break;
+            }
+        }
+    }
+    if (offset < 0)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        uint16_t instruction = program.instructions[i];
+        // Relocate JMP instructions
+        if ((instruction >> 13) == 0)
+        {
+            instruction = (instruction & ~0x1f) | (((instruction & 0x1f) + offset) & 0x1f);
+        }
+        pio.instruction_memory[offset + i] = instruction;
+    }
+    pio.used_instruction_mask |= program_mask << offset;
+    return offset;
+}
+
+void pio_emulator::remove_program(int block_index, const pio_program_info &program, int offset)
+{
+    blocks[block_index].used_instruction_mask &= ~(mask_for(static_cast<int>(program.instructions.size())) << offset);
+}
+
+void pio_emulator::sm_init(int block_index, int sm_index, int initial_pc, const pio_emu_sm_config &config)
+{
+    pio_emu_state_machine &s = blocks[block_index].sm[sm_index];
+    s.enabled = false;
+    s.config = config;
+    s.pc = initial_pc;
+    s.x = s.y = s.osr = s.isr = 0;
+    s.osr_count = 32;
+    s.isr_count = 0;
+    s.delay = 0;
+    s.stalled = false;
+    s.side_set_done = false;
+    s.exec_pending = false;
+    s.executing_exec = false;
+    s.clkdiv_accumulator = 0;
+    s.tx_fifo.clear();
+    s.rx_fifo.clear();
+    s.tx_stall_cycles = 0;
+    uint32_t sm_bits = (1u << sm_index);
+    blocks[block_index].fdebug &= ~((sm_bits << PIO_EMU_FDEBUG_TXSTALL_LSB) | (sm_bits << PIO_EMU_FDEBUG_TXOVER_LSB) | (sm_bits << PIO_EMU_FDEBUG_RXUNDER_LSB) | (sm_bits << PIO_EMU_FDEBUG_RXSTALL_LSB));
+}
+
+void pio_emulator::sm_set_enabled(int block_index, int sm_index, bool enabled)
+{
+    blocks[block_index].sm[sm_index].enabled = enabled;
+}
+
+void pio_emulator::enable_sm_mask_in_sync(int block_index, uint32_t mask)
+{
+    for (int s = 0; s < PIO_EMU_NUM_SMS; s++)
+    {
+        if (mask & (1u << s))
+        {
+            blocks[block_index].sm[s].clkdiv_accumulator = 0;
+            blocks[block_index].sm[s].enabled = true;
+        }
+    }
+}
+
+void pio_emulator::sm_exec(int block_index, int sm_index, uint16_t instruction)
+{
+    pio_emu_state_machine &s = blocks[block_index].sm[sm_index];
+    s.exec_pending = true;
+    s.exec_instruction = instruction;
+}
+
+bool pio_emulator::sm_put(int block_index, int sm_index, uint32_t data)
+{
+    pio_emu_state_machine &s = blocks[block_index].sm[sm_index];
+    if (s.tx_fifo.size() >= PIO_EMU_FIFO_DEPTH)
+    {
+        blocks[block_index].fdebug |= 1u << (PIO_EMU_FDEBUG_TXOVER_LSB + sm_index);
+        return false;
+    }
+    s.tx_fifo.push_back(data);
+    return true;
+}
+
+bool pio_emulator::sm_get(int block_index, int sm_index, uint32_t *data)
+{
+    pio_emu_state_machine &s = blocks[block_index].sm[sm_index];
+    if (s.rx_fifo.empty())
+    {
+        blocks[block_index].fdebug |= 1u << (PIO_EMU_FDEBUG_RXUNDER_LSB + sm_index);
+        return false;
+    }
+    *data = s.rx_fifo.front();
+    s.rx_fifo.pop_front();
+    return true;
+}
+
+void pio_emulator::sm_clear_fifos(int block_index, int sm_index)
+{
+    blocks[block_index].sm[sm_index].tx_fifo.clear();
+    blocks[block_index].sm[sm_index].rx_fifo.clear();
+}
+
+void pio_emulator::sm_set_pindirs(int block_index, int base, int count, bool output)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t bit = 1u << ((base + i) % 32);
+        if (output)
+        {
+            blocks[block_index].pin_directions |= bit;
+        }
+        else
+        {
+            blocks[block_index].pin_directions &= ~bit;
+        }
+    }
+    update_pads();
+}
+
+void pio_emulator::sm_set_pins(int block_index, int base, int count, uint32_t values)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t bit = 1u << ((base + i) % 32);
+        if ((values >> i) & 1)
+        {
+            blocks[block_index].pin_values |= bit;
+        }
+        else
+        {
+            blocks[block_index].pin_values &= ~bit;
+        }
+    }
+    update_pads();
+}
+
+//
+// State machine execution
+//
+
+void pio_emulator::step_sm(int block_index, int sm_index)
+{
+    pio_emu_block &pio = blocks[block_index];
+    pio_emu_state_machine &s = pio.sm[sm_index];
+
+    // Clock divider: the state machine only advances on cycles where the
+    // fractional divider accumulator overflows
+    uint32_t divider = (s.config.clkdiv_int << 8) | s.config.clkdiv_frac;
+    if (divider > 256)
+    {
+        s.clkdiv_accumulator += 256;
+        if (s.clkdiv_accumulator < divider)
+        {
+            return;
+        }
+        s.clkdiv_accumulator -= divider;
+    }
+
+    uint16_t instruction;
+    if (s.exec_pending)
+    {
+        // Forced instructions take priority over everything, including delays and stalls
+        s.exec_pending = false;
+        s.executing_exec = true;
+        s.current_exec_instruction = s.exec_instruction;
+        s.delay = 0;
+        s.stalled = false;
+        s.side_set_done = false;
+    }
+    else if (s.delay > 0)
+    {
+        s.delay--;
+        return;
+    }
+
+    instruction = s.executing_exec ? s.current_exec_instruction : pio.instruction_memory[s.pc];
+
+    // Decode delay/side-set
+    int delay_bits = 5 - s.config.side_set_bits;
+    int field = (instruction >> 8) & 0x1f;
+    int delay = field & ((1 << delay_bits) - 1);
+
+    // Side-set happens at the start of the instruction regardless of whether it stalls
+    if (!s.side_set_done && s.config.side_set_bits > 0)
+    {
+        int value_bits = s.config.side_set_bits - (s.config.side_set_opt ? 1 : 0);
+        bool enabled = !s.config.side_set_opt || (field & 0x10);
+        if (enabled && value_bits > 0)
+        {
+            uint32_t value = (field >> delay_bits) & mask_for(value_bits);
+            if (s.config.side_set_pindirs)
+            {
+                for (int i = 0; i < value_bits; i++)
+                {
+                    uint32_t bit = 1u << ((s.config.side_set_base + i) % 32);
+                    pio.pin_directions = ((value >> i) & 1) ? (pio.pin_directions | bit) : (pio.pin_directions & ~bit);
+                }
+            }
+            else
+            {
+                for (int i = 0; i < value_bits; i++)
+                {
+                    uint32_t bit = 1u << ((s.config.side_set_base + i) % 32);
+                    pio.pin_values = ((value >> i) & 1) ? (pio.pin_values | bit) : (pio.pin_values & ~bit);
+                }
+            }
+        }
+        s.side_set_done = true;
+    }
+
+    bool jumped = false;
+    int pc_before = s.pc;
+    bool completed = execute(block_index, sm_index, instruction, jumped);
+    if (!completed)
+    {
+        s.stalled = true;
+        return;
+    }
+
+    bool was_exec = s.executing_exec;
+    s.stalled = false;
+    s.side_set_done = false;
+    s.executing_exec = false;
+    if (!jumped && !was_exec)
+    {
+        s.pc = (pc_before == s.config.wrap) ? s.config.wrap_target : (pc_before + 1) % PIO_EMU_INSTRUCTION_COUNT;
+    }
+    // An instruction written to EXEC by out/mov runs next, without advancing the PC
+    s.delay = s.exec_pending ? 0 : delay;
+}
+
+bool pio_emulator::execute(int block_index, int sm_index, uint16_t instruction, bool &jumped)
+{
+    pio_emu_block &pio = blocks[block_index];
+    pio_emu_state_machine &s = pio.sm[sm_index];
+    const pio_emu_sm_config &config = s.config;
+    uint32_t inputs = synced_inputs();
+    int opcode = instruction >> 13;
+    int arg1 = (instruction >> 5) & 0x7;
+    int arg2 = instruction & 0x1f;
+    uint32_t sm_bit = 1u << sm_index;
+
+    auto irq_index = [&](int index) {
+        if (index & 0x10)
+        {
+            // Relative IRQ: add the state machine number to the bottom two bits
+            return (index & 0x4) | (((index & 0x3) + sm_index) & 0x3);
+        }
+        return index & 0x7;
+    };
+    auto write_pins = [&](int base, int count, uint32_t value) {
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t bit = 1u << ((base + i) % 32);
+            pio.pin_values = ((value >> i) & 1) ? (pio.pin_values | bit) : (pio.pin_values & ~bit);
+        }
+    };
+    auto write_pindirs = [&](int base, int count, uint32_t value) {
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t bit = 1u << ((base + i) % 32);
+            pio.pin_directions = ((value >> i) & 1) ? (pio.pin_directions | bit) : (pio.pin_directions & ~bit);
+        }
+    };
+
+    switch (opcode)
+    {
+    case 0: // JMP
+    {
+        bool condition = false;
+        switch (arg1)
+        {
+        case 0:
+            condition = true;
+            break;
+        case 1:
+            condition = s.x == 0;
+            break;
+        case 2:
+            condition = s.x != 0;
+            s.x--;
+            break;
+        case 3:
+            condition = s.y == 0;
+            break;
+        case 4:
+            condition = s.y != 0;
+            s.y--;
+            break;
+        case 5:
+            condition = s.x != s.y;
+            break;
+        case 6:
+            condition = (inputs >> config.jmp_pin) & 1;
+            break;
+        case 7:
+            condition = s.osr_count < 32;
+            break;
+        }
+        if (condition)
+        {
+            s.pc = arg2;
+            jumped = true;
+        }
+        return true;
+    }
+    case 1: // WAIT
+    {
+        int polarity = (instruction >> 7) & 1;
+        int source = (instruction >> 5) & 3;
+        int index = instruction & 0x1f;
+        int level = 0;
+        switch (source)
+        {
+        case 0:
+            level = (inputs >> index) & 1;
+            break;
+        case 1:
+            level = (inputs >> ((config.in_base + index) % 32)) & 1;
+            break;
+        case 2:
+        {
+            int flag = irq_index(index);
+            level = (pio.irq_flags >> flag) & 1;
+            if (level == polarity && polarity == 1)
+            {
+                // Waiting for an IRQ flag clears it
+                pio.irq_flags &= ~(1u << flag);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        return level == polarity;
+    }
+    case 2: // IN
+    {
+        int bits = arg2 == 0 ? 32 : arg2;
+        uint32_t data = 0;
+        switch (arg1)
+        {
+        case 0:
+            data = rotate_right(inputs, config.in_base);
+            break;
+        case 1:
+            data = s.x;
+            break;
+        case 2:
+            data = s.y;
+            break;
+        case 6:
+            data = s.isr;
+            break;
+        case 7:
+            data = s.osr;
+            break;
+        default:
+            break;
+        }
+        data &= mask_for(bits);
+        if (config.in_shift_right)
+        {
+            s.isr = bits == 32 ? data : (s.isr >> bits) | (data << (32 - bits));
+        }
+        else
+        {
+            s.isr = bits == 32 ? data : (s.isr << bits) | data;
+        }
+        s.isr_count = s.isr_count + bits > 32 ? 32 : s.isr_count + bits;
+        return true;
+    }
+    case 3: // OUT
+    {
+        int bits = arg2 == 0 ? 32 : arg2;
+        uint32_t data;
+        if (config.out_shift_right)
+        {
+            data = s.osr & mask_for(bits);
+            s.osr = bits == 32 ? 0 : s.osr >> bits;
+        }
+        else
+        {
+            data = bits == 32 ? s.osr : s.osr >> (32 - bits);
+            s.osr = bits == 32 ? 0 : s.osr << bits;
+        }
+        s.osr_count = s.osr_count + bits > 32 ? 32 : s.osr_count + bits;
+        switch (arg1)
+        {
+        case 0:
+            write_pins(config.out_base, config.out_count < bits ? config.out_count : bits, data);
+            break;
+        case 1:
+            s.x = data;
+            break;
+        case 2:
+            s.y = data;
+            break;
+        case 4:
+            write_pindirs(config.out_base, config.out_count < bits ? config.out_count : bits, data);
+            break;
+        case 5:
+            s.pc = data & 0x1f;
+            jumped = true;
+            break;
+        case 6:
+            s.isr = data;
+            s.isr_count = bits;
+            break;
+        case 7:
+            s.exec_pending = true;
+            s.exec_instruction = static_cast<uint16_t>(data);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+    case 4: // PUSH/PULL
+    {
+        bool is_pull = (instruction >> 7) & 1;
+        bool if_flag = (instruction >> 6) & 1;
+        bool block = (instruction >> 5) & 1;
+        if (is_pull)
+        {
+            if (if_flag && s.osr_count < 32)
+            {
+                return true;
+            }
+            if (s.tx_fifo.empty())
+            {
+                if (block)
+                {
+                    pio.fdebug |= sm_bit << PIO_EMU_FDEBUG_TXSTALL_LSB;
+                    s.tx_stall_cycles++;
+                    return false;
+                }
+                // Non-blocking pull from an empty FIFO copies X
+                s.osr = s.x;
+            }
+            else
+            {
+                s.osr = s.tx_fifo.front();
+                s.tx_fifo.pop_front();
+            }
+            s.osr_count = 0;
+        }
+        else
+        {
+            if (if_flag && s.isr_count < 32)
+            {
+                return true;
+            }
+            if (s.rx_fifo.size() >= PIO_EMU_FIFO_DEPTH)
+            {
+                if (block)
+                {
+                    pio.fdebug |= sm_bit << PIO_EMU_FDEBUG_RXSTALL_LSB;
+                    return false;
+                }
+                // Data is lost when pushing to a full FIFO without blocking
+            }
+            else
+            {
+                s.rx_fifo.push_back(s.isr);
+            }
+            s.isr = 0;
+            s.isr_count = 0;
+        }
+        return true;
+    }
+    case 5: // MOV
+    {
+        int destination = arg1;
+        int operation = (instruction >> 3) & 3;
+        int source = instruction & 7;
+        uint32_t data = 0;
+        switch (source)
+        {
+        case 0:
+            data = rotate_right(inputs, config.in_base);
+            break;
+        case 1:
+            data = s.x;
+            break;
+        case 2:
+            data = s.y;
+            break;
+        case 5:
+            // STATUS defaults to "TX FIFO level below 1", i.e. all ones when empty
+            data = s.tx_fifo.empty() ? 0xffffffffu : 0;
+            break;
+        case 6:
+            data = s.isr;
+            break;
+        case 7:
+            data = s.osr;
+            break;
+        default:
+            break;
+        }
+        if (operation == 1)
+        {
+            data = ~data;
+        }
+        else if (operation == 2)
+        {
+            data = bit_reverse(data);
+        }
+        switch (destination)
+        {
+        case 0:
+            write_pins(config.out_base, config.out_count, data);
+            break;
+        case 1:
+            s.x = data;
+            break;
+        case 2:
+            s.y = data;
+            break;
+        case 4:
+            s.exec_pending = true;
+            s.exec_instruction = static_cast<uint16_t>(data);
+            break;
+        case 5:
+            s.pc = data & 0x1f;
+            jumped = true;
+            break;
+        case 6:
+            s.isr = data;
+            s.isr_count = 0;
+            break;
+        case 7:
+            s.osr = data;
+            s.osr_count = 0;
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+    case 6: // IRQ
+    {
+        bool clear = (instruction >> 6) & 1;
+        bool wait = (instruction >> 5) & 1;
+        int flag = irq_index(instruction & 0x1f);
+        if (clear)
+        {
+            pio.irq_flags &= ~(1u << flag);
+            return true;
+        }
+        if (s.stalled && wait)
+        {
+            // Already raised the flag, waiting for it to be cleared
+            return !((pio.irq_flags >> flag) & 1);
+        }
+        pio.irq_flags |= 1u << flag;
+        if (flag < 4 && on_pio_irq)
+        {
+            on_pio_irq(block_index, flag);
+        }
+        return !wait;
+    }
+    case 7: // SET
+    {
+        uint32_t data = arg2;
+        switch (arg1)
+        {
+        case 0:
+            write_pins(config.set_base, config.set_count, data);
+            break;
+        case 1:
+            s.x = data;
+            break;
+        case 2:
+            s.y = data;
+            break;
+        case 4:
+            write_pindirs(config.set_base, config.set_count, data);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+    }
+    return true;
+}
@@ -0,0 +1,260 @@
+/*
+#######################################################################
+#                                                                     #
+# pio_emulator.h                                                      #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Cycle accurate emulator of the RP2040 PIO blocks
+
+  Models both PIO blocks (4 state machines each, 32 instruction slots, 4 deep FIFOs,
+  IRQ flags and clock dividers), the GPIO input synchronisers and function select,
+  and enough of the DMA controller (DREQ paced transfers between memory and the PIO
+  FIFOs, one bus transfer per system clock cycle) to run the PrawnBlaster firmware's
+  data path.
+
+  The emulator is single threaded; callers that share it between threads must
+  provide their own locking.
+ */
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "pio_assembler.h"
+
+const int PIO_EMU_NUM_BLOCKS = 2;
+const int PIO_EMU_NUM_SMS = 4;
+const int PIO_EMU_INSTRUCTION_COUNT = 32;
+const int PIO_EMU_FIFO_DEPTH = 4;
+const int PIO_EMU_NUM_GPIOS = 30;
+const int PIO_EMU_NUM_DMA_CHANNELS = 12;
+// Number of cycles between a GPIO pad changing and the PIO seeing the change
+const int PIO_EMU_INPUT_SYNC_CYCLES = 2;
+
+// Bit positions in the FDEBUG register (per state machine offsets are added to these)
+const int PIO_EMU_FDEBUG_TXSTALL_LSB = 24;
+const int PIO_EMU_FDEBUG_TXOVER_LSB = 16;
+const int PIO_EMU_FDEBUG_RXUNDER_LSB = 8;
+const int PIO_EMU_FDEBUG_RXSTALL_LSB = 0;
+
+enum pio_emu_gpio_function
+{
+    PIO_EMU_GPIO_FUNC_NULL,
+    PIO_EMU_GPIO_FUNC_SIO,
+    PIO_EMU_GPIO_FUNC_PIO0,
+    PIO_EMU_GPIO_FUNC_PIO1,
+};
+
+// The parts of a pio_sm_config that affect execution
+struct pio_emu_sm_config
+{
+    // Absolute addresses in instruction memory
+    int wrap_target = 0;
+    int wrap = PIO_EMU_INSTRUCTION_COUNT - 1;
+    // Total side-set bits (including the enable bit when side_set_opt is set)
+    int side_set_bits = 0;
+    bool side_set_opt = false;
+    bool side_set_pindirs = false;
+    int side_set_base = 0;
+    int out_base = 0;
+    int out_count = 32;
+    int set_base = 0;
+    int set_count = 5;
+    int in_base = 0;
+    int jmp_pin = 0;
+    bool in_shift_right = true;
+    bool out_shift_right = true;
+    // Clock divider in 16.8 fixed point format (as in the CLKDIV register)
+    uint32_t clkdiv_int = 1;
+    uint32_t clkdiv_frac = 0;
+};
+
+struct pio_emu_state_machine
+{
+    pio_emu_sm_config config;
+    bool enabled = false;
+    int pc = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t osr = 0;
+    uint32_t isr = 0;
+    // Bits shifted out of the OSR (32 == empty) and into the ISR
+    int osr_count = 32;
+    int isr_count = 0;
+    int delay = 0;
+    bool stalled = false;
+    bool side_set_done = false;
+    bool exec_pending = false;
+    uint16_t exec_instruction = 0;
+    bool executing_exec = false;
+    uint16_t current_exec_instruction = 0;
+    uint32_t clkdiv_accumulator = 0;
+    std::deque<uint32_t> tx_fifo;
+    std::deque<uint32_t> rx_fifo;
+    // Total number of clock cycles spent stalled on a blocking pull
+    uint64_t tx_stall_cycles = 0;
+};
+
+struct pio_emu_block
+{
+    uint16_t instruction_memory[PIO_EMU_INSTRUCTION_COUNT] = {};
+    uint32_t used_instruction_mask = 0;
+    pio_emu_state_machine sm[PIO_EMU_NUM_SMS];
+    // IRQ flags 0-7 (0-3 are also routed to the system level interrupts)
+    uint8_t irq_flags = 0;
+    uint32_t fdebug = 0;
+    uint32_t pin_values = 0;
+    uint32_t pin_directions = 0;
+};
+
+enum pio_emu_dma_endpoint_type
+{
+    PIO_EMU_DMA_MEMORY,
+    PIO_EMU_DMA_TX_FIFO,
+    PIO_EMU_DMA_RX_FIFO,
+};
+
+struct pio_emu_dma_endpoint
+{
+    pio_emu_dma_endpoint_type type = PIO_EMU_DMA_MEMORY;
+    uint32_t *address = nullptr;
+    int block = 0;
+    int sm = 0;
+};
+
+struct pio_emu_dma_channel
+{
+    bool busy = false;
+    pio_emu_dma_endpoint read;
+    pio_emu_dma_endpoint write;
+    bool read_increment = true;
+    bool write_increment = false;
+    uint32_t transfer_count = 0;
+    // Called (from within step()) when the channel completes its transfers
+    std::function<void(int channel)> on_complete;
+};
+
+struct pio_emu_edge
+{
+    uint64_t cycle;
+    int pin;
+    int level;
+};
+
+class pio_emulator
+{
+public:
+    pio_emulator();
+
+    // Current system clock cycle
+    uint64_t cycle() const { return current_cycle; }
+
+    // Run for the specified number of system clock cycles
+    void step(uint64_t cycles = 1);
+
+    // True if stepping cannot change anything until the emulator is poked from outside
+    // (no DMA in flight, no scheduled or unsettled inputs, and every enabled state machine
+    // is stalled or spinning on a jump to itself). Stalled WAIT instructions only count as
+    // idle if waits_are_idle is set.
+    bool is_idle(bool waits_are_idle = true) const;
+
+    //
+    // PIO control
+    //
+    pio_emu_block &block(int index) { return blocks[index]; }
+    pio_emu_state_machine &sm(int block_index, int sm) { return blocks[block_index].sm[sm]; }
+
+    // Load a program into instruction memory, relocating jumps (as pio_add_program does).
+    // Returns the offset or -1 if there is no space.
+    int add_program(int block_index, const pio_program_info &program);
+    void remove_program(int block_index, const pio_program_info &program, int offset);
+
+    // Reset the state machine and point it at initial_pc (as pio_sm_init does)
+    void sm_init(int block_index, int sm, int initial_pc, const pio_emu_sm_config &config);
+    void sm_set_enabled(int block_index, int sm, bool enabled);
+    // Enable several state machines and synchronise their clock dividers
+    void enable_sm_mask_in_sync(int block_index, uint32_t mask);
+    // Execute an instruction immediately (on the next cycle the state machine is clocked)
+    void sm_exec(int block_index, int sm, uint16_t instruction);
+    bool sm_put(int block_index, int sm, uint32_t data);
+    bool sm_get(int block_index, int sm, uint32_t *data);
+    void sm_clear_fifos(int block_index, int sm);
+    void sm_set_pindirs(int block_index, int base, int count, bool output);
+    void sm_set_pins(int block_index, int base, int count, uint32_t values);
+
+    //
+    // GPIO
+    //
+    void gpio_set_function(int pin, pio_emu_gpio_function function);
+    pio_emu_gpio_function gpio_get_function(int pin) const { return gpio_function[pin]; }
+    // Drive a pin from outside the chip (as a trigger source would)
+    void gpio_drive_input(int pin, int level);
+    // Schedule an external input change at an absolute cycle
+    void gpio_schedule_input(uint64_t cycle, int pin, int level);
+    // SIO (software controlled) outputs
+    void gpio_set_sio_dir(int pin, bool output);
+    void gpio_set_sio_value(int pin, int level);
+    // GPIO overrides that invert the output driven onto the pad, and the input read from it
+    void gpio_set_output_inverted(int pin, bool inverted);
+    void gpio_set_input_inverted(int pin, bool inverted);
+    bool gpio_input_inverted(int pin) const { return (input_inverted >> pin) & 1; }
+    // Current level at the pad
+    int gpio_get(int pin) const { return (pad_levels >> pin) & 1; }
+    // Record edges on these pins
+    void watch_pins(uint32_t mask) { watched_pins |= mask; }
+    std::vector<pio_emu_edge> &edges() { return edge_log; }
+    // Optional callback for every edge on a watched pin
+    std::function<void(const pio_emu_edge &)> on_edge;
+
+    //
+    // DMA
+    //
+    pio_emu_dma_channel &dma(int channel) { return dma_channels[channel]; }
+    void dma_start(int channel);
+    void dma_abort(int channel);
+
+    // Called when a PIO sets one of IRQ flags 0-3 (the flags that can interrupt the processor)
+    std::function<void(int block_index, int flag)> on_pio_irq;
+
+private:
+    pio_emu_block blocks[PIO_EMU_NUM_BLOCKS];
+    uint64_t current_cycle = 0;
+
+    pio_emu_gpio_function gpio_function[PIO_EMU_NUM_GPIOS] = {};
+    uint32_t external_levels = 0;
+    uint32_t external_driven = 0;
+    uint32_t sio_values = 0;
+    uint32_t sio_directions = 0;
+    uint32_t pad_levels = 0;
+    uint32_t output_inverted = 0;
+    uint32_t input_inverted = 0;
+    // Synchroniser pipeline, [0] is the oldest value (the one the state machines see)
+    uint32_t sync_stages[PIO_EMU_INPUT_SYNC_CYCLES] = {};
+    uint32_t watched_pins = 0;
+    std::vector<pio_emu_edge> edge_log;
+    std::deque<std::pair<uint64_t, std::pair<int, int>>> scheduled_inputs;
+
+    pio_emu_dma_channel dma_channels[PIO_EMU_NUM_DMA_CHANNELS];
+    int dma_round_robin = 0;
+
+    void step_once();
+    void update_pads();
+    void step_dma();
+    void step_sm(int block_index, int sm_index);
+    // Returns true if the instruction completed (false if it stalled)
+    bool execute(int block_index, int sm_index, uint16_t instruction, bool &jumped);
+    uint32_t synced_inputs() const { return sync_stages[0]; }
+    bool dma_dreq(const pio_emu_dma_channel &channel) const;
+};
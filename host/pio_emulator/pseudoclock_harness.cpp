@@ -0,0 +1,369 @@
+/*
+#######################################################################
+#                                                                     #
+# pseudoclock_harness.cpp                                             #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#include "pseudoclock_harness.h"
+
+#include <stdexcept>
+
+#include "pio_emulator.h"
+#include "pseudoclock_encoding.h"
+
+namespace
+{
+
+// Default pins used by the firmware
+int out_pin_for(int pseudoclock) { return 9 + 2 * pseudoclock; }
+int in_pin_for(int pseudoclock) { return 2 * pseudoclock; }
+
+// Cycles the DMA is given to fill the TX FIFOs before the state machines are enabled
+const uint64_t dma_prefill_cycles = 8;
+// Cycles between a trigger reaching the GPIO pad and the PIO seeing it (input synchroniser)
+const uint64_t input_sync_cycles = PSEUDOCLOCK_INPUT_SYNC_LENGTH;
+// pseudoclock_edge folds the "jmp shortstart" after "start" into a delay on the jump to
+// "indefinitewait", so its indefinite waits from "start" wait for the trigger to be low a
+// cycle later than pseudoclock waits for it to be high
+const uint64_t edge_arm_delay = 1;
+
+} // namespace
+
+std::vector<pseudoclock_timeline> simulate_pseudoclocks(const pio_program_info &program, const std::vector<pseudoclock_run> &runs, bool hwstart, uint64_t max_cycles)
+{
+    if (runs.size() > PIO_EMU_NUM_SMS)
+    {
+        throw std::invalid_argument("at most 4 pseudoclocks can be simulated");
+    }
+
+    pio_emulator emu;
+    int offset = emu.add_program(0, program);
+    if (offset < 0)
+    {
+        throw std::runtime_error("program does not fit in PIO instruction memory");
+    }
+
+    std::vector<pseudoclock_timeline> timelines(runs.size());
+    std::vector<std::vector<uint32_t>> words(runs.size());
+    std::vector<std::vector<uint32_t>> waits(runs.size());
+    std::vector<bool> configured(runs.size(), false);
+    uint32_t enable_mask = 0;
+
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        int sm = static_cast<int>(i);
+        int out_pin = out_pin_for(sm);
+        int in_pin = in_pin_for(sm);
+
+        // Encode the table with the firmware's encoding into a zeroed partition
+        int max_words = static_cast<int>(runs[i].instructions.size()) * 2 + 2;
+        words[i].assign(max_words, 0);
+        for (size_t j = 0; j < runs[i].instructions.size(); j++)
+        {
+            const pseudoclock_instruction &instruction = runs[i].instructions[j];
+            if (pseudoclock_encode(instruction.half_period, instruction.reps, &words[i][j * 2]) != PSEUDOCLOCK_ENCODE_OK)
+            {
+                throw std::invalid_argument("invalid instruction " + std::to_string(j) + " for pseudoclock " + std::to_string(i));
+            }
+        }
+        int wait_count;
+        int words_to_send = pseudoclock_scan(words[i].data(), max_words, &wait_count);
+        if (words_to_send <= 2)
+        {
+            // The firmware does not run pseudoclocks with an empty table
+            timelines[i].completed = true;
+            continue;
+        }
+        configured[i] = true;
+        waits[i].assign(wait_count, 0);
+
+        // Equivalent of pio_pseudoclock_init
+        pio_emu_sm_config config;
+        config.wrap_target = offset + program.wrap_target;
+        config.wrap = offset + program.wrap;
+        config.side_set_bits = program.side_set_bits;
+        config.side_set_opt = program.side_set_opt;
+        config.side_set_pindirs = program.side_set_pindirs;
+        config.side_set_base = out_pin;
+        config.jmp_pin = in_pin;
+        config.in_base = in_pin;
+        config.clkdiv_int = runs[i].clock_divider / PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
+        config.clkdiv_frac = runs[i].clock_divider % PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
+        emu.sm_set_pindirs(0, out_pin, 1, true);
+        emu.gpio_set_function(out_pin, PIO_EMU_GPIO_FUNC_PIO0);
+        emu.sm_set_pindirs(0, in_pin, 1, false);
+        emu.gpio_set_function(in_pin, PIO_EMU_GPIO_FUNC_PIO0);
+        emu.sm_init(0, sm, offset + program.labels.at("start"), config);
+        emu.watch_pins(1u << out_pin);
+
+        if (hwstart)
+        {
+            // initial wait command (this precedes the DMA transfer)
+            emu.sm_put(0, sm, 0);
+            emu.sm_put(0, sm, 1);
+        }
+
+        pio_emu_dma_channel &instructions_channel = emu.dma(2 * sm);
+        instructions_channel.read = {PIO_EMU_DMA_MEMORY, words[i].data(), 0, 0};
+        instructions_channel.write = {PIO_EMU_DMA_TX_FIFO, nullptr, 0, sm};
+        instructions_channel.read_increment = true;
+        instructions_channel.write_increment = false;
+        instructions_channel.transfer_count = words_to_send;
+        emu.dma_start(2 * sm);
+
+        pio_emu_dma_channel &waits_channel = emu.dma(2 * sm + 1);
+        waits_channel.read = {PIO_EMU_DMA_RX_FIFO, nullptr, 0, sm};
+        waits_channel.write = {PIO_EMU_DMA_MEMORY, waits[i].data(), 0, 0};
+        waits_channel.read_increment = false;
+        waits_channel.write_increment = true;
+        waits_channel.transfer_count = wait_count;
+        emu.dma_start(2 * sm + 1);
+
+        enable_mask |= 1u << sm;
+    }
+
+    emu.step(dma_prefill_cycles);
+    uint64_t start = emu.cycle();
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        for (const trigger_pulse &pulse : runs[i].triggers)
+        {
+            emu.gpio_schedule_input(start + pulse.start, in_pin_for(static_cast<int>(i)), 1);
+            emu.gpio_schedule_input(start + pulse.start + pulse.width, in_pin_for(static_cast<int>(i)), 0);
+        }
+    }
+    emu.enable_sm_mask_in_sync(0, enable_mask);
+
+    size_t remaining = 0;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (configured[i])
+        {
+            remaining++;
+            emu.dma(2 * i + 1).on_complete = [&, i](int) {
+                timelines[i].completed = true;
+                timelines[i].stop_cycle = emu.cycle() - start;
+                remaining--;
+            };
+        }
+    }
+    while (remaining > 0 && emu.cycle() - start < max_cycles)
+    {
+        emu.step();
+    }
+
+    for (const pio_emu_edge &edge : emu.edges())
+    {
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            if (edge.pin == out_pin_for(static_cast<int>(i)))
+            {
+                timelines[i].edges.push_back({edge.cycle - start, edge.level});
+            }
+        }
+    }
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        // Only report the values that actually made it out of the PIO
+        if (configured[i])
+        {
+            waits[i].resize(waits[i].size() - emu.dma(2 * i + 1).transfer_count);
+        }
+        timelines[i].waits = waits[i];
+    }
+    return timelines;
+}
+
+bool expected_timeline(const pseudoclock_run &run, bool hwstart, bool edge_triggered, uint64_t max_cycles, pseudoclock_timeline &timeline, std::string &error)
+{
+    timeline = pseudoclock_timeline();
+
+    // The timeline is worked out in cycles of the state machine (the cycle numbers below),
+    // which runs on the system clock cycles where its fractional clock divider overflows
+    // (see pio_emulator::step_sm). This is the system clock cycle of its cycle c.
+    auto system_cycle = [&](uint64_t c) {
+        return ((c + 1) * run.clock_divider + PSEUDOCLOCK_CLOCK_DIVIDER_ONE - 1) / PSEUDOCLOCK_CLOCK_DIVIDER_ONE - 1;
+    };
+
+    // Level of the trigger as seen by the state machine (after the input synchroniser)
+    auto trigger_visible = [&](uint64_t c) {
+        uint64_t cycle = system_cycle(c);
+        if (cycle < input_sync_cycles)
+        {
+            return false;
+        }
+        uint64_t pad_cycle = cycle - input_sync_cycles;
+        for (const trigger_pulse &pulse : run.triggers)
+        {
+            if (pad_cycle >= pulse.start && pad_cycle < pulse.start + pulse.width)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    // First cycle >= from (checking every cycle) at which the trigger is seen at level (a "wait")
+    auto wait_for = [&](uint64_t from, bool level, uint64_t &detected) {
+        for (uint64_t c = from; system_cycle(c) < max_cycles; c++)
+        {
+            if (trigger_visible(c) == level)
+            {
+                detected = c;
+                return true;
+            }
+        }
+        return false;
+    };
+    // First cycle >= from at which an indefinite wait sees the trigger. pseudoclock_edge first
+    // waits for it to be low.
+    auto indefinite_wait = [&](uint64_t from, uint64_t &detected) {
+        if (edge_triggered)
+        {
+            if (!wait_for(from, false, from))
+            {
+                return false;
+            }
+            from++;
+        }
+        return wait_for(from, true, detected);
+    };
+    uint64_t arm_latency = PSEUDOCLOCK_INDEFINITE_WAIT_ARM_LATENCY + (edge_triggered ? edge_arm_delay : 0);
+
+    // Either we have just jumped to "start" at cycle at_start, or the previous
+    // instruction ended at cycle end
+    bool at_start = true;
+    uint64_t start = 0;
+    uint64_t end = 0;
+
+    if (hwstart)
+    {
+        // The hardware start is an indefinite wait before the table
+        uint64_t detected;
+        if (!indefinite_wait(start + arm_latency, detected))
+        {
+            return true;
+        }
+        start = detected + PSEUDOCLOCK_RESUME_LATENCY - PSEUDOCLOCK_START_LATENCY;
+    }
+
+    for (size_t i = 0; i < run.instructions.size(); i++)
+    {
+        const pseudoclock_instruction &instruction = run.instructions[i];
+        bool is_stop = instruction.reps == 0 && instruction.half_period == 0;
+        bool is_wait = instruction.reps == 0 && !is_stop;
+        bool is_indefinite_wait = is_wait && instruction.half_period == PSEUDOCLOCK_INDEFINITE_WAIT;
+
+        if (is_stop)
+        {
+            if (at_start)
+            {
+                error = "instruction " + std::to_string(i) + ": a stop directly after a wait (or at the start of the table) is not supported";
+                return false;
+            }
+            // The stop instruction pushes the (empty) ISR
+            timeline.waits.push_back(0);
+            timeline.stop_cycle = system_cycle(end + PSEUDOCLOCK_STOP_LATENCY);
+            timeline.completed = true;
+            return true;
+        }
+
+        if (is_wait)
+        {
+            if (at_start)
+            {
+                // A wait directly after jumping to "start" is an indefinite wait (and is not logged)
+                uint64_t detected;
+                if (!indefinite_wait(start + arm_latency, detected))
+                {
+                    return true;
+                }
+                start = detected + PSEUDOCLOCK_RESUME_LATENCY - PSEUDOCLOCK_START_LATENCY;
+                continue;
+            }
+
+            if (is_indefinite_wait)
+            {
+                // An explicit indefinite wait checks the trigger every cycle, and is logged
+                // with a value of 0
+                uint64_t detected;
+                if (!indefinite_wait(end + PSEUDOCLOCK_INDEFINITE_WAIT_FIRST_CHECK, detected))
+                {
+                    return true;
+                }
+                timeline.waits.push_back(0);
+                start = detected + PSEUDOCLOCK_INDEFINITE_WAIT_RESUME_LATENCY - PSEUDOCLOCK_START_LATENCY;
+                at_start = true;
+                continue;
+            }
+
+            uint32_t words[2];
+            pseudoclock_encode(instruction.half_period, instruction.reps, words);
+            uint32_t loops = words[1];
+            uint64_t first_check = end + PSEUDOCLOCK_WAIT_FIRST_CHECK;
+            if (edge_triggered)
+            {
+                // pseudoclock_edge waits for the trigger to be low before the wait loop
+                uint64_t low;
+                if (!wait_for(first_check, false, low))
+                {
+                    return true;
+                }
+                first_check = low + 1;
+            }
+            uint64_t done;
+            uint32_t remaining = 0xffffffffu;
+            bool triggered = false;
+            // The trigger is checked every PSEUDOCLOCK_WAIT_LOOP_LENGTH cycles, once per loop
+            for (uint64_t k = 0; k <= loops; k++)
+            {
+                uint64_t check = first_check + PSEUDOCLOCK_WAIT_LOOP_LENGTH * k;
+                if (system_cycle(check) >= max_cycles)
+                {
+                    return true;
+                }
+                if (trigger_visible(check))
+                {
+                    remaining = loops - static_cast<uint32_t>(k);
+                    done = check;
+                    triggered = true;
+                    break;
+                }
+            }
+            if (!triggered)
+            {
+                // Timeout: the final loop iteration falls through to waitdone
+                done = first_check + PSEUDOCLOCK_WAIT_LOOP_LENGTH * loops + 1;
+            }
+            timeline.waits.push_back(remaining);
+            start = done + PSEUDOCLOCK_RESUME_LATENCY - PSEUDOCLOCK_START_LATENCY;
+            at_start = true;
+            continue;
+        }
+
+        uint64_t rise = at_start ? start + PSEUDOCLOCK_START_LATENCY : end;
+        for (uint64_t r = 0; r < instruction.reps; r++)
+        {
+            uint64_t edge = rise + 2 * r * instruction.half_period;
+            if (system_cycle(edge) >= max_cycles)
+            {
+                return true;
+            }
+            timeline.edges.push_back({system_cycle(edge), 1});
+            timeline.edges.push_back({system_cycle(edge + instruction.half_period), 0});
+        }
+        end = rise + 2 * static_cast<uint64_t>(instruction.reps) * instruction.half_period;
+        at_start = false;
+    }
+
+    error = "table has no stop instruction";
+    return false;
+}
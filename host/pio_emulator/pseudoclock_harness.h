@@ -0,0 +1,87 @@
+/*
+#######################################################################
+#                                                                     #
+# pseudoclock_harness.h                                               #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Runs instruction tables through pseudoclock.pio on the PIO emulator, using the
+  same encoding, memory layout and DMA setup as the firmware, and independently
+  computes the timeline the tables are expected to produce.
+
+  All cycle numbers are system clock cycles relative to the cycle the state machines
+  are enabled, except for the instructions of a state machine with a clock divider
+  (see pseudoclock_run).
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pio_assembler.h"
+#include "pseudoclock_encoding.h"
+
+// A user facing instruction, in the units accepted by the "set" command
+struct pseudoclock_instruction
+{
+    uint32_t half_period;
+    uint32_t reps;
+};
+
+struct trigger_pulse
+{
+    uint64_t start;
+    uint64_t width;
+};
+
+struct pseudoclock_edge
+{
+    uint64_t cycle;
+    int level;
+
+    bool operator==(const pseudoclock_edge &other) const { return cycle == other.cycle && level == other.level; }
+};
+
+struct pseudoclock_timeline
+{
+    std::vector<pseudoclock_edge> edges;
+    // Values pushed by the PIO (one per wait plus one for the stop instruction),
+    // in the form stored in the firmware waits array
+    std::vector<uint32_t> waits;
+    // False if the sequence did not complete within the cycle limit
+    bool completed = false;
+    // Cycle at which the stop instruction was reached
+    uint64_t stop_cycle = 0;
+};
+
+struct pseudoclock_run
+{
+    // In cycles of the state machine, i.e. after pseudoclock_divide_cycles (as the firmware
+    // encodes them)
+    std::vector<pseudoclock_instruction> instructions;
+    std::vector<trigger_pulse> triggers;
+    // Clock divider of the state machine, in 1/256ths (see "setclkdiv")
+    uint32_t clock_divider = PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
+};
+
+// The latencies of pseudoclock.pio (PSEUDOCLOCK_START_LATENCY etc.) that define the golden
+// timeline are in pseudoclock_encoding.h, as the firmware also uses them.
+
+// Simulate one or more pseudoclocks (pseudoclock i uses state machine i with its own trigger pin).
+// program is either pseudoclock or pseudoclock_edge.
+std::vector<pseudoclock_timeline> simulate_pseudoclocks(const pio_program_info &program, const std::vector<pseudoclock_run> &runs, bool hwstart, uint64_t max_cycles);
+
+// Compute the expected timeline of a single pseudoclock, running pseudoclock_edge if
+// edge_triggered is true. Returns false and sets error if the table contains a sequence the
+// PIO program does not support.
+bool expected_timeline(const pseudoclock_run &run, bool hwstart, bool edge_triggered, uint64_t max_cycles, pseudoclock_timeline &timeline, std::string &error);
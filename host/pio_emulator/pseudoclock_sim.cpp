@@ -0,0 +1,442 @@
+/*
+#######################################################################
+#                                                                     #
+# pseudoclock_sim.cpp                                                 #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Command line front end for the PIO emulator
+
+  Run instruction tables through pseudoclock.pio and print the edge times:
+      pseudoclock_sim [--hwstart] [--edge] [--trigger <pseudoclock>:<cycle>:<width>] table0.txt [table1.txt ...]
+
+  Table files contain one "<half-period> <reps>" instruction per line (as for "set", in
+  cycles of the state machine if it has a clock divider).
+
+  Compare the emulated output against the golden timeline for randomised tables (run by
+  both programs, with and without clock dividers):
+      pseudoclock_sim --check [--seed <n>] [--iterations <n>]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pio_assembler.h"
+#include "pseudoclock_encoding.h"
+#include "pseudoclock_harness.h"
+
+#ifndef PSEUDOCLOCK_PIO_PATH
+#define PSEUDOCLOCK_PIO_PATH "pseudoclock.pio"
+#endif
+
+namespace
+{
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: pseudoclock_sim [options] <table file>...\n"
+            "       pseudoclock_sim --check [options]\n"
+            "options:\n"
+            "  --program <path>             pseudoclock.pio to run (default " PSEUDOCLOCK_PIO_PATH ")\n"
+            "  --hwstart                    wait for a trigger before starting\n"
+            "  --edge                       run pseudoclock_edge (the edge trigger modes)\n"
+            "  --clkdiv <pc>:<int>:<frac>   clock divider of pseudoclock <pc> (as for setclkdiv)\n"
+            "  --trigger <pc>:<cycle>:<len> add a trigger pulse for pseudoclock <pc>\n"
+            "  --max-cycles <n>             give up after this many cycles (default 10000000)\n"
+            "  --check                      compare randomised tables against the golden timeline\n"
+            "  --seed <n>                   seed for --check (default 1)\n"
+            "  --iterations <n>             number of randomised runs for --check (default 500)\n");
+}
+
+bool load_table(const std::string &path, std::vector<pseudoclock_instruction> &table)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "could not open %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    bool has_stop = false;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        pseudoclock_instruction instruction;
+        if (fields >> instruction.half_period >> instruction.reps)
+        {
+            table.push_back(instruction);
+            if (instruction.half_period == 0 && instruction.reps == 0)
+            {
+                has_stop = true;
+                break;
+            }
+        }
+    }
+    if (!has_stop)
+    {
+        table.push_back({0, 0});
+    }
+    return true;
+}
+
+void print_timeline(int pseudoclock, const pseudoclock_timeline &timeline)
+{
+    for (const pseudoclock_edge &edge : timeline.edges)
+    {
+        printf("edge %d %llu %d\n", pseudoclock, (unsigned long long)edge.cycle, edge.level);
+    }
+    for (size_t i = 0; i < timeline.waits.size(); i++)
+    {
+        printf("wait %d %zu %u\n", pseudoclock, i, timeline.waits[i]);
+    }
+    if (timeline.completed)
+    {
+        printf("stop %d %llu\n", pseudoclock, (unsigned long long)timeline.stop_cycle);
+    }
+    else
+    {
+        printf("incomplete %d\n", pseudoclock);
+    }
+}
+
+pseudoclock_run random_run(std::mt19937_64 &rng)
+{
+    auto uniform = [&](uint64_t low, uint64_t high) { return std::uniform_int_distribution<uint64_t>(low, high)(rng); };
+    pseudoclock_run run;
+
+    // Mostly no clock divider, otherwise an integer or a fractional one
+    switch (uniform(0, 3))
+    {
+    case 0:
+        run.clock_divider = static_cast<uint32_t>(uniform(2, 4)) * PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
+        break;
+    case 1:
+        run.clock_divider = static_cast<uint32_t>(uniform(PSEUDOCLOCK_CLOCK_DIVIDER_ONE + 1, 4 * PSEUDOCLOCK_CLOCK_DIVIDER_ONE));
+        break;
+    default:
+        break;
+    }
+
+    int count = static_cast<int>(uniform(1, 40));
+    bool previous_was_wait = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (uniform(0, 99) < 25)
+        {
+            // wait (consecutive waits make an indefinite wait), sometimes an explicit indefinite wait
+            uint32_t timeout = static_cast<uint32_t>(uniform(PSEUDOCLOCK_MIN_WAIT_LENGTH, uniform(0, 9) == 0 ? 2000 : 80));
+            run.instructions.push_back({uniform(0, 4) == 0 ? PSEUDOCLOCK_INDEFINITE_WAIT : timeout, 0});
+            previous_was_wait = true;
+        }
+        else
+        {
+            uint32_t half_period = static_cast<uint32_t>(uniform(PSEUDOCLOCK_NON_LOOP_PATH_LENGTH, uniform(0, 9) == 0 ? 1000 : 30));
+            uint32_t reps = static_cast<uint32_t>(uniform(1, uniform(0, 9) == 0 ? 50 : 4));
+            run.instructions.push_back({half_period, reps});
+            previous_was_wait = false;
+        }
+    }
+    if (previous_was_wait)
+    {
+        // A stop directly after a wait would leave the pseudoclock waiting forever
+        run.instructions.push_back({static_cast<uint32_t>(uniform(PSEUDOCLOCK_NON_LOOP_PATH_LENGTH, 30)), 1});
+    }
+    run.instructions.push_back({0, 0});
+
+    // Trigger pulses of random widths (including ones long enough to end an indefinite
+    // wait as well as the wait before it) spread across the run
+    uint64_t t = uniform(0, 200);
+    while (t < 400000)
+    {
+        uint64_t width = uniform(1, uniform(0, 4) == 0 ? 40 : 8);
+        run.triggers.push_back({t, width});
+        t += width + uniform(1, 600);
+    }
+    return run;
+}
+
+bool compare(const pseudoclock_timeline &expected, const pseudoclock_timeline &actual, std::string &message)
+{
+    if (expected.completed != actual.completed)
+    {
+        message = expected.completed ? "emulated sequence did not complete" : "emulated sequence completed unexpectedly";
+        return false;
+    }
+    size_t edges = expected.edges.size() < actual.edges.size() ? expected.edges.size() : actual.edges.size();
+    for (size_t i = 0; i < edges; i++)
+    {
+        if (!(expected.edges[i] == actual.edges[i]))
+        {
+            message = "edge " + std::to_string(i) + ": expected level " + std::to_string(expected.edges[i].level) + " at cycle " + std::to_string(expected.edges[i].cycle) + ", got level " + std::to_string(actual.edges[i].level) + " at cycle " + std::to_string(actual.edges[i].cycle);
+            return false;
+        }
+    }
+    if (expected.edges.size() != actual.edges.size())
+    {
+        message = "expected " + std::to_string(expected.edges.size()) + " edges, got " + std::to_string(actual.edges.size());
+        return false;
+    }
+    std::vector<uint32_t> expected_waits = expected.waits;
+    std::vector<uint32_t> actual_waits = actual.waits;
+    if (!expected.completed)
+    {
+        // Values pushed right at the cycle limit may not have been transferred yet
+        size_t common = expected_waits.size() < actual_waits.size() ? expected_waits.size() : actual_waits.size();
+        expected_waits.resize(common);
+        actual_waits.resize(common);
+    }
+    if (expected_waits != actual_waits)
+    {
+        message = "wait values differ:";
+        for (size_t i = 0; i < expected.waits.size() || i < actual.waits.size(); i++)
+        {
+            message += " [" + std::to_string(i) + "] " + (i < expected.waits.size() ? std::to_string(expected.waits[i]) : "-") + "/" + (i < actual.waits.size() ? std::to_string(actual.waits[i]) : "-");
+        }
+        return false;
+    }
+    return true;
+}
+
+void print_run(const pseudoclock_run &run)
+{
+    for (const pseudoclock_instruction &instruction : run.instructions)
+    {
+        fprintf(stderr, "    %u %u\n", instruction.half_period, instruction.reps);
+    }
+}
+
+int run_check(const pio_program_info &program, const pio_program_info &edge_program, uint64_t seed, int iterations, uint64_t max_cycles)
+{
+    std::mt19937_64 rng(seed);
+    int failures = 0;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        bool hwstart = std::uniform_int_distribution<int>(0, 1)(rng);
+        bool edge_triggered = std::uniform_int_distribution<int>(0, 1)(rng);
+        int num_pseudoclocks = std::uniform_int_distribution<int>(1, 4)(rng);
+        std::vector<pseudoclock_run> runs;
+        for (int i = 0; i < num_pseudoclocks; i++)
+        {
+            runs.push_back(random_run(rng));
+        }
+
+        std::vector<pseudoclock_timeline> actual = simulate_pseudoclocks(edge_triggered ? edge_program : program, runs, hwstart, max_cycles);
+        bool matched = true;
+        for (int i = 0; i < num_pseudoclocks; i++)
+        {
+            pseudoclock_timeline expected;
+            std::string error;
+            if (!expected_timeline(runs[i], hwstart, edge_triggered, max_cycles, expected, error))
+            {
+                fprintf(stderr, "iteration %d pseudoclock %d: invalid table: %s\n", iteration, i, error.c_str());
+                matched = false;
+                continue;
+            }
+            std::string message;
+            if (!compare(expected, actual[i], message))
+            {
+                fprintf(stderr, "iteration %d pseudoclock %d (%s, %s, divider %u/256): %s\n", iteration, i, hwstart ? "hwstart" : "start", edge_triggered ? "edge" : "level", runs[i].clock_divider, message.c_str());
+                print_run(runs[i]);
+                matched = false;
+            }
+        }
+        if (!matched)
+        {
+            failures++;
+        }
+    }
+    printf("%d/%d randomised runs matched the golden timeline\n", iterations - failures, iterations);
+    return failures == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string program_path = PSEUDOCLOCK_PIO_PATH;
+    bool hwstart = false;
+    bool edge_triggered = false;
+    bool check = false;
+    uint64_t seed = 1;
+    int iterations = 500;
+    uint64_t max_cycles = 10000000;
+    std::vector<std::string> table_paths;
+    std::vector<std::pair<int, trigger_pulse>> triggers;
+    std::vector<std::pair<int, uint32_t>> clock_dividers;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char * {
+            if (i + 1 >= argc)
+            {
+                usage();
+                exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--program")
+        {
+            program_path = next();
+        }
+        else if (arg == "--hwstart")
+        {
+            hwstart = true;
+        }
+        else if (arg == "--edge")
+        {
+            edge_triggered = true;
+        }
+        else if (arg == "--clkdiv")
+        {
+            int pseudoclock;
+            unsigned div_int, div_frac;
+            if (sscanf(next(), "%d:%u:%u", &pseudoclock, &div_int, &div_frac) != 3 || pseudoclock < 0 || pseudoclock > 3 || div_int < 1 || div_int > 65535 || div_frac > 255)
+            {
+                usage();
+                return 2;
+            }
+            clock_dividers.push_back({pseudoclock, div_int * PSEUDOCLOCK_CLOCK_DIVIDER_ONE + div_frac});
+        }
+        else if (arg == "--trigger")
+        {
+            int pseudoclock;
+            unsigned long long start, width;
+            if (sscanf(next(), "%d:%llu:%llu", &pseudoclock, &start, &width) != 3 || pseudoclock < 0 || pseudoclock > 3)
+            {
+                usage();
+                return 2;
+            }
+            triggers.push_back({pseudoclock, {start, width}});
+        }
+        else if (arg == "--max-cycles")
+        {
+            max_cycles = strtoull(next(), nullptr, 0);
+        }
+        else if (arg == "--check")
+        {
+            check = true;
+        }
+        else if (arg == "--seed")
+        {
+            seed = strtoull(next(), nullptr, 0);
+        }
+        else if (arg == "--iterations")
+        {
+            iterations = atoi(next());
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            return 0;
+        }
+        else if (arg[0] == '-')
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            table_paths.push_back(arg);
+        }
+    }
+
+    pio_program_info program;
+    pio_program_info edge_program;
+    try
+    {
+        program = pio_assemble_file(program_path, "pseudoclock");
+        edge_program = pio_assemble_file(program_path, "pseudoclock_edge");
+    }
+    catch (const pio_assembler_error &e)
+    {
+        fprintf(stderr, "%s: %s\n", program_path.c_str(), e.what());
+        return 2;
+    }
+
+    if (check)
+    {
+        return run_check(program, edge_program, seed, iterations, max_cycles);
+    }
+
+    if (table_paths.empty() || table_paths.size() > 4)
+    {
+        usage();
+        return 2;
+    }
+    std::vector<pseudoclock_run> runs(table_paths.size());
+    for (size_t i = 0; i < table_paths.size(); i++)
+    {
+        if (!load_table(table_paths[i], runs[i].instructions))
+        {
+            return 2;
+        }
+    }
+    for (auto &trigger : triggers)
+    {
+        if (trigger.first >= (int)runs.size())
+        {
+            fprintf(stderr, "trigger for pseudoclock %d but only %zu tables given\n", trigger.first, runs.size());
+            return 2;
+        }
+        runs[trigger.first].triggers.push_back(trigger.second);
+    }
+    for (auto &clock_divider : clock_dividers)
+    {
+        if (clock_divider.first >= (int)runs.size())
+        {
+            fprintf(stderr, "clock divider for pseudoclock %d but only %zu tables given\n", clock_divider.first, runs.size());
+            return 2;
+        }
+        runs[clock_divider.first].clock_divider = clock_divider.second;
+    }
+
+    std::vector<pseudoclock_timeline> timelines;
+    try
+    {
+        timelines = simulate_pseudoclocks(edge_triggered ? edge_program : program, runs, hwstart, max_cycles);
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < timelines.size(); i++)
+    {
+        print_timeline(static_cast<int>(i), timelines[i]);
+
+        // Flag any difference from the golden timeline
+        pseudoclock_timeline expected;
+        std::string error;
+        if (!expected_timeline(runs[i], hwstart, edge_triggered, max_cycles, expected, error))
+        {
+            fprintf(stderr, "pseudoclock %zu: %s\n", i, error.c_str());
+            status = 1;
+        }
+        else if (!compare(expected, timelines[i], error))
+        {
+            fprintf(stderr, "pseudoclock %zu does not match the golden timeline: %s\n", i, error.c_str());
+            status = 1;
+        }
+    }
+    return status;
+}
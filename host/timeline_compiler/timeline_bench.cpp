@@ -0,0 +1,112 @@
+/*
+#######################################################################
+#                                                                     #
+# timeline_bench.cpp                                                  #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Throughput of the timeline compiler
+
+      timeline_bench [--ticks <n>] [--seed <n>] [--threads <n>]
+
+  Generates a timeline made of runs of evenly spaced ticks with random lengths and
+  spacings, compiles it with one thread and with --threads threads (default: all hardware
+  threads), and checks
+  that both give the same table.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include "timeline_compiler.h"
+
+namespace
+{
+
+using bench_clock = std::chrono::steady_clock;
+
+std::vector<timeline_segment> make_timeline(size_t ticks, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<uint64_t> run_length(1, 5000);
+    std::uniform_int_distribution<uint64_t> half_period(5, 100000);
+
+    timeline_segment segment;
+    segment.ticks.reserve(ticks);
+    uint64_t t = 0;
+    while (segment.ticks.size() < ticks)
+    {
+        uint64_t spacing = 2 * half_period(rng);
+        for (uint64_t n = run_length(rng); n > 0 && segment.ticks.size() < ticks; n--)
+        {
+            segment.ticks.push_back(t);
+            t += spacing;
+        }
+    }
+    return {segment};
+}
+
+std::vector<timeline_instruction> timed_compile(const std::vector<timeline_segment> &segments, unsigned threads, size_t ticks)
+{
+    timeline_compile_options options;
+    options.threads = threads;
+    auto start = bench_clock::now();
+    std::vector<timeline_instruction> table = compile_timeline(segments, options);
+    double elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+    printf("%2u thread(s): %zu ticks -> %zu instructions in %6.3f s: %8.1f M ticks/s\n", threads, ticks, table.size(), elapsed, ticks / elapsed / 1e6);
+    return table;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    size_t ticks = 10000000;
+    unsigned seed = 1;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--ticks") == 0)
+        {
+            ticks = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0)
+        {
+            seed = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--threads") == 0)
+        {
+            threads = strtoul(argv[++i], nullptr, 0);
+        }
+        else
+        {
+            fprintf(stderr, "usage: timeline_bench [--ticks <n>] [--seed <n>] [--threads <n>]\n");
+            return 2;
+        }
+    }
+
+    std::vector<timeline_segment> segments = make_timeline(ticks, seed);
+    std::vector<timeline_instruction> serial = timed_compile(segments, 1, ticks);
+    std::vector<timeline_instruction> parallel = timed_compile(segments, threads, ticks);
+    printf("compression: %.1f ticks per instruction\n", static_cast<double>(ticks) / serial.size());
+    if (serial != parallel)
+    {
+        fprintf(stderr, "serial and parallel tables differ\n");
+        return 1;
+    }
+    return 0;
+}
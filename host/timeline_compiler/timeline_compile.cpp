@@ -0,0 +1,136 @@
+/*
+#######################################################################
+#                                                                     #
+# timeline_compile.cpp                                                #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Compile a list of tick times into an instruction table
+
+      timeline_compile [--threads <n>] [--delay-waits] [--final-half-period <n>] [input] [-o output]
+
+  The input has one tick time (in clock cycles) per line, "wait <timeout>" to wait
+  for a trigger, and "#" comments. It is read from stdin if no file is given. The
+  output has one "<half_period> <reps>" line per instruction, which is the format
+  read by pseudoclock_sim, and goes to stdout unless -o is given.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include "timeline_compiler.h"
+
+namespace
+{
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: timeline_compile [options] [input] [-o output]\n"
+            "  --threads <n>                worker threads (default: all)\n"
+            "  --delay-waits                bridge long gaps with timed waits\n"
+            "  --final-half-period <n>      half period of the last tick of a segment (default 5)\n");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    timeline_compile_options options;
+    std::string input_path;
+    std::string output_path;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--threads") == 0)
+        {
+            options.threads = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--delay-waits") == 0)
+        {
+            options.allow_delay_waits = true;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--final-half-period") == 0)
+        {
+            options.final_half_period = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-o") == 0)
+        {
+            output_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && input_path.empty())
+        {
+            input_path = argv[i];
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::string text;
+    if (input_path.empty())
+    {
+        text.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        std::ifstream file(input_path);
+        if (!file)
+        {
+            fprintf(stderr, "could not open %s\n", input_path.c_str());
+            return 2;
+        }
+        text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<timeline_instruction> table;
+    try
+    {
+        table = compile_timeline(parse_timeline(text), options);
+    }
+    catch (const timeline_error &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    std::ostringstream out;
+    for (const timeline_instruction &instruction : table)
+    {
+        out << instruction.half_period << ' ' << instruction.reps << '\n';
+    }
+    if (output_path.empty())
+    {
+        std::cout << out.str();
+    }
+    else
+    {
+        std::ofstream file(output_path);
+        if (!(file << out.str()))
+        {
+            fprintf(stderr, "could not write %s\n", output_path.c_str());
+            return 2;
+        }
+    }
+    if (table.size() > 30000)
+    {
+        fprintf(stderr, "warning: %zu instructions do not fit in a single pseudoclock (30000)\n", table.size());
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+#######################################################################
+#                                                                     #
+# timeline_compiler.cpp                                               #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+#include "timeline_compiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "pseudoclock_encoding.h"
+
+namespace
+{
+
+const uint64_t max_half_period = UINT32_MAX;
+const uint64_t max_reps = UINT32_MAX;
+// Largest (even) timeout that can be encoded
+const uint64_t max_wait_timeout = UINT32_MAX - 1;
+// A timed out wait is followed by the next rising edge this many cycles after the
+// timeout (3 cycles to the first check, 1 to fall through, 8 to resume, less the 4
+// setup cycles included in the timeout; see pseudoclock_harness.h)
+const uint64_t delay_wait_overhead = 8;
+// Don't bother with threads for fewer ticks than this per chunk
+const size_t min_chunk_ticks = 1 << 16;
+
+// Consecutive ticks with the same spacing, or (when delay_wait is set) a single tick
+// followed by a timed wait
+struct tick_run
+{
+    uint64_t half_period;
+    uint64_t count;
+    uint32_t delay_wait;
+};
+
+struct chunk_result
+{
+    std::vector<tick_run> runs;
+    // Index of the first tick that could not be converted (or SIZE_MAX)
+    size_t error_index = SIZE_MAX;
+    std::string error;
+};
+
+void append_run(std::vector<tick_run> &runs, const tick_run &run)
+{
+    if (!runs.empty() && run.delay_wait == 0 && runs.back().delay_wait == 0 && runs.back().half_period == run.half_period)
+    {
+        runs.back().count += run.count;
+    }
+    else
+    {
+        runs.push_back(run);
+    }
+}
+
+// Convert the spacing after ticks [first, last) into runs
+void convert_chunk(const std::vector<uint64_t> &ticks, size_t first, size_t last, const timeline_compile_options &options, chunk_result &result)
+{
+    for (size_t i = first; i < last; i++)
+    {
+        if (ticks[i + 1] <= ticks[i])
+        {
+            result.error_index = i + 1;
+            result.error = "tick times must increase";
+            return;
+        }
+        uint64_t gap = ticks[i + 1] - ticks[i];
+        if (gap % 2)
+        {
+            result.error_index = i + 1;
+            result.error = "an odd number of cycles between ticks (" + std::to_string(gap) + ") cannot be produced with a 50-50 duty cycle";
+            return;
+        }
+        if (gap < 2 * PSEUDOCLOCK_NON_LOOP_PATH_LENGTH)
+        {
+            result.error_index = i + 1;
+            result.error = "ticks are closer than the minimum period (" + std::to_string(gap) + " < " + std::to_string(2 * PSEUDOCLOCK_NON_LOOP_PATH_LENGTH) + ")";
+            return;
+        }
+        if (gap / 2 <= max_half_period)
+        {
+            append_run(result.runs, {gap / 2, 1, 0});
+            continue;
+        }
+
+        // Too long for a single period: a pulse and then a wait that times out
+        uint64_t max_delay = 2 * max_half_period + max_wait_timeout + delay_wait_overhead;
+        if (!options.allow_delay_waits || gap > max_delay)
+        {
+            result.error_index = i + 1;
+            result.error = "gap between ticks (" + std::to_string(gap) + ") is longer than the longest period" + std::string(options.allow_delay_waits ? " plus the longest wait" : " (see allow_delay_waits)");
+            return;
+        }
+        uint64_t half_period = PSEUDOCLOCK_NON_LOOP_PATH_LENGTH;
+        if (gap - 2 * half_period - delay_wait_overhead > max_wait_timeout)
+        {
+            half_period = (gap - delay_wait_overhead - max_wait_timeout) / 2;
+        }
+        uint64_t timeout = gap - 2 * half_period - delay_wait_overhead;
+        append_run(result.runs, {half_period, 1, static_cast<uint32_t>(timeout)});
+    }
+}
+
+// Runs for a whole segment, converted in parallel chunks
+std::vector<tick_run> convert_segment(const timeline_segment &segment, size_t segment_index, const timeline_compile_options &options)
+{
+    const std::vector<uint64_t> &ticks = segment.ticks;
+    std::vector<tick_run> runs;
+    if (ticks.empty())
+    {
+        return runs;
+    }
+
+    size_t gaps = ticks.size() - 1;
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t chunks = std::max<size_t>(1, std::min<size_t>(threads, gaps / min_chunk_ticks));
+    std::vector<chunk_result> results(chunks);
+    std::vector<std::thread> workers;
+    for (size_t c = 0; c < chunks; c++)
+    {
+        size_t first = gaps * c / chunks;
+        size_t last = gaps * (c + 1) / chunks;
+        if (c + 1 == chunks)
+        {
+            convert_chunk(ticks, first, last, options, results[c]);
+        }
+        else
+        {
+            workers.emplace_back(convert_chunk, std::cref(ticks), first, last, std::cref(options), std::ref(results[c]));
+        }
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    // Stitch the chunks together (the first error is in the earliest failed chunk)
+    for (const chunk_result &result : results)
+    {
+        if (result.error_index != SIZE_MAX)
+        {
+            throw timeline_error("segment " + std::to_string(segment_index) + ", tick " + std::to_string(result.error_index) + ": " + result.error);
+        }
+        for (const tick_run &run : result.runs)
+        {
+            append_run(runs, run);
+        }
+    }
+
+    // The last tick repeats the final spacing
+    if (!runs.empty() && runs.back().delay_wait == 0)
+    {
+        runs.back().count++;
+    }
+    else
+    {
+        append_run(runs, {options.final_half_period, 1, 0});
+    }
+    return runs;
+}
+
+void emit(std::vector<timeline_instruction> &table, uint32_t half_period, uint32_t reps)
+{
+    uint32_t words[2];
+    if (pseudoclock_encode(half_period, reps, words) != PSEUDOCLOCK_ENCODE_OK)
+    {
+        throw timeline_error("cannot encode instruction (" + std::to_string(half_period) + ", " + std::to_string(reps) + ")");
+    }
+    table.push_back({half_period, reps});
+}
+
+} // namespace
+
+std::vector<timeline_instruction> compile_timeline(const std::vector<timeline_segment> &segments, const timeline_compile_options &options)
+{
+    std::vector<timeline_instruction> table;
+    for (size_t s = 0; s < segments.size(); s++)
+    {
+        for (const tick_run &run : convert_segment(segments[s], s, options))
+        {
+            for (uint64_t remaining = run.count; remaining > 0;)
+            {
+                uint32_t reps = static_cast<uint32_t>(std::min(remaining, max_reps));
+                emit(table, static_cast<uint32_t>(run.half_period), reps);
+                remaining -= reps;
+            }
+            if (run.delay_wait)
+            {
+                emit(table, run.delay_wait, 0);
+            }
+        }
+        if (segments[s].wait_timeout)
+        {
+            emit(table, segments[s].wait_timeout, 0);
+        }
+    }
+    table.push_back({0, 0});
+    return table;
+}
+
+std::vector<timeline_segment> parse_timeline(const std::string &text)
+{
+    std::vector<timeline_segment> segments(1);
+    const char *p = text.c_str();
+    int line = 1;
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+        {
+            p++;
+        }
+        if (std::isdigit(static_cast<unsigned char>(*p)))
+        {
+            char *end;
+            segments.back().ticks.push_back(strtoull(p, &end, 10));
+            p = end;
+        }
+        else if (strncmp(p, "wait", 4) == 0)
+        {
+            char *end;
+            unsigned long long timeout = strtoull(p + 4, &end, 10);
+            if (end == p + 4 || timeout > UINT32_MAX)
+            {
+                throw timeline_error("line " + std::to_string(line) + ": invalid wait");
+            }
+            segments.back().wait_timeout = static_cast<uint32_t>(timeout);
+            segments.emplace_back();
+            p = end;
+        }
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+        {
+            p++;
+        }
+        if (*p == '#')
+        {
+            while (*p && *p != '\n')
+            {
+                p++;
+            }
+        }
+        if (*p == '\n')
+        {
+            p++;
+            line++;
+        }
+        else if (*p)
+        {
+            throw timeline_error("line " + std::to_string(line) + ": expected a tick time or \"wait <timeout>\"");
+        }
+    }
+    return segments;
+}
@@ -0,0 +1,77 @@
+/*
+#######################################################################
+#                                                                     #
+# timeline_compiler.h                                                 #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is part of the PrawnBlaster host tools (see readme.md and #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Converts clock tick times into a PrawnBlaster instruction table
+
+  Every pulse the PrawnBlaster produces has a 50-50 duty cycle, so the time between
+  two ticks (rising edges) fixes the half period of the first one. Consecutive ticks
+  with the same spacing are merged into a single instruction, which gives the
+  smallest possible table. Runs longer than 2^32-1 ticks are split over several
+  instructions.
+
+  Tick times are in system clock cycles. Only differences matter: the first tick of
+  a segment is output as soon as the pseudoclock starts (or resumes after a wait).
+  The last tick of a segment has the same half period as the one before it (or
+  final_half_period if it is the only tick).
+
+  Large timelines are converted in parallel chunks.
+ */
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct timeline_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Ticks output without interruption, optionally followed by a wait for a trigger
+struct timeline_segment
+{
+    std::vector<uint64_t> ticks;
+    // Timeout of the wait after the last tick (in clock cycles, 0 for no wait)
+    uint32_t wait_timeout = 0;
+};
+
+// An instruction in the units of the "set" command
+struct timeline_instruction
+{
+    uint32_t half_period;
+    uint32_t reps;
+
+    bool operator==(const timeline_instruction &other) const { return half_period == other.half_period && reps == other.reps; }
+};
+
+struct timeline_compile_options
+{
+    // Worker threads (0 to use all hardware threads)
+    unsigned threads = 0;
+    // Half period of a tick that is not followed by another tick in its segment
+    uint32_t final_half_period = 5;
+    // Bridge gaps longer than the longest period with a short pulse and a timed wait.
+    // These waits are reported by "getwait" and end early if the trigger goes high.
+    bool allow_delay_waits = false;
+};
+
+// Returns the instruction table (ending with a stop instruction)
+std::vector<timeline_instruction> compile_timeline(const std::vector<timeline_segment> &segments, const timeline_compile_options &options = timeline_compile_options());
+
+// Parse the text format read by timeline_compile (one tick time per line, "wait <timeout>"
+// ends a segment, "#" starts a comment)
+std::vector<timeline_segment> parse_timeline(const std::string &text);
@@ -0,0 +1,86 @@
+/*
+#######################################################################
+#                                                                     #
+# cycle_counter.h                                                     #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is used to flash a Raspberry Pi Pico microcontroller      #
+# prototyping board to create a PrawnBlaster (see readme.txt and      #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Cycle accurate timing of short intervals with the SysTick timer
+
+  SysTick is a 24 bit down counter clocked by clk_sys. Each core has its own, so
+  readings must only be compared with readings taken on the same core. Intervals
+  longer than 2^24 cycles (~168 ms at 100 MHz) wrap around.
+ */
+#ifndef _CYCLE_COUNTER_H_
+#define _CYCLE_COUNTER_H_
+
+#include "hardware/structs/systick.h"
+
+#define CYCLE_COUNTER_MASK 0x00ffffffu
+
+// Start the SysTick of the calling core free running from the processor clock
+static inline void cycle_counter_init(void)
+{
+    systick_hw->rvr = CYCLE_COUNTER_MASK;
+    systick_hw->cvr = 0;
+    // ENABLE | CLKSOURCE (processor clock), no interrupt
+    systick_hw->csr = 0x5;
+}
+
+static inline uint32_t cycle_counter_read(void)
+{
+    return systick_hw->cvr;
+}
+
+// Cycles between two readings (the counter counts down)
+static inline uint32_t cycle_counter_elapsed(uint32_t start, uint32_t end)
+{
+    return (start - end) & CYCLE_COUNTER_MASK;
+}
+
+// Count, minimum, maximum and total of a series of intervals (reset with cycle_stat_reset)
+struct cycle_stat
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+};
+
+static inline void cycle_stat_reset(struct cycle_stat *stat)
+{
+    stat->count = 0;
+    stat->min = 0xffffffffu;
+    stat->max = 0;
+    stat->total = 0;
+}
+
+static inline void cycle_stat_record(struct cycle_stat *stat, uint32_t cycles)
+{
+    stat->count++;
+    stat->total += cycles;
+    if (cycles < stat->min)
+    {
+        stat->min = cycles;
+    }
+    if (cycles > stat->max)
+    {
+        stat->max = cycles;
+    }
+}
+
+static inline uint32_t cycle_stat_mean(const struct cycle_stat *stat)
+{
+    return stat->count ? (uint32_t)(stat->total / stat->count) : 0;
+}
+#endif
@@ -12,6 +12,12 @@
   they are provided to simplify the API.
  */
 
+static void (*idle_callback)(void) = NULL;
+
+void fast_serial_set_idle_callback(void (*callback)(void)){
+	idle_callback = callback;
+}
+
 // Read bytes (blocks until buffer_size is reached)
 uint32_t fast_serial_read(const char * buffer, uint32_t buffer_size){
 	uint32_t buffer_idx = 0;
@@ -49,6 +55,9 @@ uint32_t fast_serial_read_until(char * buffer, uint32_t buffer_size, char until)
 		if(buffer_idx > 0 && buffer[buffer_idx-1] == until){
 			break;
 		}
+		if(idle_callback){
+			idle_callback();
+		}
 		fast_serial_task();
 	}
 	buffer[buffer_idx] = '\0'; // Null terminate string
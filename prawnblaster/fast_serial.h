@@ -49,6 +49,10 @@ uint32_t fast_serial_read(const char * buffer, uint32_t buffer_size);
 // Adds null terminator to buffer after read completes (reserving one byte in buffer for this)
 uint32_t fast_serial_read_until(char * buffer, uint32_t buffer_size, char until);
 
+// Set a function to call while fast_serial_read_until is waiting for data (NULL for none)
+// It may write to the serial port.
+void fast_serial_set_idle_callback(void (*callback)(void));
+
 // Clear read FIFO (without reading it)
 static inline void fast_serial_read_flush(){
 	tud_cdc_read_flush();
@@ -24,13 +24,19 @@
 #include "pico/multicore.h"
 #include "pico/bootrom.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
 #include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
 #include "hardware/pll.h"
 #include "hardware/clocks.h"
 #include "hardware/structs/pll.h"
 #include "hardware/structs/clocks.h"
 
+#include "cycle_counter.h"
 #include "pseudoclock.pio.h"
+#include "pseudoclock_encoding.h"
+#include "timestamp.pio.h"
 
 extern "C"{
 #include "fast_serial.h"
@@ -44,35 +50,76 @@ const char VERSION[16] = "1.1.1-overclock";
 
 int DEBUG;
 
+const unsigned int max_waits = 400;
+#ifdef PRAWNBLASTER_BANKED_SRAM
+// One bank per pseudoclock
+#define MAX_PSEUDOCLOCKS 4
+// Each pseudoclock's table lives in an SRAM bank of its own (see CMakeLists.txt), read through
+// the non-striped alias of that bank. Its DMA channel then never has to wait for the bus behind
+// another pseudoclock's, at the cost of a smaller table when fewer than 4 pseudoclocks are used.
+// The tables fill the bottom 56kB of SRAM0-3, leaving the top 8kB of each for everything else.
+const unsigned int max_instructions = 7167;
+// max_instructions*2 + 2
+#define BANK_TABLE(bank) __attribute__((section(".sram" #bank ".instructions")))
+uint32_t instructions_bank0[14336] BANK_TABLE(0);
+uint32_t instructions_bank1[14336] BANK_TABLE(1);
+uint32_t instructions_bank2[14336] BANK_TABLE(2);
+uint32_t instructions_bank3[14336] BANK_TABLE(3);
+uint32_t *const instruction_banks[4] = {instructions_bank0, instructions_bank1, instructions_bank2, instructions_bank3};
+#else
+// Pseudoclocks 0-3 run on pio_to_use, 4 and 5 on the other PIO block (unless their trigger
+// modes need different programs, see assign_pseudoclock_sms). There are no more as each one
+// takes two of the 12 DMA channels.
+#define MAX_PSEUDOCLOCKS 6
 // Can't seem to have this be used to define array size even though it's a constant
 const unsigned int max_instructions = 30000;
-const unsigned int max_waits = 400;
-// max_instructions*2 + 8
-unsigned int instructions[60008];
-// max_waits + 4
-unsigned int waits[404];
+// max_instructions*2 + 2*MAX_PSEUDOCLOCKS
+uint32_t instructions[60012];
+#endif //PRAWNBLASTER_BANKED_SRAM
+// max_waits + MAX_PSEUDOCLOCKS
+unsigned int waits[406];
 
 #define SERIAL_BUFFER_SIZE 256
 char readstring[SERIAL_BUFFER_SIZE] = "";
-// This contains the number of clock cycles for a half period, which is currently 5 (there are 5 ASM instructions)
-const unsigned int non_loop_path_length = 5;
 
-uint OUT_PINS[4];
-uint IN_PINS[4];
+uint OUT_PINS[MAX_PSEUDOCLOCKS];
+uint IN_PINS[MAX_PSEUDOCLOCKS];
 const uint INVALID_PIN_NUMBER = 100;
 
+// Clock dividers (see "setclkdiv"), in 1/256ths of a clock cycle. Each pseudoclock's state
+// machine runs at clk_sys divided by its divider, so its instructions are stored in cycles
+// of that slower clock. They are converted on the way in and out, so that set/setb/get and
+// the wait lengths are always in clk_sys cycles.
+uint32_t clock_dividers[MAX_PSEUDOCLOCKS];
+
+// Trigger modes (see "settrigger"). The edge modes run the pseudoclock_edge program, and
+// the active low modes invert the trigger pin with its GPIO input override.
+#define TRIGGER_HIGH 0
+#define TRIGGER_LOW 1
+#define TRIGGER_RISING 2
+#define TRIGGER_FALLING 3
+int trigger_modes[MAX_PSEUDOCLOCKS];
+// Outputs inverted with their GPIO output override, so that they idle high (see "setpolarity")
+bool outputs_inverted[MAX_PSEUDOCLOCKS];
+
 int num_pseudoclocks_in_use;
 PIO pio_to_use;
-
-// Mutex for status
-static mutex_t status_mutex;
-static mutex_t wait_mutex;
+// Where each pseudoclock runs for the current queue of shots (see assign_pseudoclock_sms)
+PIO pseudoclock_pios[MAX_PSEUDOCLOCKS];
+uint pseudoclock_sms[MAX_PSEUDOCLOCKS];
+// The pseudoclock program each PIO block runs (NULL if none), and where core1 loaded it
+// (while a queue of shots is running)
+const pio_program_t *pseudoclock_programs[2];
+uint pseudoclock_program_offsets[2];
 
 // SIO GPIO init status
 int gpio_inited = 0;
 
 // STATUS flag
-int status;
+// Read by both cores without locking (aligned 32 bit loads and stores are atomic).
+// Changes go through set_status/status_compare_and_set, which serialise on status_lock.
+volatile int status;
+spin_lock_t *status_lock;
 #define STOPPED 0
 #define TRANSITION_TO_RUNNING 1
 #define RUNNING 2
@@ -87,10 +134,203 @@ int clock_status;
 #define EXTERNAL 1
 
 // number of waits storage
-int num_waits_processed[4];
+// Written by core1 only. Readers retry until they see the same even value of
+// num_waits_sequence before and after copying (it is odd during an update).
+volatile int num_waits_processed[MAX_PSEUDOCLOCKS];
+volatile unsigned int num_waits_shot;
+volatile uint32_t num_waits_sequence;
+
+// Shot queue (see "hwstart")
+// Shots to run for the last start command, and how many of them have finished
+unsigned int shots_queued = 1;
+volatile unsigned int shots_completed;
+// Each shot's waits are stored after the previous shot's (shot_wait_stride words each),
+// wrapping around once the pseudoclock's part of waits[] is full. This keeps the
+// waits of the last shots_stored shots.
+unsigned int shot_wait_stride[MAX_PSEUDOCLOCKS];
+unsigned int shots_stored[MAX_PSEUDOCLOCKS];
+
+// Event mode (see "events"): status changes and completed waits are queued here by
+// whichever core causes them, and written to the serial port by core0 while it is idle
+struct event_record
+{
+    uint32_t time_us;
+    uint32_t shot;
+    uint8_t type;
+    uint8_t pseudoclock;
+    uint16_t value; // status, or wait index
+};
+#define EVENT_STATUS 0
+#define EVENT_WAIT 1
+#define EVENT_SHOT 2
+#define EVENT_QUEUE_LENGTH 32
+event_record event_queue[EVENT_QUEUE_LENGTH];
+// Written under event_lock by producers, read by core0 only
+volatile uint32_t event_queue_head;
+volatile uint32_t event_queue_tail;
+volatile uint32_t events_lost;
+volatile int events_enabled;
+spin_lock_t *event_lock;
+
+// Debug trace (see "trace dump"): with debug on, each core records what it is doing in its
+// own ring, and core0 formats the records when asked. Recording never touches the serial
+// port, so it does not disturb the timing of core1. Each ring has a single producer (its
+// core, outside interrupt handlers) and a single consumer (core0), so no lock is needed.
+enum trace_id
+{
+    TRACE_TOO_MANY_INSTRUCTIONS,
+    TRACE_TOO_MANY_WAITS,
+    TRACE_NO_INSTRUCTIONS,
+    TRACE_WILL_SEND,
+    TRACE_DRAINING_INSTRUCTIONS,
+    TRACE_DRAINING_WAITS,
+    TRACE_PROGRAM_ABORTED,
+    TRACE_DRAINING_TX,
+    TRACE_TIMESTAMPS_NOT_RUNNING,
+    TRACE_TIMESTAMPS_NO_ROOM,
+    TRACE_CONFIGURE_FAILED,
+    TRACE_SHOT_STARTED,
+    TRACE_WAITING,
+    TRACE_ABORTING,
+    TRACE_COMPLETE,
+    TRACE_LOOP_ENDED,
+    TRACE_ABORT_REQUESTED,
+    TRACE_ID_COUNT
+};
+const char *const trace_messages[TRACE_ID_COUNT] = {
+    "Too many instructions to send to pseudoclock %d (%d > %d)",
+    "Too many waits to send to pseudoclock %d (%d > %d)",
+    "Pseudoclock %d has no instructions. It will not run this time.",
+    "Will send %d instructions containing %d waits to pseudoclock %d",
+    "Draining instruction FIFO of pseudoclock %d",
+    "Draining wait FIFO of pseudoclock %d",
+    "Pseudoclock %d program aborted",
+    "Draining TX FIFO of pseudoclock %d",
+    "Pseudoclock %d is not running, so triggers will not be timestamped",
+    "No room for the timestamp program, so triggers will not be timestamped",
+    "Failed to configure pseudoclock %d. Aborting.",
+    "Shot %d started",
+    "Waiting for pseudoclocks to finish",
+    "Aborting pseudoclock program",
+    "Pseudoclock program complete",
+    "Core1 loop ended",
+    "Abort requested",
+};
+struct trace_record
+{
+    uint32_t time_us;
+    uint32_t cycles; // SysTick of the recording core (see cycle_counter.h)
+    uint32_t id;
+    int32_t args[3];
+};
+#define TRACE_LENGTH 64
+struct trace_ring
+{
+    trace_record records[TRACE_LENGTH];
+    // head and lost are written by the recording core, tail and lost_reported by core0
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t lost;
+    uint32_t lost_reported;
+};
+trace_ring trace_rings[2];
+
+// Core1 sleeps during a shot and is woken by these interrupts (see core1_entry)
+// DMA channels (bit mask) transferring wait lengths, which complete once the stop instruction has run
+volatile uint32_t waits_dma_irq_mask;
+// PIO interrupt sources for "a wait length has been pushed" (RX FIFO not empty)
+#define WAIT_PUSHED_IRQ_SOURCES (0xfu << pis_sm0_rx_fifo_not_empty)
+// Core1 cycle counter when the last waits DMA transfer finished, and whether one has
+// finished since the current shot was armed (the counter is stale otherwise)
+volatile uint32_t sequence_end_cycles;
+volatile bool sequence_ended;
+// Clock cycles from the end of a shot to STOPPED (last shot and worst since boot)
+volatile uint32_t last_stop_latency;
+volatile uint32_t worst_stop_latency;
+// Clock cycles from receiving "abort" to every pseudoclock being stopped (last abort and worst since boot)
+uint32_t last_abort_latency;
+uint32_t worst_abort_latency;
+
+// Telemetry (see "gettelemetry"), in clock cycles
+// The code these time runs from SRAM (__not_in_flash_func), so that it never waits
+// on an XIP cache miss (or for the other core to finish with the cache).
+// Core1: times it was woken during the last shot, and the longest it spent handling a wake up
+volatile uint32_t core1_wakeups;
+volatile uint32_t core1_worst_wakeup_cycles;
+// Core1: time to configure the state machines and DMA for the last shot
+volatile uint32_t core1_arm_cycles;
+// Core0: the last "setb", and the time spent decoding the payload (excluding reading it)
+uint32_t setb_instructions;
+uint32_t setb_decode_cycles;
+uint32_t setb_total_cycles;
+
+// Performance counters (see "stats"), in clock cycles since boot or the last "stats reset".
+// Each is only recorded by one core.
+enum stat_id
+{
+    STAT_COMMAND,     // core0: handling a command, from reading its line to replying (including any payload), in microseconds
+    STAT_SETB_DECODE, // core0: decoding the payload of a "setb" (excluding reading it)
+    STAT_CONFIGURE,   // core1: configure_pseudoclock_pio_sm, per pseudoclock
+    STAT_START,       // core1: from receiving "start" (or re-arming, for later shots of a queue) to enabling the state machines
+    STAT_START_SKEW,  // core1: between enabling the state machines of the two PIO blocks (at most), with more than 4 pseudoclocks
+    STAT_WAKEUP,      // core1: handling a wake up during a shot
+    STAT_STOP,        // core1: from the end of a shot to STOPPED
+    STAT_ABORT,       // core0: from receiving "abort" to every pseudoclock being stopped
+    STAT_ID_COUNT
+};
+const char *const stat_names[STAT_ID_COUNT] = {"command", "setb-decode", "configure", "start", "start-skew", "wakeup", "stop", "abort"};
+cycle_stat stats[STAT_ID_COUNT];
+// Core0 time when the current command was read. Commands with a payload can take longer
+// than the cycle counter wraps (2^24 cycles), so they are timed with the microsecond timer.
+uint32_t command_start_us;
+
+// Trigger timestamps (see "timestamps" and timestamp.pio)
+// Two state machines in the PIO block the pseudoclocks are not using each push a count
+// for every rising edge of the trigger input, which DMA copies into their half of timestamp_counts
+#define MAX_TIMESTAMPS 400
+uint32_t timestamp_counts[2][MAX_TIMESTAMPS];
+// Pseudoclock whose trigger input is timestamped (-1 for none)
+int timestamp_pseudoclock = -1;
+// Timestamp the rising edges of the pseudoclock's own output instead (see "capture")
+bool timestamp_output = false;
+// DMA channels while timestamps are being captured (-1 otherwise), and the
+// number of timestamps captured once they are not
+volatile int timestamp_dma_channels[2] = {-1, -1};
+volatile uint32_t timestamps_captured[2];
+
+// Coalesced uploads (see "setcoalesce")
+// Consecutive identical instructions are merged into a single slot of the table
+// by adding up their reps. Only slots holding more than one instruction are recorded,
+// which is enough to map the addresses used by set/setb/get onto slots.
+#define MAX_COALESCED_SLOTS 256
+struct coalesced_slot
+{
+    uint16_t slot;
+    uint16_t count;
+    uint8_t pseudoclock;
+};
+coalesced_slot coalesced_slots[MAX_COALESCED_SLOTS];
+int num_coalesced_slots;
+
+struct coalesce_state
+{
+    bool enabled;
+    // Address (as sent to set/setb) of the next instruction
+    uint32_t next_addr;
+    // Next free slot in the table
+    uint32_t next_slot;
+    // Entry in coalesced_slots for the last slot, or -1 if it holds a single instruction
+    int open_entry;
+    uint32_t last_half_period;
+    uint32_t last_reps;
+};
+coalesce_state coalesce[MAX_PSEUDOCLOCKS];
+#define COALESCE_NOT_SEQUENTIAL -1
+#define COALESCE_NO_FREE_SLOTS -2
 
 struct pseudoclock_config
 {
+    int pseudoclock;
     PIO pio;
     uint sm;
     uint OUT_PIN;
@@ -102,110 +342,335 @@ struct pseudoclock_config
     bool configured;
 };
 
+struct timestamp_config
+{
+    PIO pio;
+    uint offset;
+    bool configured;
+};
+
+// TX FIFO underruns (see "health"). The pseudoclock program only pulls with data in flight
+// (the end of the table is a stop, which doesn't pull again), so a state machine stalled on
+// an empty TX FIFO means DMA fell behind and every later edge is late. The FDEBUG TXSTALL
+// flags are sticky, so core1 checks them whenever it wakes up during a shot (for a wait or
+// the waits DMA completing) and once more at the end of the shot, rather than waking up to
+// poll them.
+struct pseudoclock_health
+{
+    // Checks in the current (or last) shot that found a stall since the previous check
+    uint32_t stalls;
+    // Instruction the state machine was waiting for at the first of them (or -1)
+    int first_instruction;
+    // Shots of the current (or last) queue with at least one stall
+    uint32_t shots;
+};
+volatile pseudoclock_health health[MAX_PSEUDOCLOCKS];
+
+// Queue an event (either core, does nothing unless event mode is on)
+void __not_in_flash_func(queue_event)(uint8_t type, uint8_t pseudoclock, uint16_t value, uint32_t shot)
+{
+    if (!events_enabled)
+    {
+        return;
+    }
+    uint32_t saved_irq = spin_lock_blocking(event_lock);
+    if (event_queue_head - event_queue_tail < EVENT_QUEUE_LENGTH)
+    {
+        event_record *event = &event_queue[event_queue_head % EVENT_QUEUE_LENGTH];
+        event->time_us = time_us_32();
+        event->type = type;
+        event->pseudoclock = pseudoclock;
+        event->value = value;
+        event->shot = shot;
+        __dmb();
+        event_queue_head++;
+    }
+    else
+    {
+        events_lost++;
+    }
+    spin_unlock(event_lock, saved_irq);
+}
+
+// Record a trace (either core, but not from an interrupt handler; does nothing unless debug is on)
+void __not_in_flash_func(trace)(trace_id id, int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0)
+{
+    if (!DEBUG)
+    {
+        return;
+    }
+    trace_ring *ring = &trace_rings[get_core_num()];
+    if (ring->head - ring->tail >= TRACE_LENGTH)
+    {
+        ring->lost++;
+        return;
+    }
+    trace_record *record = &ring->records[ring->head % TRACE_LENGTH];
+    record->time_us = time_us_32();
+    record->cycles = cycle_counter_read();
+    record->id = id;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+    __dmb();
+    ring->head++;
+}
+
 // Thread safe functions for getting/setting status
-int get_status()
+int __not_in_flash_func(get_status)()
 {
-    mutex_enter_blocking(&status_mutex);
     int status_copy = status;
-    mutex_exit(&status_mutex);
+    __dmb();
     return status_copy;
 }
 
-void set_status(int new_status)
+// Change the status only if it is still the expected one. Returns whether it was changed.
+// The M0+ has no exclusive load/store instructions, so a hardware spinlock makes the
+// compare and the store atomic (it is held for a handful of cycles).
+bool __not_in_flash_func(status_compare_and_set)(int expected, int new_status)
+{
+    uint32_t saved_irq = spin_lock_blocking(status_lock);
+    bool changed = status == expected;
+    if (changed)
+    {
+        status = new_status;
+        queue_event(EVENT_STATUS, 0, new_status, 0);
+    }
+    spin_unlock(status_lock, saved_irq);
+    if (changed)
+    {
+        // wake core1 in case it is sleeping through a shot
+        __sev();
+    }
+    return changed;
+}
+
+void __not_in_flash_func(set_status)(int new_status)
 {
-    mutex_enter_blocking(&status_mutex);
+    uint32_t saved_irq = spin_lock_blocking(status_lock);
     status = new_status;
-    mutex_exit(&status_mutex);
+    queue_event(EVENT_STATUS, 0, new_status, 0);
+    spin_unlock(status_lock, saved_irq);
+    __sev();
 }
 
-bool configure_pseudoclock_pio_sm(pseudoclock_config *config, uint prog_offset, uint32_t hwstart, int max_instructions_per_pseudoclock, int max_waits_per_pseudoclock)
+// Publish new processed wait counts for a shot (core1 only, or core0 while no shot is running)
+void __not_in_flash_func(set_num_processed_waits)(unsigned int shot, const int *counts)
 {
-    // Zero out waits array
-    int max_waits = (max_waits_per_pseudoclock + 1);
-    for (int i = config->sm * max_waits; i < (config->sm + 1) * max_waits; i++)
+    num_waits_sequence++;
+    __dmb();
+    num_waits_shot = shot;
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
     {
-        waits[i] = 0;
+        num_waits_processed[i] = counts[i];
     }
+    __dmb();
+    num_waits_sequence++;
+}
 
-    // Find the number of 32 bit words to send
-    int words_to_send = 0;
-    int wait_count = 1; // We always send a stop message
-    bool previous_instruction_was_wait = false;
-    int max_words = (max_instructions_per_pseudoclock * 2 + 2);
-    for (int i = config->sm * max_words; i < ((config->sm + 1) * max_words); i += 2)
+// Interrupt handlers (run on core1)
+void __isr __not_in_flash_func(waits_dma_irq_handler)()
+{
+    sequence_end_cycles = cycle_counter_read();
+    sequence_ended = true;
+    for (int i = 0; i < NUM_DMA_CHANNELS; i++)
     {
-        if (instructions[i] == 0 && instructions[i + 1] == 0)
+        if ((waits_dma_irq_mask & (1u << i)) && dma_channel_get_irq1_status(i))
         {
-            words_to_send = i + 2 - config->sm * max_words;
-            break;
+            dma_channel_acknowledge_irq1(i);
         }
-        else if (instructions[i] == 0)
+    }
+    __sev();
+}
+
+void __isr __not_in_flash_func(wait_pushed_irq_handler)()
+{
+    // The FIFO is drained by DMA straight away, so this fires once and core1 re-arms it
+    // after catching up on the processed waits
+    pio_set_irq0_source_mask_enabled(pio0, WAIT_PUSHED_IRQ_SOURCES, false);
+    pio_set_irq0_source_mask_enabled(pio1, WAIT_PUSHED_IRQ_SOURCES, false);
+    __sev();
+}
+
+// Number of instructions (excluding the final stop) each pseudoclock's table holds
+unsigned int instructions_per_pseudoclock()
+{
+#ifdef PRAWNBLASTER_BANKED_SRAM
+    return max_instructions;
+#else
+    return max_instructions / num_pseudoclocks_in_use;
+#endif //PRAWNBLASTER_BANKED_SRAM
+}
+
+// Start of a pseudoclock's table (instructions_per_pseudoclock() * 2 + 2 words)
+uint32_t *__not_in_flash_func(instruction_table)(int pseudoclock)
+{
+#ifdef PRAWNBLASTER_BANKED_SRAM
+    return instruction_banks[pseudoclock];
+#else
+    return &instructions[pseudoclock * (instructions_per_pseudoclock() * 2 + 2)];
+#endif //PRAWNBLASTER_BANKED_SRAM
+}
+
+// The PIO block that is not pio_to_use
+PIO __not_in_flash_func(other_pio)()
+{
+    return pio_to_use == pio0 ? pio1 : pio0;
+}
+
+// PIO block and state machine of a pseudoclock
+PIO __not_in_flash_func(pseudoclock_pio)(int pseudoclock)
+{
+    return pseudoclock_pios[pseudoclock];
+}
+
+uint __not_in_flash_func(pseudoclock_sm)(int pseudoclock)
+{
+    return pseudoclock_sms[pseudoclock];
+}
+
+const pio_program_t *trigger_program(int pseudoclock)
+{
+    return trigger_modes[pseudoclock] == TRIGGER_RISING || trigger_modes[pseudoclock] == TRIGGER_FALLING ? &pseudoclock_edge_program : &pseudoclock_program;
+}
+
+// Give each pseudoclock a PIO block and state machine for the next queue of shots (core0,
+// while stopped). Either program fills a whole PIO block, so the pseudoclocks fill
+// pio_to_use and then the other block, but only share a block with others using the same
+// program. Returns false if they don't fit (more than 4 need the same block).
+bool assign_pseudoclock_sms()
+{
+    PIO blocks[2] = {pio_to_use, other_pio()};
+    uint sms_used[2] = {0, 0};
+    pseudoclock_programs[0] = NULL;
+    pseudoclock_programs[1] = NULL;
+    for (int i = 0; i < num_pseudoclocks_in_use; i++)
+    {
+        const pio_program_t *program = trigger_program(i);
+        int b = 0;
+        while (b < 2 && (sms_used[b] == NUM_PIO_STATE_MACHINES || (sms_used[b] > 0 && pseudoclock_programs[pio_get_index(blocks[b])] != program)))
         {
-            // Only count the first wait in a set of sequential waits
-            if (!previous_instruction_was_wait)
-            {
-                wait_count += 1;
-            }
-            previous_instruction_was_wait = true;
+            b++;
         }
-        else
+        if (b == 2)
         {
-            previous_instruction_was_wait = false;
+            return false;
         }
+        pseudoclock_programs[pio_get_index(blocks[b])] = program;
+        pseudoclock_pios[i] = blocks[b];
+        pseudoclock_sms[i] = sms_used[b]++;
+    }
+    return true;
+}
+
+// Offset of the "end" label of the pseudoclock program in a PIO block (relative to where it was loaded)
+uint __not_in_flash_func(pseudoclock_end_offset)(PIO pio)
+{
+    return pseudoclock_programs[pio_get_index(pio)] == &pseudoclock_edge_program ? pseudoclock_edge_offset_end : pseudoclock_offset_end;
+}
+
+// Convert cycles of a pseudoclock's state machine into clk_sys cycles (instructions are
+// converted the other way with pseudoclock_divide_half_period)
+uint64_t to_system_cycles(int pseudoclock, uint32_t cycles)
+{
+    return pseudoclock_multiply_cycles(cycles, clock_dividers[pseudoclock]);
+}
+
+void clear_instructions()
+{
+#ifdef PRAWNBLASTER_BANKED_SRAM
+    // The banks are not part of .bss, so this is also their only initialisation
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+    {
+        memset(instruction_banks[i], 0, sizeof(instructions_bank0));
     }
+#else
+    memset(instructions, 0, sizeof(instructions));
+#endif //PRAWNBLASTER_BANKED_SRAM
+}
+
+// Set the inverters of a pseudoclock's pins (see "settrigger" and "setpolarity"). Setting the
+// function of a pin (gpio_init, pio_gpio_init) clears them, so this has to follow each of those.
+void set_gpio_overrides(int pseudoclock, uint out_pin, uint in_pin)
+{
+    // The input of an inverted output is inverted back, so that the timestamps (which read
+    // the output) still see the pseudoclock's own rising edges
+    enum gpio_override output_override = outputs_inverted[pseudoclock] ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL;
+    gpio_set_outover(out_pin, output_override);
+    gpio_set_inover(out_pin, output_override);
+    bool trigger_inverted = trigger_modes[pseudoclock] == TRIGGER_LOW || trigger_modes[pseudoclock] == TRIGGER_FALLING;
+    gpio_set_inover(in_pin, trigger_inverted ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+}
+
+bool configure_pseudoclock_pio_sm(pseudoclock_config *config, uint prog_offset, uint32_t hwstart, int max_instructions_per_pseudoclock, int max_waits_per_pseudoclock, unsigned int shot)
+{
+    int max_waits = (max_waits_per_pseudoclock + 1);
+
+    // Find the number of 32 bit words to send
+    int wait_count;
+    int max_words = (max_instructions_per_pseudoclock * 2 + 2);
+    int words_to_send = pseudoclock_scan(instruction_table(config->pseudoclock), max_words, &wait_count);
 
     // Check we don't have too many instructions to send
     if (words_to_send > max_words)
     {
-        if (DEBUG)
-        {
-            // Divide by 2 to put it back in terms of "half_period reps" instructions
-            // Subtract off two to remove the stop instruction from the count
-            fast_serial_printf("Too many instructions to send to pseudoclock %d (%d > %d)\r\n", config->sm, (words_to_send - 2) / 2, max_words / 2);
-        }
+        // Divide by 2 to put it back in terms of "half_period reps" instructions
+        // Subtract off two to remove the stop instruction from the count
+        trace(TRACE_TOO_MANY_INSTRUCTIONS, config->pseudoclock, (words_to_send - 2) / 2, max_words / 2);
         return false;
     }
 
     // Check we don't have too many waits to send
     if (wait_count > max_waits)
     {
-        if (DEBUG)
-        {
-            // subtract off one to remove the stop instruction from the wait count
-            fast_serial_printf("Too many waits to send to pseudoclock %d (%d > %d)\r\n", config->sm, wait_count - 1, max_waits_per_pseudoclock);
-        }
+        // subtract off one to remove the stop instruction from the wait count
+        trace(TRACE_TOO_MANY_WAITS, config->pseudoclock, wait_count - 1, max_waits_per_pseudoclock);
         return false;
     }
 
+    // The layout only depends on the table, which can't change during a queue. It is set
+    // when the first shot is armed and left alone after that, as core0 reads it at any time.
+    unsigned int stored = max_waits / wait_count;
+    if (shot == 0)
+    {
+        shot_wait_stride[config->pseudoclock] = wait_count;
+        shots_stored[config->pseudoclock] = stored;
+    }
+
+    // Zero out this shot's part of the waits array
+    unsigned int *shot_waits = &waits[config->pseudoclock * max_waits + (shot % stored) * wait_count];
+    for (int i = 0; i < wait_count; i++)
+    {
+        shot_waits[i] = 0;
+    }
+
     if (words_to_send == 2)
     {
         // Just a stop instruction (aka empty set of instructions)
         // so don't run this pseudoclock
         config->configured = false;
 
-        if (DEBUG)
-        {
-            fast_serial_printf("Pseudoclock %d has no instructions. It will not run this time.\r\n", config->sm);
-        }
+        trace(TRACE_NO_INSTRUCTIONS, config->pseudoclock);
 
         return true;
     }
 
-    if (DEBUG)
-    {
-        // word count:
-        //      Divide by 2 to put it back in terms of "half_period reps" instructions
-        //      Subtract off two to remove the stop instruction from the count
-        // wait count:
-        //      subtract off one to remove the stop instruction from the wait count
-        fast_serial_printf("Will send %d instructions containing %d waits to pseudoclock %d\r\n", (words_to_send - 2) / 2, wait_count - 1, config->sm);
-    }
+    // word count:
+    //      Divide by 2 to put it back in terms of "half_period reps" instructions
+    //      Subtract off two to remove the stop instruction from the count
+    // wait count:
+    //      subtract off one to remove the stop instruction from the wait count
+    trace(TRACE_WILL_SEND, (words_to_send - 2) / 2, wait_count - 1, config->pseudoclock);
 
     // Claim the POI
     pio_claim_sm_mask(config->pio, 1u << config->sm);
 
     // Configure PIO Statemachine
-    pio_pseudoclock_init(config->pio, config->sm, prog_offset, config->OUT_PIN, config->IN_PIN);
+    uint32_t divider = clock_dividers[config->pseudoclock];
+    bool edge_triggered = pseudoclock_programs[pio_get_index(config->pio)] == &pseudoclock_edge_program;
+    pio_pseudoclock_init(config->pio, config->sm, prog_offset, edge_triggered, config->OUT_PIN, config->IN_PIN, divider / PSEUDOCLOCK_CLOCK_DIVIDER_ONE, divider % PSEUDOCLOCK_CLOCK_DIVIDER_ONE);
+    // (pio_gpio_init has just cleared the inverters of both pins)
+    set_gpio_overrides(config->pseudoclock, config->OUT_PIN, config->IN_PIN);
 
     // Update configuration with words/waits to send
     config->words_to_send = words_to_send;
@@ -222,57 +687,14 @@ bool configure_pseudoclock_pio_sm(pseudoclock_config *config, uint prog_offset,
     config->instructions_dma_channel = dma_claim_unused_channel(true);
     dma_channel_config instruction_c = dma_channel_get_default_config(config->instructions_dma_channel);
 
-    // Set transfer request signal. Technically after this, dreq==sm will be true (for PIO0)
-    // but we'll do this just incase the constants change. This sets the signal to be when
-    // there is space in the PIO FIFO
-    int instruction_dreq = 0;
-    if (pio_to_use == pio0)
-    {
-        switch (config->sm)
-        {
-        case 0:
-            instruction_dreq = DREQ_PIO0_TX0;
-            break;
-        case 1:
-            instruction_dreq = DREQ_PIO0_TX1;
-            break;
-        case 2:
-            instruction_dreq = DREQ_PIO0_TX2;
-            break;
-        case 3:
-            instruction_dreq = DREQ_PIO0_TX3;
-            break;
-        default:
-            break;
-        }
-    }
-    else
-    {
-        switch (config->sm)
-        {
-        case 0:
-            instruction_dreq = DREQ_PIO1_TX0;
-            break;
-        case 1:
-            instruction_dreq = DREQ_PIO1_TX1;
-            break;
-        case 2:
-            instruction_dreq = DREQ_PIO1_TX2;
-            break;
-        case 3:
-            instruction_dreq = DREQ_PIO1_TX3;
-            break;
-        default:
-            break;
-        }
-    }
-    channel_config_set_dreq(&instruction_c, instruction_dreq);
+    // Set transfer request signal. This sets the signal to be when there is space in the PIO FIFO
+    channel_config_set_dreq(&instruction_c, pio_get_dreq(config->pio, config->sm, true));
 
     dma_channel_configure(
         config->instructions_dma_channel,      // The DMA channel
         &instruction_c,                        // DMA channel config
         &config->pio->txf[config->sm],         // Write address to the PIO TX FIFO
-        &instructions[config->sm * max_words], // Read address to the instruction array
+        instruction_table(config->pseudoclock),// Read address to the instruction array
         words_to_send,                         // How many values to transfer
         true                                   // Start immediately
     );
@@ -281,60 +703,21 @@ bool configure_pseudoclock_pio_sm(pseudoclock_config *config, uint prog_offset,
     config->waits_dma_channel = dma_claim_unused_channel(true);
     dma_channel_config waits_c = dma_channel_get_default_config(config->waits_dma_channel);
 
-    // Set transfer request signal. Technically after this, dreq==sm will be true (for PIO0)
-    // but we'll do this just incase the constants change. This sets the signal to be when
-    // there is space in the PIO FIFO
-    int waits_dreq = 0;
-    if (pio_to_use == pio0)
-    {
-        switch (config->sm)
-        {
-        case 0:
-            waits_dreq = DREQ_PIO0_RX0;
-            break;
-        case 1:
-            waits_dreq = DREQ_PIO0_RX1;
-            break;
-        case 2:
-            waits_dreq = DREQ_PIO0_RX2;
-            break;
-        case 3:
-            waits_dreq = DREQ_PIO0_RX3;
-            break;
-        default:
-            break;
-        }
-    }
-    else
-    {
-        switch (config->sm)
-        {
-        case 0:
-            waits_dreq = DREQ_PIO1_RX0;
-            break;
-        case 1:
-            waits_dreq = DREQ_PIO1_RX1;
-            break;
-        case 2:
-            waits_dreq = DREQ_PIO1_RX2;
-            break;
-        case 3:
-            waits_dreq = DREQ_PIO1_RX3;
-            break;
-        default:
-            break;
-        }
-    }
-    channel_config_set_dreq(&waits_c, waits_dreq);
+    // Set transfer request signal. This sets the signal to be when there is data in the PIO FIFO
+    channel_config_set_dreq(&waits_c, pio_get_dreq(config->pio, config->sm, false));
 
     // change the default to increment write address and leave read constant
     channel_config_set_read_increment(&waits_c, false);
     channel_config_set_write_increment(&waits_c, true);
 
+    // Interrupt core1 when the last wait (the stop instruction) has been transferred
+    waits_dma_irq_mask |= 1u << config->waits_dma_channel;
+    dma_channel_set_irq1_enabled(config->waits_dma_channel, true);
+
     dma_channel_configure(
         config->waits_dma_channel,      // The DMA channel
         &waits_c,                       // DMA channel config
-        &waits[config->sm * max_waits], // write address to the waits array
+        shot_waits,                     // write address to the waits array
         &config->pio->rxf[config->sm],  // Read address from the PIO RX FIFO
         wait_count,                     // How many values to transfer
         true                            // Start immediately
@@ -347,6 +730,9 @@ bool configure_pseudoclock_pio_sm(pseudoclock_config *config, uint prog_offset,
 
 void free_pseudoclock_pio_sm(pseudoclock_config *config)
 {
+    // Disable the interrupt before a possible abort (which may raise it)
+    dma_channel_set_irq1_enabled(config->waits_dma_channel, false);
+    pio_set_irq0_source_enabled(config->pio, (enum pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + config->sm), false);
 
     if (get_status() == ABORTING)
     {
@@ -355,41 +741,158 @@ void free_pseudoclock_pio_sm(pseudoclock_config *config)
         dma_channel_abort(config->waits_dma_channel);
 
         // Drain the FIFOs
-        if (DEBUG)
-        {
-            fast_serial_printf("Draining instruction FIFO\r\n");
-        }
+        trace(TRACE_DRAINING_INSTRUCTIONS, config->pseudoclock);
         pio_sm_drain_tx_fifo(config->pio, config->sm);
-        if (DEBUG)
-        {
-            fast_serial_printf("Draining wait FIFO\r\n");
-        }
+        trace(TRACE_DRAINING_WAITS, config->pseudoclock);
         // drain rx fifo
         while (pio_sm_get_rx_fifo_level(config->pio, config->sm) > 0)
         {
             pio_sm_get(config->pio, config->sm);
         }
-        if (DEBUG)
-        {
-            fast_serial_printf("Pseudoclock program aborted\r\n");
-        }
+        trace(TRACE_PROGRAM_ABORTED, config->pseudoclock);
     }
 
     // Free the DMA channels
+    dma_channel_acknowledge_irq1(config->waits_dma_channel);
+    waits_dma_irq_mask &= ~(1u << config->waits_dma_channel);
     dma_channel_unclaim(config->instructions_dma_channel);
     dma_channel_unclaim(config->waits_dma_channel);
 
-    if (DEBUG)
-    {
-        fast_serial_printf("Draining TX FIFO\r\n");
-    }
+    trace(TRACE_DRAINING_TX, config->pseudoclock);
     // drain the tx FIFO to be safe
     pio_sm_drain_tx_fifo(config->pio, config->sm);
 
-    // release the state machine
+    // Stop the state machine (which is otherwise still looping at "end") before its program
+    // is removed, and release it
+    pio_sm_set_enabled(config->pio, config->sm, false);
     pio_sm_unclaim(config->pio, config->sm);
 }
 
+void configure_timestamp_sms(timestamp_config *config, pseudoclock_config *pseudoclock_configs)
+{
+    config->configured = false;
+    timestamps_captured[0] = 0;
+    timestamps_captured[1] = 0;
+    if (timestamp_pseudoclock < 0 || timestamp_pseudoclock >= num_pseudoclocks_in_use)
+    {
+        return;
+    }
+
+    // The first rising edge of the pseudoclock output is the reference for the timestamps
+    pseudoclock_config *pseudoclock = &pseudoclock_configs[timestamp_pseudoclock];
+    if (!pseudoclock->configured)
+    {
+        trace(TRACE_TIMESTAMPS_NOT_RUNNING, timestamp_pseudoclock);
+        return;
+    }
+
+    // Use the PIO block the pseudoclocks are not using (if there is one)
+    config->pio = other_pio();
+    if (pseudoclock_programs[pio_get_index(config->pio)] != NULL || !pio_can_add_program(config->pio, &timestamp_program))
+    {
+        trace(TRACE_TIMESTAMPS_NO_ROOM);
+        return;
+    }
+    config->offset = pio_add_program(config->pio, &timestamp_program);
+    pio_claim_sm_mask(config->pio, 0x3);
+
+    // SM 0 samples the trigger on even cycles, SM 1 on odd cycles
+    const uint entries[2] = {timestamp_offset_even, timestamp_offset_odd};
+    for (int i = 0; i < 2; i++)
+    {
+        pio_timestamp_init(config->pio, i, config->offset, entries[i], pseudoclock->OUT_PIN, timestamp_output ? pseudoclock->OUT_PIN : pseudoclock->IN_PIN);
+
+        int channel = dma_claim_unused_channel(true);
+        dma_channel_config c = dma_channel_get_default_config(channel);
+        channel_config_set_dreq(&c, pio_get_dreq(config->pio, i, false));
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        dma_channel_configure(
+            channel,                  // The DMA channel
+            &c,                       // DMA channel config
+            timestamp_counts[i],      // write address to the timestamps array
+            &config->pio->rxf[i],     // Read address from the PIO RX FIFO
+            MAX_TIMESTAMPS,           // How many values to transfer
+            true                      // Start immediately
+        );
+        timestamp_dma_channels[i] = channel;
+    }
+
+    // They wait for the reference edge, so start them before the pseudoclocks
+    pio_enable_sm_mask_in_sync(config->pio, 0x3);
+    config->configured = true;
+}
+
+void free_timestamp_sms(timestamp_config *config)
+{
+    if (!config->configured)
+    {
+        return;
+    }
+
+    pio_set_sm_mask_enabled(config->pio, 0x3, false);
+    for (int i = 0; i < 2; i++)
+    {
+        int channel = timestamp_dma_channels[i];
+        // Let the DMA catch up with the last timestamps
+        while (pio_sm_get_rx_fifo_level(config->pio, i) > 0 && dma_channel_is_busy(channel))
+        {
+            tight_loop_contents();
+        }
+        dma_channel_abort(channel);
+        timestamps_captured[i] = MAX_TIMESTAMPS - dma_channel_hw_addr(channel)->transfer_count;
+        __dmb();
+        timestamp_dma_channels[i] = -1;
+        dma_channel_unclaim(channel);
+        pio_sm_clear_fifos(config->pio, i);
+        pio_sm_unclaim(config->pio, i);
+    }
+    pio_remove_program(config->pio, &timestamp_program, config->offset);
+    config->configured = false;
+}
+
+// Number of trigger edges timestamped so far (either core)
+uint32_t get_num_timestamps()
+{
+    uint32_t num = MAX_TIMESTAMPS;
+    for (int i = 0; i < 2; i++)
+    {
+        int channel = timestamp_dma_channels[i];
+        __dmb();
+        uint32_t captured = channel >= 0 ? MAX_TIMESTAMPS - dma_channel_hw_addr(channel)->transfer_count : timestamps_captured[i];
+        if (captured < num)
+        {
+            num = captured;
+        }
+    }
+    return num;
+}
+
+// Clock cycles from the first rising edge of the pseudoclock output to rising edge
+// number n of its trigger input (see timestamp.pio for where these numbers come from)
+uint64_t get_timestamp(uint32_t n)
+{
+    uint64_t timestamp = UINT64_MAX;
+    for (int i = 0; i < 2; i++)
+    {
+        // Undo the wrapping of the count, which is fine as long as the edges are
+        // less than 2^33 cycles apart
+        uint64_t count = 0;
+        uint32_t previous = 0xffffffff;
+        for (uint32_t j = 0; j <= n; j++)
+        {
+            count += (uint32_t)(previous - timestamp_counts[i][j]);
+            previous = timestamp_counts[i][j];
+        }
+        uint64_t cycles = 2 * count + 2 * n + (i == 0 ? 2 : 1);
+        if (cycles < timestamp)
+        {
+            timestamp = cycles;
+        }
+    }
+    return timestamp;
+}
+
 // void rearrange_instructions(int old_num, int new_num)
 // {
 //     // reset all waits
@@ -428,10 +931,23 @@ void free_pseudoclock_pio_sm(pseudoclock_config *config)
 //     }
 // }
 
+// Check whether pin is one of the pins in pins (OUT_PINS or IN_PINS) of any pseudoclock
+bool pin_in_list(const uint *pins, uint pin)
+{
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+    {
+        if (pins[i] == pin)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool pin_in_use(int pin)
 {
     // Check in pin is in use
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
     {
         if (OUT_PINS[i] == pin || IN_PINS[i] == pin)
         {
@@ -488,182 +1004,924 @@ void configure_missing_pins()
     }
 }
 
-void calculate_processed_waits(pseudoclock_config *configs)
+void __not_in_flash_func(calculate_processed_waits)(pseudoclock_config *configs, unsigned int shot)
 {
     // For every active pseudoclock, check how many waits we expected to see and
     // subtract off the remaining number of DMA transfers to do. This gives us a
     // measure of which waits are ready to be accessed
+    int counts[MAX_PSEUDOCLOCKS] = {};
     for (int i = 0; i < num_pseudoclocks_in_use; i++)
     {
         if (configs[i].configured)
         {
-            mutex_enter_blocking(&wait_mutex);
-            num_waits_processed[i] = configs[i].waits_to_send - dma_channel_hw_addr(configs[i].waits_dma_channel)->transfer_count;
-            mutex_exit(&wait_mutex);
+            counts[i] = configs[i].waits_to_send - dma_channel_hw_addr(configs[i].waits_dma_channel)->transfer_count;
+            // The last value is pushed by the stop instruction rather than a wait
+            for (int j = num_waits_processed[i]; j < counts[i] && j < configs[i].waits_to_send - 1; j++)
+            {
+                queue_event(EVENT_WAIT, i, j, shot);
+            }
         }
     }
+    set_num_processed_waits(shot, counts);
 }
 
-int get_num_processed_waits(int pseudoclock)
+// Re-arm the "wait pushed" interrupt of every running pseudoclock
+void __not_in_flash_func(enable_wait_pushed_irqs)(pseudoclock_config *configs)
 {
-    mutex_enter_blocking(&wait_mutex);
-    int num = num_waits_processed[pseudoclock];
-    mutex_exit(&wait_mutex);
-    return num;
+    uint32_t sources[2] = {0, 0};
+    for (int i = 0; i < num_pseudoclocks_in_use; i++)
+    {
+        if (configs[i].configured)
+        {
+            sources[pio_get_index(configs[i].pio)] |= 1u << (pis_sm0_rx_fifo_not_empty + configs[i].sm);
+        }
+    }
+    for (uint block = 0; block < 2; block++)
+    {
+        if (sources[block])
+        {
+            pio_set_irq0_source_mask_enabled(block == 0 ? pio0 : pio1, sources[block], true);
+        }
+    }
 }
 
-void core1_entry()
+bool __not_in_flash_func(pseudoclocks_running)(pseudoclock_config *configs)
 {
-    // PIO initialisation
-    uint offset = pio_add_program(pio_to_use, &pseudoclock_program);
-
-    // announce we are ready
-    multicore_fifo_push_blocking(0);
-
-    while (true)
+    for (int i = 0; i < num_pseudoclocks_in_use; i++)
     {
-        // wait for message from main core
-        uint32_t hwstart = multicore_fifo_pop_blocking();
-
-        // clear out number of processed waits per pseudoclock
-        mutex_enter_blocking(&wait_mutex);
-        num_waits_processed[0] = 0;
-        num_waits_processed[1] = 0;
-        num_waits_processed[2] = 0;
-        num_waits_processed[3] = 0;
-        mutex_exit(&wait_mutex);
-
-        // Initialise configs
-        pseudoclock_config pseudoclock_configs[4];
-        bool success = true;
-        for (int i = 0; i < num_pseudoclocks_in_use; i++)
+        if (configs[i].configured && (dma_channel_is_busy(configs[i].instructions_dma_channel) || dma_channel_is_busy(configs[i].waits_dma_channel)))
         {
-            pseudoclock_configs[i].pio = pio_to_use;
-            pseudoclock_configs[i].sm = i;
-            pseudoclock_configs[i].OUT_PIN = OUT_PINS[i];
-            pseudoclock_configs[i].IN_PIN = IN_PINS[i];
-            success = configure_pseudoclock_pio_sm(&pseudoclock_configs[i], offset, hwstart, max_instructions / num_pseudoclocks_in_use, max_waits / num_pseudoclocks_in_use);
-            if (!success)
-            {
-                if (DEBUG)
-                {
-                    fast_serial_printf("Failed to configure pseudoclock %d\r\n. Aborting.", i);
-                }
-                break;
-            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Number of waits processed in the current (or last) shot, which is stored in shot
+int get_num_processed_waits(int pseudoclock, unsigned int *shot)
+{
+    uint32_t sequence;
+    int num;
+    do
+    {
+        sequence = num_waits_sequence;
+        __dmb();
+        *shot = num_waits_shot;
+        num = num_waits_processed[pseudoclock];
+        __dmb();
+    } while ((sequence & 1) || sequence != num_waits_sequence);
+    return num;
+}
+
+// Whether the waits of a shot have not been overwritten by a later shot yet
+bool shot_waits_stored(int pseudoclock, unsigned int shot, unsigned int current_shot)
+{
+    return current_shot - shot < shots_stored[pseudoclock];
+}
+
+// Wait loops that were left of a processed wait when the trigger arrived (as pushed by the
+// PIO program), or 4294967295 if it timed out
+uint32_t get_wait_loops_remaining(int pseudoclock, unsigned int shot, unsigned int addr)
+{
+    int waits_per_pseudoclock = (max_waits / num_pseudoclocks_in_use) + 1;
+    unsigned int slot = (shot % shots_stored[pseudoclock]) * shot_wait_stride[pseudoclock];
+    return waits[pseudoclock * waits_per_pseudoclock + slot + addr];
+}
+
+// The value reported for a processed wait (see "getwait")
+uint32_t get_wait_value(int pseudoclock, unsigned int shot, unsigned int addr)
+{
+    unsigned int wait_remaining = get_wait_loops_remaining(pseudoclock, shot, addr);
+    // don't multiply the -1 wraparound of the unsigned int - this means a
+    // wait timed out.
+    if (wait_remaining != 4294967295)
+    {
+        // Note that these are not the lengths of the waits, but how many base (system) clock ticks were left
+        // before timeout. 0 = timeout. a wait with a timeout of 8, and a value reported here as 2, means the
+        // wait was 6 clock ticks long.
+        //
+        // We multiply by two here to counteract the divide by two when storing (see below),
+        // and by the clock divider. The result is saturated (which is only needed with a clock
+        // divider) so that it never looks like a timeout.
+        uint64_t cycles = to_system_cycles(pseudoclock, wait_remaining * 2);
+        wait_remaining = cycles < UINT32_MAX ? cycles : UINT32_MAX - 1;
+    }
+    return wait_remaining;
+}
+
+// Index of the first trigger timestamp at or after cycle (get_num_timestamps() if none)
+uint32_t find_timestamp(uint64_t cycle)
+{
+    uint32_t low = 0;
+    uint32_t high = get_num_timestamps();
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+        if (get_timestamp(middle) < cycle)
+        {
+            low = middle + 1;
         }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
 
-        if (!success)
+// The exact length of a processed wait of the current (or last) shot (see "getexactwait"),
+// or 4294967295 if it timed out. The wait loop only checks the trigger every other clock
+// cycle, so this replays the table (and the waits before this one) to find when the wait
+// started and which check saw the trigger, and then looks up the trigger edge in the
+// timestamps, which have single cycle resolution. Explicit indefinite waits are not timed by
+// the PIO at all, so their length only comes from the timestamps. Returns false if the edge
+// was not timestamped. Needs a divider of 1 and the timestamps of this pseudoclock's trigger.
+bool get_exact_wait_length(int pseudoclock, unsigned int shot, unsigned int addr, uint32_t *length)
+{
+    uint32_t *table = instruction_table(pseudoclock);
+    // Times are in clock cycles from the first rising edge of the output, as for the timestamps
+    uint64_t end = 0;        // end of the last clock pulse instruction
+    uint64_t next_rise = 0;  // next rising edge after a wait
+    bool started = false;    // reached the first rising edge
+    bool after_wait = true;  // at "start" of the PIO program (a wait here is indefinite)
+    bool triggered = false;  // the last wait ended on the trigger (which is then still high)
+    unsigned int wait = 0;
+    for (unsigned int i = 0; i < instructions_per_pseudoclock(); i++)
+    {
+        uint32_t reps = table[i * 2];
+        uint32_t loops = table[i * 2 + 1];
+        if (reps != 0)
         {
-            set_status(ABORTING);
-            for (int i = 0; i < num_pseudoclocks_in_use; i++)
+            uint64_t rise = after_wait ? next_rise : end;
+            started = true;
+            after_wait = false;
+            end = rise + 2 * (uint64_t)(loops + PSEUDOCLOCK_NON_LOOP_PATH_LENGTH) * reps;
+        }
+        else if (loops == 0)
+        {
+            break;
+        }
+        else if (after_wait)
+        {
+            // An indefinite wait, which is armed when the next rising edge would have been
+            // (the waits at the very start of the table are before the first rising edge)
+            if (started)
             {
-                if (pseudoclock_configs[i].configured)
+                if (!triggered)
                 {
-                    free_pseudoclock_pio_sm(&pseudoclock_configs[i]);
+                    uint32_t index = find_timestamp(next_rise - PSEUDOCLOCK_INPUT_SYNC_LENGTH);
+                    if (index >= get_num_timestamps())
+                    {
+                        return false;
+                    }
+                    next_rise = get_timestamp(index) + PSEUDOCLOCK_INPUT_SYNC_LENGTH;
                 }
+                next_rise += PSEUDOCLOCK_RESUME_LATENCY;
             }
-            set_status(ABORTED);
-            if (DEBUG)
+            triggered = false;
+        }
+        else if (loops == PSEUDOCLOCK_INDEFINITE_WAIT_WORD)
+        {
+            // An explicit indefinite wait (after a clock pulse), which checks the trigger
+            // every cycle, so ends as soon as the first edge after it started is visible
+            uint64_t first_check = end + PSEUDOCLOCK_INDEFINITE_WAIT_FIRST_CHECK;
+            uint32_t index = find_timestamp(first_check - PSEUDOCLOCK_INPUT_SYNC_LENGTH);
+            if (index >= get_num_timestamps())
+            {
+                return false;
+            }
+            uint64_t visible = get_timestamp(index) + PSEUDOCLOCK_INPUT_SYNC_LENGTH;
+            if (wait == addr)
+            {
+                *length = visible - end + 1;
+                return true;
+            }
+            next_rise = visible + PSEUDOCLOCK_INDEFINITE_WAIT_RESUME_LATENCY;
+            after_wait = true;
+            triggered = true;
+            wait++;
+        }
+        else
+        {
+            uint64_t first_check = end + PSEUDOCLOCK_WAIT_FIRST_CHECK;
+            uint32_t remaining = get_wait_loops_remaining(pseudoclock, shot, wait);
+            uint64_t detected;
+            triggered = remaining != 4294967295;
+            if (triggered)
+            {
+                detected = first_check + PSEUDOCLOCK_WAIT_LOOP_LENGTH * (uint64_t)(loops - remaining);
+            }
+            else
+            {
+                detected = first_check + PSEUDOCLOCK_WAIT_LOOP_LENGTH * (uint64_t)loops + 1;
+            }
+            if (wait == addr)
             {
-                fast_serial_printf("Core1 loop ended\r\n");
+                if (!triggered)
+                {
+                    *length = 4294967295;
+                    return true;
+                }
+                // The trigger became visible to the PIO at most one cycle before the check
+                // that saw it (unless it was already there at the first check)
+                uint64_t visible = detected;
+                if (detected > first_check)
+                {
+                    uint32_t index = find_timestamp(detected - 1 - PSEUDOCLOCK_INPUT_SYNC_LENGTH);
+                    if (index >= get_num_timestamps() || get_timestamp(index) > detected - PSEUDOCLOCK_INPUT_SYNC_LENGTH)
+                    {
+                        return false;
+                    }
+                    visible = get_timestamp(index) + PSEUDOCLOCK_INPUT_SYNC_LENGTH;
+                }
+                // The same origin as "getwait" (timeout minus value) uses, which counts the
+                // setup of the wait loop
+                *length = visible - end + 1;
+                return true;
             }
+            next_rise = detected + PSEUDOCLOCK_RESUME_LATENCY;
+            after_wait = true;
+            wait++;
+        }
+    }
+    return false;
+}
+
+// Write out queued events (core0, called while waiting for a command)
+void send_events()
+{
+    // Waits from shots that have since been overwritten (see "hwstart") count as lost
+    uint32_t overwritten = 0;
+    while (event_queue_tail != event_queue_head)
+    {
+        __dmb();
+        event_record event = event_queue[event_queue_tail % EVENT_QUEUE_LENGTH];
+        event_queue_tail++;
+        if (event.type == EVENT_STATUS)
+        {
+            fast_serial_printf("!status %u %u\r\n", event.time_us, event.value);
+        }
+        else if (event.type == EVENT_SHOT)
+        {
+            fast_serial_printf("!shot %u %u\r\n", event.time_us, event.shot);
+        }
+        else
+        {
+            unsigned int current_shot;
+            get_num_processed_waits(event.pseudoclock, &current_shot);
+            if (!shot_waits_stored(event.pseudoclock, event.shot, current_shot))
+            {
+                overwritten++;
+                continue;
+            }
+            fast_serial_printf("!wait %u %u %u %u\r\n", event.time_us, event.pseudoclock, event.value, get_wait_value(event.pseudoclock, event.shot, event.value));
+        }
+    }
+    if (events_lost || overwritten)
+    {
+        uint32_t saved_irq = spin_lock_blocking(event_lock);
+        uint32_t lost = events_lost + overwritten;
+        events_lost = 0;
+        spin_unlock(event_lock, saved_irq);
+        fast_serial_printf("!lost %u\r\n", lost);
+    }
+}
+
+// Write out and discard the trace records of both cores (core0, see "trace dump")
+void dump_trace()
+{
+    for (uint core = 0; core < 2; core++)
+    {
+        trace_ring *ring = &trace_rings[core];
+        uint32_t head = ring->head;
+        while (ring->tail != head)
+        {
+            __dmb();
+            trace_record record = ring->records[ring->tail % TRACE_LENGTH];
+            __dmb();
+            ring->tail++;
+            fast_serial_printf("%u core%u %u: ", record.time_us, core, record.cycles);
+            fast_serial_printf(trace_messages[record.id], record.args[0], record.args[1], record.args[2]);
+            fast_serial_printf("\r\n");
+        }
+        uint32_t lost = ring->lost;
+        if (lost != ring->lost_reported)
+        {
+            fast_serial_printf("core%u lost %u\r\n", core, lost - ring->lost_reported);
+            ring->lost_reported = lost;
+        }
+    }
+}
+
+void reset_coalescing(int pseudoclock)
+{
+    // Drop the records of this pseudoclock, keeping the others in order
+    int j = 0;
+    for (int i = 0; i < num_coalesced_slots; i++)
+    {
+        if (coalesced_slots[i].pseudoclock != pseudoclock)
+        {
+            coalesced_slots[j++] = coalesced_slots[i];
+        }
+    }
+    num_coalesced_slots = j;
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+    {
+        if (i == pseudoclock || coalesce[i].open_entry < 0)
+        {
             continue;
         }
+        // The open entry is the last one for that pseudoclock
+        for (int k = num_coalesced_slots - 1; k >= 0; k--)
+        {
+            if (coalesced_slots[k].pseudoclock == i)
+            {
+                coalesce[i].open_entry = k;
+                break;
+            }
+        }
+    }
+    coalesce[pseudoclock].next_addr = 0;
+    coalesce[pseudoclock].next_slot = 0;
+    coalesce[pseudoclock].open_entry = -1;
+}
 
-        // Check that this shot has not been aborted already
-        if (get_status() == TRANSITION_TO_RUNNING)
+// Clear the table of a pseudoclock in use, along with its coalescing state and the waits of
+// its last shot (which are reported in the units of its clock divider, see "setclkdiv")
+void clear_pseudoclock_table(int pseudoclock)
+{
+    memset(instruction_table(pseudoclock), 0, (instructions_per_pseudoclock() * 2 + 2) * sizeof(uint32_t));
+    reset_coalescing(pseudoclock);
+    unsigned int shot;
+    int counts[MAX_PSEUDOCLOCKS];
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+    {
+        counts[i] = get_num_processed_waits(i, &shot);
+    }
+    counts[pseudoclock] = 0;
+    set_num_processed_waits(shot, counts);
+    shot_wait_stride[pseudoclock] = 0;
+    shots_stored[pseudoclock] = 0;
+}
+
+// Store an instruction while coalescing. Instructions must arrive in order, starting from
+// address 0 (which discards the previous table). Returns a pseudoclock_encode_result or
+// one of the COALESCE_* errors.
+int __not_in_flash_func(coalesce_instruction)(int pseudoclock, uint32_t addr, uint32_t half_period, uint32_t reps, uint32_t *table)
+{
+    coalesce_state *state = &coalesce[pseudoclock];
+    if (addr == 0)
+    {
+        reset_coalescing(pseudoclock);
+    }
+    else if (addr != state->next_addr)
+    {
+        return COALESCE_NOT_SEQUENTIAL;
+    }
+
+    // Waits and stops are never merged (two waits in a row are an indefinite wait)
+    if (state->next_slot > 0 && reps != 0 && half_period == state->last_half_period && reps == state->last_reps)
+    {
+        uint32_t *words = &table[(state->next_slot - 1) * 2];
+        uint32_t slot_half_period;
+        uint32_t slot_reps;
+        pseudoclock_decode(words, &slot_half_period, &slot_reps);
+        bool recorded = state->open_entry >= 0;
+        uint32_t count = recorded ? coalesced_slots[state->open_entry].count : 1;
+        // Start a new slot instead if the total reps would overflow (or nothing more can be recorded)
+        if (slot_reps <= UINT32_MAX - reps && count < UINT16_MAX && (recorded || num_coalesced_slots < MAX_COALESCED_SLOTS))
+        {
+            if (!recorded)
+            {
+                state->open_entry = num_coalesced_slots++;
+                coalesced_slots[state->open_entry].slot = state->next_slot - 1;
+                coalesced_slots[state->open_entry].count = 1;
+                coalesced_slots[state->open_entry].pseudoclock = pseudoclock;
+            }
+            pseudoclock_encode(slot_half_period, slot_reps + reps, words);
+            coalesced_slots[state->open_entry].count++;
+            state->next_addr++;
+            return PSEUDOCLOCK_ENCODE_OK;
+        }
+    }
+
+    if (state->next_slot >= instructions_per_pseudoclock())
+    {
+        return COALESCE_NO_FREE_SLOTS;
+    }
+    int result = pseudoclock_encode(half_period, reps, &table[state->next_slot * 2]);
+    if (result == PSEUDOCLOCK_ENCODE_OK)
+    {
+        state->next_slot++;
+        state->next_addr++;
+        state->open_entry = -1;
+        state->last_half_period = half_period;
+        state->last_reps = reps;
+    }
+    return result;
+}
+
+// Store an instruction whose half period is already in cycles of the pseudoclock's state
+// machine. Returns a pseudoclock_encode_result or one of the COALESCE_* errors.
+int __not_in_flash_func(store_divided_instruction)(int pseudoclock, uint32_t addr, uint32_t half_period, uint32_t reps, uint32_t *table)
+{
+    if (coalesce[pseudoclock].enabled)
+    {
+        return coalesce_instruction(pseudoclock, addr, half_period, reps, table);
+    }
+    return pseudoclock_encode(half_period, reps, &table[addr * 2]);
+}
+
+// Store an instruction received by set/setb. Returns a pseudoclock_encode_result or one
+// of the COALESCE_* errors.
+int __not_in_flash_func(store_instruction)(int pseudoclock, uint32_t addr, uint32_t half_period, uint32_t reps, uint32_t *table)
+{
+    uint32_t divided;
+    if (!pseudoclock_divide_half_period(half_period, reps, clock_dividers[pseudoclock], &divided))
+    {
+        return PSEUDOCLOCK_ENCODE_INVALID_WAIT;
+    }
+    return store_divided_instruction(pseudoclock, addr, divided, reps, table);
+}
+
+// Store a linear chirp of count instructions with one rep each, starting at *addr: the
+// first has a half period of half_period system clock cycles and each following one is delta
+// cycles longer. Stops at the first instruction that can't be stored and returns its
+// pseudoclock_encode_result (or COALESCE_* error). *addr is left at the next address.
+int store_chirp(int pseudoclock, uint32_t *addr, uint32_t half_period, int32_t delta, uint32_t count, uint32_t *table)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int result = COALESCE_NO_FREE_SLOTS;
+        if (coalesce[pseudoclock].enabled || *addr < instructions_per_pseudoclock())
+        {
+            result = store_instruction(pseudoclock, *addr, half_period + (uint32_t)delta * i, 1, table);
+        }
+        if (result != PSEUDOCLOCK_ENCODE_OK)
         {
-            // update the status
-            set_status(RUNNING);
+            return result;
+        }
+        (*addr)++;
+    }
+    return PSEUDOCLOCK_ENCODE_OK;
+}
 
-            // Start the PIO SMs together as well as synchronising the clocks
-            uint enable_mask = 0;
+// Instructions rejected while decoding a "setb" payload
+struct setb_errors
+{
+    uint32_t reps_count;
+    uint32_t last_reps_idx;
+    uint32_t half_period_count;
+    uint32_t last_half_period_idx;
+    uint32_t no_slot_count;
+    // "setb64" only
+    uint32_t too_long_count;
+    uint32_t last_too_long_idx;
+};
+
+// Decode and store count instructions of a "setb" payload, starting at addr. Returns the next address.
+unsigned int __not_in_flash_func(decode_instructions)(const uint8_t *buffer, uint32_t count, int pseudoclock, unsigned int addr, setb_errors *errors)
+{
+    uint32_t *table = instruction_table(pseudoclock);
+    // Errors are reported by index into the tables of all pseudoclocks
+    uint32_t first_index = pseudoclock * (instructions_per_pseudoclock() + 1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t reps = ((buffer[8 * i + 7] << 24)
+                         | (buffer[8 * i + 6] << 16)
+                         | (buffer[8 * i + 5] << 8)
+                         | (buffer[8 * i + 4]));
+        uint32_t half_period = ((buffer[8 * i + 3] << 24)
+                                | (buffer[8 * i + 2] << 16)
+                                | (buffer[8 * i + 1] << 8)
+                                | (buffer[8 * i + 0]));
+
+        // See "set" command for how these are encoded
+        switch (store_instruction(pseudoclock, addr, half_period, reps, table))
+        {
+        case PSEUDOCLOCK_ENCODE_OK:
+            addr++;
+            break;
+        case PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT:
+            fast_serial_printf("half-period too short\r\n");
+            errors->half_period_count++;
+            errors->last_half_period_idx = first_index + addr;
+            break;
+        case COALESCE_NO_FREE_SLOTS:
+            errors->no_slot_count++;
+            break;
+        default:
+            errors->reps_count++;
+            errors->last_reps_idx = first_index + addr;
+            break;
+        }
+    }
+    return addr;
+}
+
+uint64_t read_uint64_le(const uint8_t *bytes)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// Decode and store count extended instructions of a "setb64" payload, starting at addr.
+// Each is split into as few instructions as possible (see pseudoclock_split_count), which
+// take consecutive addresses. Returns the next address.
+unsigned int decode_extended_instructions(const uint8_t *buffer, uint32_t count, int pseudoclock, unsigned int addr, setb_errors *errors)
+{
+    uint32_t *table = instruction_table(pseudoclock);
+    uint32_t first_index = pseudoclock * (instructions_per_pseudoclock() + 1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t reps = read_uint64_le(&buffer[16 * i + 8]);
+        uint64_t half_period;
+        if (!pseudoclock_divide_half_period64(read_uint64_le(&buffer[16 * i]), reps, clock_dividers[pseudoclock], &half_period))
+        {
+            errors->reps_count++;
+            errors->last_reps_idx = first_index + addr;
+            continue;
+        }
+        // Only the reps can be split, the half period has to fit (once divided by the clock divider)
+        if (half_period > UINT32_MAX)
+        {
+            errors->too_long_count++;
+            errors->last_too_long_idx = first_index + addr;
+            continue;
+        }
+        do
+        {
+            uint32_t part = reps > PSEUDOCLOCK_MAX_REPS ? PSEUDOCLOCK_MAX_REPS : (uint32_t)reps;
+            int result = COALESCE_NO_FREE_SLOTS;
+            if (coalesce[pseudoclock].enabled || addr < instructions_per_pseudoclock())
+            {
+                result = store_divided_instruction(pseudoclock, addr, (uint32_t)half_period, part, table);
+            }
+            if (result == PSEUDOCLOCK_ENCODE_OK)
+            {
+                addr++;
+                reps -= part;
+                continue;
+            }
+            if (result == PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT)
+            {
+                errors->half_period_count++;
+                errors->last_half_period_idx = first_index + addr;
+            }
+            else if (result == COALESCE_NO_FREE_SLOTS)
+            {
+                errors->no_slot_count++;
+            }
+            else
+            {
+                errors->reps_count++;
+                errors->last_reps_idx = first_index + addr;
+            }
+            break;
+        } while (reps > 0);
+    }
+    return addr;
+}
+
+// Find the slot holding the coalesced instruction at addr, and how many instructions
+// were merged into it
+uint32_t coalesced_slot_for(int pseudoclock, uint32_t addr, uint32_t *count)
+{
+    // Instructions (before the current record) that do not have a slot of their own
+    uint32_t merged = 0;
+    *count = 1;
+    for (int i = 0; i < num_coalesced_slots; i++)
+    {
+        if (coalesced_slots[i].pseudoclock != pseudoclock)
+        {
+            continue;
+        }
+        uint32_t first_addr = coalesced_slots[i].slot + merged;
+        if (addr < first_addr)
+        {
+            break;
+        }
+        if (addr < first_addr + coalesced_slots[i].count)
+        {
+            *count = coalesced_slots[i].count;
+            return coalesced_slots[i].slot;
+        }
+        merged += coalesced_slots[i].count - 1;
+    }
+    return addr - merged;
+}
+
+// Count the state machines that have stalled on an empty TX FIFO since the last check
+// (core1). The flags are also cleared by pio_sm_init at the start of each shot.
+void __not_in_flash_func(sample_health)(pseudoclock_config *configs)
+{
+    uint32_t stalled[2];
+    for (uint block = 0; block < 2; block++)
+    {
+        PIO pio = block == 0 ? pio0 : pio1;
+        stalled[block] = (pio->fdebug >> PIO_FDEBUG_TXSTALL_LSB) & 0xf;
+        if (stalled[block])
+        {
+            pio->fdebug = stalled[block] << PIO_FDEBUG_TXSTALL_LSB;
+        }
+    }
+    if (!stalled[0] && !stalled[1])
+    {
+        return;
+    }
+    for (int i = 0; i < num_pseudoclocks_in_use; i++)
+    {
+        if (!configs[i].configured || !(stalled[pio_get_index(configs[i].pio)] & (1u << configs[i].sm)))
+        {
+            continue;
+        }
+        health[i].stalls++;
+        if (health[i].first_instruction < 0)
+        {
+            // Words pulled so far are those sent by DMA, less the ones still in the FIFO
+            uint32_t sent = configs[i].words_to_send - dma_channel_hw_addr(configs[i].instructions_dma_channel)->transfer_count;
+            uint32_t pulled = sent - pio_sm_get_tx_fifo_level(configs[i].pio, configs[i].sm);
+            health[i].first_instruction = pulled / 2;
+        }
+    }
+}
+
+// Enable the state machines of the pseudoclocks (bit masks indexed by PIO block, core1).
+// Those in the same block start on the same cycle. The RP2040 can't enable two blocks
+// at once, so with more than 4 pseudoclocks the other block is enabled straight after
+// pio_to_use, with interrupts disabled so that nothing runs in between.
+void __not_in_flash_func(enable_pseudoclocks)(const uint32_t *enable_masks)
+{
+    PIO other = other_pio();
+    uint32_t other_mask = enable_masks[pio_get_index(other)];
+    if (!other_mask)
+    {
+        pio_enable_sm_mask_in_sync(pio_to_use, enable_masks[pio_get_index(pio_to_use)]);
+        return;
+    }
+    uint32_t saved_irq = save_and_disable_interrupts();
+    uint32_t start = cycle_counter_read();
+    pio_enable_sm_mask_in_sync(pio_to_use, enable_masks[pio_get_index(pio_to_use)]);
+    pio_enable_sm_mask_in_sync(other, other_mask);
+    uint32_t end = cycle_counter_read();
+    restore_interrupts(saved_irq);
+    // An upper bound, as it includes reading the counter
+    cycle_stat_record(&stats[STAT_START_SKEW], cycle_counter_elapsed(start, end));
+}
+
+void __not_in_flash_func(core1_entry)()
+{
+    // Interrupts that end the sleep during a shot (enabled on this core)
+    cycle_counter_init();
+    irq_set_exclusive_handler(DMA_IRQ_1, waits_dma_irq_handler);
+    irq_set_exclusive_handler(PIO0_IRQ_0, wait_pushed_irq_handler);
+    irq_set_exclusive_handler(PIO1_IRQ_0, wait_pushed_irq_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+    irq_set_enabled(PIO0_IRQ_0, true);
+    irq_set_enabled(PIO1_IRQ_0, true);
+
+    // announce we are ready
+    multicore_fifo_push_blocking(0);
+
+    while (true)
+    {
+        // wait for message from main core
+        uint32_t hwstart = multicore_fifo_pop_blocking();
+
+        // Load the pseudoclock programs into the PIO blocks this queue uses (as assigned by
+        // core0). They are only loaded while needed, as there isn't room for the timestamp
+        // program alongside them.
+        for (uint block = 0; block < 2; block++)
+        {
+            if (pseudoclock_programs[block])
+            {
+                pseudoclock_program_offsets[block] = pio_add_program(block == 0 ? pio0 : pio1, pseudoclock_programs[block]);
+            }
+        }
+
+        // Run the queued shots back to back. Core1 re-arms the pseudoclocks after each
+        // shot (rather than the host), and every shot starts on a hardware trigger.
+        bool failed = false;
+        bool aborting = false;
+        for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+        {
+            health[i].shots = 0;
+        }
+        for (unsigned int shot = 0; shot < shots_queued; shot++)
+        {
+            uint32_t arm_start = cycle_counter_read();
+            sequence_ended = false;
+            core1_wakeups = 0;
+            core1_worst_wakeup_cycles = 0;
+            for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+            {
+                health[i].stalls = 0;
+                health[i].first_instruction = -1;
+            }
+
+            // clear out number of processed waits per pseudoclock
+            const int no_waits[MAX_PSEUDOCLOCKS] = {};
+            set_num_processed_waits(shot, no_waits);
+
+            // Initialise configs
+            pseudoclock_config pseudoclock_configs[MAX_PSEUDOCLOCKS];
+            bool success = true;
             for (int i = 0; i < num_pseudoclocks_in_use; i++)
             {
-                if (pseudoclock_configs[i].configured)
+                pseudoclock_configs[i].pseudoclock = i;
+                pseudoclock_configs[i].pio = pseudoclock_pio(i);
+                pseudoclock_configs[i].sm = pseudoclock_sm(i);
+                pseudoclock_configs[i].OUT_PIN = OUT_PINS[i];
+                pseudoclock_configs[i].IN_PIN = IN_PINS[i];
+                uint32_t configure_start = cycle_counter_read();
+                uint offset = pseudoclock_program_offsets[pio_get_index(pseudoclock_configs[i].pio)];
+                success = configure_pseudoclock_pio_sm(&pseudoclock_configs[i], offset, hwstart, instructions_per_pseudoclock(), max_waits / num_pseudoclocks_in_use, shot);
+                cycle_stat_record(&stats[STAT_CONFIGURE], cycle_counter_elapsed(configure_start, cycle_counter_read()));
+                if (!success)
                 {
-                    enable_mask |= 1u << i;
+                    trace(TRACE_CONFIGURE_FAILED, i);
+                    break;
                 }
             }
-            pio_enable_sm_mask_in_sync(pio_to_use, enable_mask);
 
-            // Wait for DMA transfers to finish
-            for (int i = 0; i < num_pseudoclocks_in_use; i++)
+            if (!success)
             {
-                if (pseudoclock_configs[i].configured)
+                set_status(ABORTING);
+                for (int i = 0; i < num_pseudoclocks_in_use; i++)
                 {
-                    if (DEBUG)
+                    if (pseudoclock_configs[i].configured)
                     {
-                        fast_serial_printf("Tight loop for pseudoclock %d beginning\r\n", i);
+                        free_pseudoclock_pio_sm(&pseudoclock_configs[i]);
                     }
-                    while (dma_channel_is_busy(pseudoclock_configs[i].instructions_dma_channel) && get_status() != ABORT_REQUESTED)
+                }
+                set_status(ABORTED);
+                failed = true;
+                break;
+            }
+
+            timestamp_config timestamps;
+            configure_timestamp_sms(&timestamps, pseudoclock_configs);
+            core1_arm_cycles = cycle_counter_elapsed(arm_start, cycle_counter_read());
+
+            // Check that this shot has not been aborted already, and update the status
+            // (which stays RUNNING between the shots of a queue)
+            if (shot == 0 ? status_compare_and_set(TRANSITION_TO_RUNNING, RUNNING) : get_status() == RUNNING)
+            {
+
+                // Start the PIO SMs together as well as synchronising the clocks
+                uint32_t enable_masks[2] = {0, 0};
+                for (int i = 0; i < num_pseudoclocks_in_use; i++)
+                {
+                    pseudoclock_config *config = &pseudoclock_configs[i];
+                    if (config->configured)
                     {
-                        calculate_processed_waits(pseudoclock_configs);
+                        enable_masks[pio_get_index(config->pio)] |= 1u << config->sm;
+                        // Let DMA fill the TX FIFO first, so that the state machine doesn't
+                        // start out stalled on it (which would count as an underrun)
+                        while (!pio_sm_is_tx_fifo_full(config->pio, config->sm) && dma_channel_is_busy(config->instructions_dma_channel))
+                        {
+                            tight_loop_contents();
+                        }
                     }
-                    if (DEBUG)
+                }
+                enable_pseudoclocks(enable_masks);
+                cycle_stat_record(&stats[STAT_START], cycle_counter_elapsed(arm_start, cycle_counter_read()));
+                trace(TRACE_SHOT_STARTED, shot);
+
+                // Sleep until the DMA transfers have finished or an abort is requested.
+                // We are woken by the waits DMA completing, by a wait length being pushed
+                // (so that getwait is up to date) and by any change of status.
+                trace(TRACE_WAITING);
+                while (true)
+                {
+                    uint32_t wakeup_start = cycle_counter_read();
+                    // Re-arm before counting, so that a wait pushed in between still wakes us up
+                    enable_wait_pushed_irqs(pseudoclock_configs);
+                    calculate_processed_waits(pseudoclock_configs, shot);
+                    sample_health(pseudoclock_configs);
+                    if (!pseudoclocks_running(pseudoclock_configs) || get_status() == ABORT_REQUESTED)
                     {
-                        fast_serial_printf("Tight loop for pseudoclock waits %d beginning\r\n", i);
+                        break;
                     }
-                    while (dma_channel_is_busy(pseudoclock_configs[i].waits_dma_channel) && get_status() != ABORT_REQUESTED)
+                    uint32_t wakeup_cycles = cycle_counter_elapsed(wakeup_start, cycle_counter_read());
+                    cycle_stat_record(&stats[STAT_WAKEUP], wakeup_cycles);
+                    if (wakeup_cycles > core1_worst_wakeup_cycles)
                     {
-                        calculate_processed_waits(pseudoclock_configs);
+                        core1_worst_wakeup_cycles = wakeup_cycles;
                     }
-                    if (DEBUG)
+                    core1_wakeups++;
+                    __wfe();
+                }
+                pio_set_irq0_source_mask_enabled(pio0, WAIT_PUSHED_IRQ_SOURCES, false);
+                pio_set_irq0_source_mask_enabled(pio1, WAIT_PUSHED_IRQ_SOURCES, false);
+                sample_health(pseudoclock_configs);
+                for (int i = 0; i < num_pseudoclocks_in_use; i++)
+                {
+                    if (health[i].stalls > 0)
                     {
-                        fast_serial_printf("Tight loops done for pseudoclock %d\r\n", i);
+                        health[i].shots++;
                     }
                 }
             }
-        }
 
-        // One final calculation of processed waits in case we missed it in the
-        // last loop iteration
-        calculate_processed_waits(pseudoclock_configs);
+            // One final calculation of processed waits in case we missed it in the
+            // last loop iteration
+            calculate_processed_waits(pseudoclock_configs, shot);
 
-        // If we aborted, update the status to acknowledge the abort
-        if (get_status() == ABORT_REQUESTED)
-        {
-            if (DEBUG)
+            // After the last shot (or an abort), update the status to acknowledge the abort,
+            // otherwise put in the transition to stop state. An abort can still arrive until
+            // we leave RUNNING, so retry until one of the transitions succeeds.
+            bool finished = shot + 1 == shots_queued || get_status() != RUNNING;
+            if (finished)
             {
-                fast_serial_printf("Aborting pseudoclock program\r\n");
+                while (true)
+                {
+                    if (status_compare_and_set(ABORT_REQUESTED, ABORTING))
+                    {
+                        aborting = true;
+                        break;
+                    }
+                    if (status_compare_and_set(RUNNING, TRANSITION_TO_STOP))
+                    {
+                        aborting = false;
+                        break;
+                    }
+                }
+                trace(aborting ? TRACE_ABORTING : TRACE_COMPLETE);
             }
 
-            set_status(ABORTING);
-        }
-        // otherwise put in the transition to stop state
-        else
-        {
-            if (DEBUG)
+            // cleanup
+            free_timestamp_sms(&timestamps);
+            for (int i = 0; i < num_pseudoclocks_in_use; i++)
             {
-                fast_serial_printf("Pseudoclock program complete\r\n");
+                if (pseudoclock_configs[i].configured)
+                {
+                    free_pseudoclock_pio_sm(&pseudoclock_configs[i]);
+                }
             }
 
-            set_status(TRANSITION_TO_STOP);
+            if (aborting)
+            {
+                break;
+            }
+            shots_completed = shot + 1;
+            queue_event(EVENT_SHOT, 0, 0, shot);
+            if (finished)
+            {
+                break;
+            }
         }
 
-        // cleanup
-        for (int i = 0; i < num_pseudoclocks_in_use; i++)
+        for (uint block = 0; block < 2; block++)
         {
-            if (pseudoclock_configs[i].configured)
+            if (pseudoclock_programs[block])
             {
-                free_pseudoclock_pio_sm(&pseudoclock_configs[i]);
+                pio_remove_program(block == 0 ? pio0 : pio1, pseudoclock_programs[block], pseudoclock_program_offsets[block]);
             }
         }
 
-        // Update the status
-        if (get_status() == ABORTING)
+        // Update the status (a shot that failed to configure has already been aborted)
+        if (aborting)
         {
             set_status(ABORTED);
         }
-        else
+        else if (!failed)
         {
             set_status(STOPPED);
+            // Only if the last shot ran a pseudoclock (with every table empty, nothing ends it)
+            if (sequence_ended)
+            {
+                last_stop_latency = cycle_counter_elapsed(sequence_end_cycles, cycle_counter_read());
+                cycle_stat_record(&stats[STAT_STOP], last_stop_latency);
+                if (last_stop_latency > worst_stop_latency)
+                {
+                    worst_stop_latency = last_stop_latency;
+                }
+            }
         }
 
-        if (DEBUG)
+        trace(TRACE_LOOP_ENDED);
+    }
+}
+
+// Stop every running pseudoclock (core0, when aborting). Each state machine is made to
+// execute a jump to the end of the program that also drives its output low, which
+// takes effect straight away even if it is stalled on the FIFO or a wait.
+void __not_in_flash_func(stop_pseudoclocks)()
+{
+    for (int i = 0; i < num_pseudoclocks_in_use; i++)
+    {
+        PIO pio = pseudoclock_pio(i);
+        uint sm = pseudoclock_sm(i);
+        // Only state machines claimed by core1 belong to this shot
+        if (pio_sm_is_claimed(pio, sm))
         {
-            fast_serial_printf("Core1 loop ended\r\n");
+            uint offset = pseudoclock_program_offsets[pio_get_index(pio)];
+            pio_sm_exec(pio, sm, pio_encode_jmp(offset + pseudoclock_end_offset(pio)) | pio_encode_sideset_opt(1, 0));
         }
     }
 }
@@ -678,6 +1936,7 @@ void configure_gpio()
         {
             gpio_init(OUT_PINS[i]);
             gpio_set_dir(OUT_PINS[i], GPIO_OUT);
+            set_gpio_overrides(i, OUT_PINS[i], IN_PINS[i]);
         }
         // update inited state
         gpio_inited = 1;
@@ -722,9 +1981,36 @@ void resus_callback(void)
     fast_serial_printf("System Clock Resus'd\r\n");
 }
 
+// Start a shot (or a queue of them with hwstart), as requested by start/hwstart. Returns
+// false (having reported why) if the pseudoclocks don't fit in the PIO blocks.
+bool start_shots(uint32_t hwstart, unsigned int shots)
+{
+    if (!assign_pseudoclock_sms())
+    {
+        fast_serial_printf("At most 4 pseudoclocks can use edge triggers, and at most 4 level triggers\r\n");
+        return false;
+    }
+    shots_queued = shots;
+    shots_completed = 0;
+    configure_gpio();
+    // Force output low in case it was left high
+    for (int i = 0; i < num_pseudoclocks_in_use; i++)
+    {
+        gpio_put(OUT_PINS[i], 0);
+    }
+    // update status (before notifying core1, which checks it once configured)
+    set_status(TRANSITION_TO_RUNNING);
+    // Notify state machine to start
+    multicore_fifo_push_blocking(hwstart);
+    // update gpio inited status
+    gpio_inited = 0;
+    return true;
+}
+
 void loop()
 {
     fast_serial_read_until(readstring, 256, '\n');
+    command_start_us = time_us_32();
     int local_status = get_status();
     if (strncmp(readstring, "version", 7) == 0)
     {
@@ -751,15 +2037,26 @@ void loop()
     }
     else if (strncmp(readstring, "abort", 5) == 0)
     {
-        if (local_status != RUNNING && local_status != TRANSITION_TO_RUNNING)
+        uint32_t abort_start = cycle_counter_read();
+        trace(TRACE_ABORT_REQUESTED);
+        // Only request the abort if core1 has not moved on since we checked the status
+        if (!status_compare_and_set(RUNNING, ABORT_REQUESTED) && !status_compare_and_set(TRANSITION_TO_RUNNING, ABORT_REQUESTED))
         {
             fast_serial_printf("Can only abort when status is 1 or 2 (transitioning to running or running)\r\n");
         }
         else
         {
+            // Stop the state machines straight away, rather than when core1 cleans up
+            stop_pseudoclocks();
+            last_abort_latency = cycle_counter_elapsed(abort_start, cycle_counter_read());
+            cycle_stat_record(&stats[STAT_ABORT], last_abort_latency);
+            if (last_abort_latency > worst_abort_latency)
+            {
+                worst_abort_latency = last_abort_latency;
+            }
+
             // force output low first, this should take control from the state machine
             // and prevent it from changing the output pin state erroneously as we drain the fifo
-            set_status(ABORT_REQUESTED);
             configure_gpio();
             for (int i = 0; i < num_pseudoclocks_in_use; i++)
             {
@@ -769,6 +2066,50 @@ void loop()
             fast_serial_printf("ok\r\n");
         }
     }
+    else if (strncmp(readstring, "getexactwait", 12) == 0)
+    {
+        unsigned int addr;
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u %u", &pseudoclock, &addr);
+        int waits_per_pseudoclock = (max_waits / num_pseudoclocks_in_use) + 1;
+        if (parsed < 2)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
+        {
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
+        }
+        else if (addr >= waits_per_pseudoclock)
+        {
+            fast_serial_printf("invalid address\r\n");
+        }
+        else if (timestamp_pseudoclock != pseudoclock || timestamp_output || clock_dividers[pseudoclock] != PSEUDOCLOCK_CLOCK_DIVIDER_ONE || (trigger_modes[pseudoclock] != TRIGGER_HIGH && trigger_modes[pseudoclock] != TRIGGER_LOW))
+        {
+            fast_serial_printf("exact waits need timestamps of the trigger, a level trigger and no clock divider\r\n");
+        }
+        else
+        {
+            unsigned int shot;
+            uint32_t length;
+            if (addr >= get_num_processed_waits(pseudoclock, &shot))
+            {
+                fast_serial_printf("wait not yet available\r\n");
+            }
+            else if (!get_exact_wait_length(pseudoclock, shot, addr, &length))
+            {
+                fast_serial_printf("exact length not available\r\n");
+            }
+            else
+            {
+                fast_serial_printf("%u\r\n", length);
+            }
+        }
+    }
     else if (strncmp(readstring, "getwait", 7) == 0)
     {
         unsigned int addr;
@@ -779,40 +2120,202 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
         }
         else if (addr >= waits_per_pseudoclock)
         {
             fast_serial_printf("invalid address\r\n");
         }
-        else if (addr >= get_num_processed_waits(pseudoclock))
+        else
+        {
+            unsigned int shot;
+            if (addr >= get_num_processed_waits(pseudoclock, &shot))
+            {
+                fast_serial_printf("wait not yet available\r\n");
+            }
+            else
+            {
+                fast_serial_printf("%u\r\n", get_wait_value(pseudoclock, shot, addr));
+            }
+        }
+    }
+    else if (strncmp(readstring, "getshotwait", 11) == 0)
+    {
+        unsigned int shot;
+        unsigned int addr;
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u %u %u", &pseudoclock, &shot, &addr);
+        if (parsed < 3)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
         {
-            fast_serial_printf("wait not yet available\r\n");
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
         }
         else
         {
-            unsigned int wait_remaining = waits[pseudoclock * waits_per_pseudoclock + addr];
-            // don't multiply the -1 wraparound of the unsigned int - this means a
-            // wait timed out.
-            if (wait_remaining != 4294967295)
+            unsigned int current_shot;
+            int processed = get_num_processed_waits(pseudoclock, &current_shot);
+            if (shot >= shots_queued || addr >= shot_wait_stride[pseudoclock])
+            {
+                fast_serial_printf("invalid address\r\n");
+            }
+            else if (shot > current_shot || (shot == current_shot && addr >= processed))
+            {
+                fast_serial_printf("wait not yet available\r\n");
+            }
+            else if (!shot_waits_stored(pseudoclock, shot, current_shot))
+            {
+                fast_serial_printf("wait no longer stored\r\n");
+            }
+            else
+            {
+                fast_serial_printf("%u\r\n", get_wait_value(pseudoclock, shot, addr));
+            }
+        }
+    }
+    else if (strncmp(readstring, "getshots", 8) == 0)
+    {
+        fast_serial_printf("completed:%u queued:%u\r\n", shots_completed, shots_queued);
+    }
+    else if (strncmp(readstring, "gettimestampcount", 17) == 0)
+    {
+        fast_serial_printf("%u\r\n", get_num_timestamps());
+    }
+    else if (strncmp(readstring, "gettimestamps", 13) == 0)
+    {
+        // Stream count timestamps back, one per line (so a capture can be read in one go)
+        unsigned int first;
+        unsigned int count;
+        int parsed = sscanf(readstring, "%*s %u %u", &first, &count);
+        if (parsed < 2)
+        {
+            fast_serial_printf("invalid request\r\n");
+            return;
+        }
+        if (first > MAX_TIMESTAMPS || count > MAX_TIMESTAMPS - first)
+        {
+            fast_serial_printf("invalid address\r\n");
+            return;
+        }
+        uint32_t available = get_num_timestamps();
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            if (i < available)
+            {
+                fast_serial_printf("%llu\r\n", (unsigned long long)get_timestamp(i));
+            }
+            else
             {
-                // Note that these are not the lengths of the waits, but how many base (system) clock ticks were left
-                // before timeout. 0 = timeout. a wait with a timeout of 8, and a value reported here as 2, means the
-                // wait was 6 clock ticks long.
-                //
-                // We multiply by two here to counteract the divide by two when storing (see below)
-                wait_remaining *= 2;
+                fast_serial_printf("timestamp not yet available\r\n");
             }
-            fast_serial_printf("%u\r\n", wait_remaining);
         }
     }
+    else if (strncmp(readstring, "gettimestamp", 12) == 0)
+    {
+        unsigned int index;
+        int parsed = sscanf(readstring, "%*s %u", &index);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (index >= MAX_TIMESTAMPS)
+        {
+            fast_serial_printf("invalid address\r\n");
+        }
+        else if (index >= get_num_timestamps())
+        {
+            fast_serial_printf("timestamp not yet available\r\n");
+        }
+        else
+        {
+            fast_serial_printf("%llu\r\n", (unsigned long long)get_timestamp(index));
+        }
+    }
+    else if (strncmp(readstring, "events on", 9) == 0)
+    {
+        uint32_t saved_irq = spin_lock_blocking(event_lock);
+        event_queue_tail = event_queue_head;
+        events_lost = 0;
+        events_enabled = 1;
+        spin_unlock(event_lock, saved_irq);
+        fast_serial_set_idle_callback(send_events);
+        fast_serial_printf("ok\r\n");
+    }
+    else if (strncmp(readstring, "events off", 10) == 0)
+    {
+        events_enabled = 0;
+        fast_serial_set_idle_callback(NULL);
+        fast_serial_printf("ok\r\n");
+    }
+    else if (strncmp(readstring, "getstoplatency", 14) == 0)
+    {
+        fast_serial_printf("last:%u worst:%u\r\n", last_stop_latency, worst_stop_latency);
+    }
+    else if (strncmp(readstring, "health", 6) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else
+        {
+            fast_serial_printf("stalls:%u first-instruction:%d shots:%u\r\n", health[pseudoclock].stalls, health[pseudoclock].first_instruction, health[pseudoclock].shots);
+        }
+    }
+    else if (strncmp(readstring, "trace dump", 10) == 0)
+    {
+        dump_trace();
+        fast_serial_printf("ok\r\n");
+    }
+    else if (strncmp(readstring, "stats", 5) == 0 && strncmp(readstring, "stats reset", 11) != 0)
+    {
+        for (int i = 0; i < STAT_ID_COUNT; i++)
+        {
+            cycle_stat *stat = &stats[i];
+            fast_serial_printf("%s count:%u min:%u mean:%u max:%u\r\n", stat_names[i], stat->count, stat->count ? stat->min : 0, cycle_stat_mean(stat), stat->max);
+        }
+        fast_serial_printf("ok\r\n");
+    }
+    else if (strncmp(readstring, "gettelemetry", 12) == 0)
+    {
+        fast_serial_printf("wakeups:%u worst-wakeup:%u arm:%u setb-instructions:%u setb-decode:%u setb-total:%u\r\n", core1_wakeups, core1_worst_wakeup_cycles, core1_arm_cycles, setb_instructions, setb_decode_cycles, setb_total_cycles);
+    }
+    else if (strncmp(readstring, "getabortlatency", 15) == 0)
+    {
+        fast_serial_printf("last:%u worst:%u\r\n", last_abort_latency, worst_abort_latency);
+    }
     // Prevent manual mode commands from running during buffered execution
     else if (local_status != ABORTED && local_status != STOPPED)
     {
         fast_serial_printf("Cannot execute command %s during buffered execution. Check status first and wait for it to return 0 or 5 (stopped or aborted).\r\n", readstring);
     }
+    else if (strncmp(readstring, "stats reset", 11) == 0)
+    {
+        // Core1 is idle (or just finishing its last record) once stopped
+        for (int i = 0; i < STAT_ID_COUNT; i++)
+        {
+            cycle_stat_reset(&stats[i]);
+        }
+        fast_serial_printf("ok\r\n");
+    }
     // Set number of pseudoclocks
     else if (strncmp(readstring, "setnumpseudoclocks", 17) == 0)
     {
@@ -822,26 +2325,35 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (num_pseudoclocks < 1 || num_pseudoclocks > 4)
+        else if (num_pseudoclocks < 1 || num_pseudoclocks > MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The number of pseudoclocks must be between 1 and 4 (inclusive)\r\n");
+            fast_serial_printf("The number of pseudoclocks must be between 1 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS);
         }
         else
         {
             // TODO: be cleverer here and rearrange instructions
             // rearrange_instructions(num_pseudoclocks_in_use, num_pseudoclocks);
 
-            // reset waits
-            for (int i = 0; i < max_waits + 4; i++)
+            // reset waits, and forget the last shot's (they were laid out for the old number)
+            for (int i = 0; i < max_waits + MAX_PSEUDOCLOCKS; i++)
             {
                 waits[i] = 0;
             }
-            // reset instructions
-            for (int i = 0; i < max_instructions * 2 + 8; i++)
+            int no_waits[MAX_PSEUDOCLOCKS] = {};
+            set_num_processed_waits(0, no_waits);
+            for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
             {
-                instructions[i] = 0;
+                shot_wait_stride[i] = 0;
+                shots_stored[i] = 0;
             }
+            // reset instructions
+            clear_instructions();
             num_pseudoclocks_in_use = num_pseudoclocks;
+            // the slot layout has changed
+            for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
+            {
+                reset_coalescing(i);
+            }
             fast_serial_printf("ok\r\n");
         }
     }
@@ -854,11 +2366,11 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
-        else if (pin_no == OUT_PINS[0] || pin_no == OUT_PINS[1] || pin_no == OUT_PINS[2] || pin_no == OUT_PINS[3])
+        else if (pin_in_list(OUT_PINS, pin_no))
         {
             fast_serial_printf("IN pin cannot be the same as one of the OUT pins\r\n");
         }
@@ -872,6 +2384,10 @@ void loop()
         }
         else
         {
+            if (IN_PINS[pseudoclock] != INVALID_PIN_NUMBER)
+            {
+                gpio_set_inover(IN_PINS[pseudoclock], GPIO_OVERRIDE_NORMAL);
+            }
             IN_PINS[pseudoclock] = pin_no;
             fast_serial_printf("ok\r\n");
         }
@@ -885,57 +2401,201 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pin_in_list(IN_PINS, pin_no))
+        {
+            fast_serial_printf("OUT pin cannot be the same as one of the IN pins\r\n");
+        }
+        else if (pin_no != 25 && (pin_no < 0 || pin_no > 19))
+        {
+            fast_serial_printf("OUT pin must be between 0 and 19 (inclusive) or 25 (LED for debugging)\r\n");
+        }
+        else if (pin_no == OUT_PINS[pseudoclock])
+        {
+            fast_serial_printf("ok\r\n");
+        }
+        else if (pin_in_list(OUT_PINS, pin_no))
+        {
+            fast_serial_printf("OUT pin cannot be the same as one of the other OUT pins\r\n");
+        }
+        else
+        {
+            if (OUT_PINS[pseudoclock] != INVALID_PIN_NUMBER)
+            {
+                gpio_set_outover(OUT_PINS[pseudoclock], GPIO_OVERRIDE_NORMAL);
+                gpio_set_inover(OUT_PINS[pseudoclock], GPIO_OVERRIDE_NORMAL);
+            }
+            OUT_PINS[pseudoclock] = pin_no;
+            fast_serial_printf("ok\r\n");
+        }
+    }
+    else if (strncmp(readstring, "getoutpin", 9) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else
+        {
+            if (OUT_PINS[pseudoclock] == INVALID_PIN_NUMBER)
+            {
+                fast_serial_printf("default\r\n");
+            }
+            else
+            {
+                fast_serial_printf("%u\r\n", OUT_PINS[pseudoclock]);
+            }
+        }
+    }
+    else if (strncmp(readstring, "getinpin", 8) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else
+        {
+            if (IN_PINS[pseudoclock] == INVALID_PIN_NUMBER)
+            {
+                fast_serial_printf("default\r\n");
+            }
+            else
+            {
+                fast_serial_printf("%u\r\n", IN_PINS[pseudoclock]);
+            }
+        }
+    }
+    else if (strncmp(readstring, "setclkdiv", 9) == 0)
+    {
+        unsigned int pseudoclock;
+        unsigned int div_int;
+        unsigned int div_frac = 0;
+        int parsed = sscanf(readstring, "%*s %u %u %u", &pseudoclock, &div_int, &div_frac);
+        if (parsed < 2)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (div_int < 1 || div_int > 65535 || div_frac > 255)
+        {
+            fast_serial_printf("The clock divider must be between 1 and 65535 (inclusive), with a fraction between 0 and 255 (inclusive)\r\n");
+        }
+        else
+        {
+            uint32_t divider = div_int * PSEUDOCLOCK_CLOCK_DIVIDER_ONE + div_frac;
+            // The table is stored in cycles of the old divided clock, so would run at the
+            // wrong speed (pseudoclocks not in use have no table until setnumpseudoclocks)
+            if (divider != clock_dividers[pseudoclock] && pseudoclock < num_pseudoclocks_in_use)
+            {
+                clear_pseudoclock_table(pseudoclock);
+            }
+            clock_dividers[pseudoclock] = divider;
+            fast_serial_printf("ok\r\n");
+        }
+    }
+    else if (strncmp(readstring, "getclkdiv", 9) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else
+        {
+            fast_serial_printf("%u %u\r\n", clock_dividers[pseudoclock] / PSEUDOCLOCK_CLOCK_DIVIDER_ONE, clock_dividers[pseudoclock] % PSEUDOCLOCK_CLOCK_DIVIDER_ONE);
+        }
+    }
+    else if (strncmp(readstring, "settrigger", 10) == 0)
+    {
+        unsigned int pseudoclock;
+        unsigned int mode;
+        int parsed = sscanf(readstring, "%*s %u %u", &pseudoclock, &mode);
+        if (parsed < 2)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
-        else if (pin_no == IN_PINS[0] || pin_no == IN_PINS[1] || pin_no == IN_PINS[2] || pin_no == IN_PINS[3])
+        else if (mode > TRIGGER_FALLING)
         {
-            fast_serial_printf("OUT pin cannot be the same as one of the IN pins\r\n");
+            fast_serial_printf("The trigger mode must be 0 (high), 1 (low), 2 (rising edge) or 3 (falling edge)\r\n");
         }
-        else if (pin_no != 25 && (pin_no < 0 || pin_no > 19))
+        else
         {
-            fast_serial_printf("OUT pin must be between 0 and 19 (inclusive) or 25 (LED for debugging)\r\n");
+            trigger_modes[pseudoclock] = mode;
+            // Update the pin overrides
+            gpio_inited = 0;
+            fast_serial_printf("ok\r\n");
         }
-        else if (pin_no == OUT_PINS[pseudoclock])
+    }
+    else if (strncmp(readstring, "gettrigger", 10) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
         {
-            fast_serial_printf("ok\r\n");
+            fast_serial_printf("invalid request\r\n");
         }
-        else if (pin_no == OUT_PINS[0] || pin_no == OUT_PINS[1] || pin_no == OUT_PINS[2] || pin_no == OUT_PINS[3])
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("OUT pin cannot be the same as one of the other OUT pins\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
         else
         {
-            OUT_PINS[pseudoclock] = pin_no;
-            fast_serial_printf("ok\r\n");
+            fast_serial_printf("%d\r\n", trigger_modes[pseudoclock]);
         }
     }
-    else if (strncmp(readstring, "getoutpin", 9) == 0)
+    else if (strncmp(readstring, "setpolarity", 11) == 0)
     {
         unsigned int pseudoclock;
-        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
-        if (parsed < 1)
+        unsigned int inverted;
+        int parsed = sscanf(readstring, "%*s %u %u", &pseudoclock, &inverted);
+        if (parsed < 2)
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (inverted != 0 && inverted != 1)
+        {
+            fast_serial_printf("You must specify either 0 (normal) or 1 (inverted)\r\n");
         }
         else
         {
-            if (OUT_PINS[pseudoclock] == INVALID_PIN_NUMBER)
-            {
-                fast_serial_printf("default\r\n");
-            }
-            else
-            {
-                fast_serial_printf("%u\r\n", OUT_PINS[pseudoclock]);
-            }
+            outputs_inverted[pseudoclock] = inverted;
+            // Update the pin overrides
+            gpio_inited = 0;
+            fast_serial_printf("ok\r\n");
         }
     }
-    else if (strncmp(readstring, "getinpin", 8) == 0)
+    else if (strncmp(readstring, "getpolarity", 11) == 0)
     {
         unsigned int pseudoclock;
         int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
@@ -943,20 +2603,13 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
         else
         {
-            if (IN_PINS[pseudoclock] == INVALID_PIN_NUMBER)
-            {
-                fast_serial_printf("default\r\n");
-            }
-            else
-            {
-                fast_serial_printf("%u\r\n", IN_PINS[pseudoclock]);
-            }
+            fast_serial_printf("%d\r\n", outputs_inverted[pseudoclock]);
         }
     }
     else if (strncmp(readstring, "setclock", 8) == 0)
@@ -1031,37 +2684,118 @@ void loop()
             fast_serial_printf("ok\r\n");
         }
     }
+    else if (strncmp(readstring, "timestamps off", 14) == 0 || strncmp(readstring, "capture off", 11) == 0)
+    {
+        timestamp_pseudoclock = -1;
+        fast_serial_printf("ok\r\n");
+    }
+    else if (strncmp(readstring, "timestamps", 10) == 0 || strncmp(readstring, "capture", 7) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else
+        {
+            timestamp_pseudoclock = pseudoclock;
+            timestamp_output = readstring[0] == 'c';
+            fast_serial_printf("ok\r\n");
+        }
+    }
+    else if (strncmp(readstring, "setcoalesce", 11) == 0)
+    {
+        unsigned int pseudoclock;
+        unsigned int enabled;
+        int parsed = sscanf(readstring, "%*s %u %u", &pseudoclock, &enabled);
+        if (parsed < 2)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (enabled != 0 && enabled != 1)
+        {
+            fast_serial_printf("You must specify either 0 (off) or 1 (on)\r\n");
+        }
+        else
+        {
+            reset_coalescing(pseudoclock);
+            coalesce[pseudoclock].enabled = enabled;
+            fast_serial_printf("ok\r\n");
+        }
+    }
     else if (strncmp(readstring, "hwstart", 7) == 0)
     {
-        configure_gpio();
-        // Force output low in case it was left high
-        for (int i = 0; i < num_pseudoclocks_in_use; i++)
+        unsigned int shots;
+        if (sscanf(readstring, "%*s %u", &shots) < 1)
         {
-            gpio_put(OUT_PINS[i], 0);
+            shots = 1;
+        }
+        if (shots < 1)
+        {
+            fast_serial_printf("The number of shots must be at least 1\r\n");
+            return;
+        }
+        if (start_shots(1, shots))
+        {
+            fast_serial_printf("ok\r\n");
         }
-        // Notify state machine to start
-        multicore_fifo_push_blocking(1);
-        // update status
-        set_status(TRANSITION_TO_RUNNING);
-        // update gpio inited status
-        gpio_inited = 0;
-        fast_serial_printf("ok\r\n");
     }
     else if ((strncmp(readstring, "start", 5) == 0))
     {
-        configure_gpio();
-        // Force output low in case it was left high
+        if (start_shots(0, 1))
+        {
+            fast_serial_printf("ok\r\n");
+        }
+    }
+    else if (strncmp(readstring, "underruntest", 12) == 0)
+    {
+        // Fill every table with the most demanding instructions for DMA (one rep at the
+        // shortest half-period, so two words per 2*PSEUDOCLOCK_NON_LOOP_PATH_LENGTH cycles
+        // for each pseudoclock), run them and check that no state machine ran dry.
+        // This replaces the uploaded instructions.
         for (int i = 0; i < num_pseudoclocks_in_use; i++)
         {
-            gpio_put(OUT_PINS[i], 0);
+            reset_coalescing(i);
+            uint32_t *table = instruction_table(i);
+            for (unsigned int addr = 0; addr < instructions_per_pseudoclock(); addr++)
+            {
+                pseudoclock_encode(PSEUDOCLOCK_NON_LOOP_PATH_LENGTH, 1, &table[addr * 2]);
+            }
+            pseudoclock_encode(0, 0, &table[instructions_per_pseudoclock() * 2]);
+        }
+        if (!start_shots(0, 1))
+        {
+            return;
+        }
+        while (get_status() != STOPPED && get_status() != ABORTED)
+        {
+            tight_loop_contents();
+        }
+        uint32_t underruns = 0;
+        for (int i = 0; i < num_pseudoclocks_in_use; i++)
+        {
+            if (health[i].stalls > 0)
+            {
+                underruns |= 1u << i;
+            }
+        }
+        if (underruns == 0)
+        {
+            fast_serial_printf("ok\r\n");
+        }
+        else
+        {
+            fast_serial_printf("underrun in pseudoclocks 0x%x\r\n", underruns);
         }
-        // Notify state machine to start
-        multicore_fifo_push_blocking(0);
-        // update status
-        set_status(TRANSITION_TO_RUNNING);
-        // update gpio inited status
-        gpio_inited = 0;
-        fast_serial_printf("ok\r\n");
     }
     // TODO: update this to support pseudoclock selection
     else if (strncmp(readstring, "set ", 4) == 0)
@@ -1071,98 +2805,110 @@ void loop()
         unsigned int reps;
         unsigned int pseudoclock;
         int parsed = sscanf(readstring, "%*s %u %u %u %u", &pseudoclock, &addr, &half_period, &reps);
-        int address_offset = pseudoclock * (max_instructions * 2 / num_pseudoclocks_in_use + 2);
         if (parsed < 4)
         {
             fast_serial_printf("invalid request\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
         }
-        else if (addr >= max_instructions)
+        else if (addr >= instructions_per_pseudoclock() && !coalesce[pseudoclock].enabled)
         {
             fast_serial_printf("invalid address\r\n");
         }
-        else if (reps == 0)
+        else
         {
-            // This indicates either a stop or a wait instruction
-            instructions[address_offset + addr * 2] = 0;
-            if (half_period == 0)
-            {
-                // It's a stop instruction
-                instructions[address_offset + addr * 2 + 1] = 0;
-                fast_serial_printf("ok\r\n");
-            }
-            else if (half_period >= 6)
+            switch (store_instruction(pseudoclock, addr, half_period, reps, instruction_table(pseudoclock)))
             {
-                // It's a wait instruction:
-                // The half period contains the number of ASM wait loops to wait for before continuing.
-                // There are 4 clock cycles of delay between ending the previous instruction and being
-                // ready to detect the trigger to end the wait. So we also subtract these off to ensure
-                // the timeout is accurate.
-                // The wait loop conatins two ASM instructions, so we divide by 2 here.
-                instructions[address_offset + addr * 2 + 1] = (half_period - 4) / 2;
+            case PSEUDOCLOCK_ENCODE_OK:
                 fast_serial_printf("ok\r\n");
-            }
-            else
-            {
+                break;
+            case PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT:
+                fast_serial_printf("half-period too short\r\n");
+                break;
+            case COALESCE_NOT_SEQUENTIAL:
+                fast_serial_printf("Instructions must be set in order while coalescing (expected address %u)\r\n", coalesce[pseudoclock].next_addr);
+                break;
+            case COALESCE_NO_FREE_SLOTS:
+                fast_serial_printf("no free instruction slots\r\n");
+                break;
+            default:
                 fast_serial_printf("invalid request\r\n");
+                break;
             }
         }
-        else if (half_period < (non_loop_path_length))
-        {
-            fast_serial_printf("half-period too short\r\n");
-        }
-        else if (reps < 1)
-        {
-            fast_serial_printf("reps must be at least one\r\n");
-        }
-        else
-        {
-            instructions[address_offset + addr * 2] = reps;
-            instructions[address_offset + addr * 2 + 1] = half_period - non_loop_path_length;
-            fast_serial_printf("ok\r\n");
-        }
     }
     else if (strncmp(readstring, "get ", 4) == 0)
     {
         unsigned int addr;
         unsigned int pseudoclock;
         int parsed = sscanf(readstring, "%*s %u %u", &pseudoclock, &addr);
-        int address_offset = pseudoclock * (max_instructions * 2 / num_pseudoclocks_in_use + 2);
         if (parsed < 2)
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
-        else if (addr >= max_instructions)
+        else if (pseudoclock >= num_pseudoclocks_in_use)
         {
-            fast_serial_printf("invalid address\r\n");
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
         }
-        else
+        else if (coalesce[pseudoclock].enabled)
         {
-            uint half_period = instructions[address_offset + addr * 2 + 1];
-            uint reps = instructions[address_offset + addr * 2];
-            if (reps != 0)
+            if (addr >= coalesce[pseudoclock].next_addr)
             {
-                half_period += non_loop_path_length;
+                fast_serial_printf("invalid address\r\n");
             }
             else
             {
-                // account for wait loop being 2 ASM instructions long
-                half_period = half_period * 2;
-                // If not a stop instruction
-                if (half_period != 0)
-                {
-                    // acount for 4 ASM instructions between end of previous pseudoclock instruction and start of wait loop
-                    half_period += 4;
-                }
+                // merged instructions are identical, so each has an equal share of the reps
+                uint32_t count;
+                uint32_t slot = coalesced_slot_for(pseudoclock, addr, &count);
+                uint32_t half_period;
+                uint32_t reps;
+                pseudoclock_decode(&instruction_table(pseudoclock)[slot * 2], &half_period, &reps);
+                // Waits are never merged, so an explicit indefinite wait is read back as for "set"
+                bool indefinite = reps == 0 && half_period == PSEUDOCLOCK_INDEFINITE_WAIT;
+                fast_serial_printf("%llu %u\r\n", indefinite ? half_period : (unsigned long long)to_system_cycles(pseudoclock, half_period), reps / count);
             }
-            fast_serial_printf("%u %u\r\n", half_period, reps);
+        }
+        else if (addr >= instructions_per_pseudoclock())
+        {
+            fast_serial_printf("invalid address\r\n");
+        }
+        else
+        {
+            uint32_t half_period;
+            uint32_t reps;
+            pseudoclock_decode(&instruction_table(pseudoclock)[addr * 2], &half_period, &reps);
+            // The half period of an explicit indefinite wait is a marker, not a length
+            bool indefinite = reps == 0 && half_period == PSEUDOCLOCK_INDEFINITE_WAIT;
+            fast_serial_printf("%llu %u\r\n", indefinite ? half_period : (unsigned long long)to_system_cycles(pseudoclock, half_period), reps);
+        }
+    }
+    else if (strncmp(readstring, "getcoalesce", 11) == 0)
+    {
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u", &pseudoclock);
+        if (parsed < 1)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else
+        {
+            coalesce_state *state = &coalesce[pseudoclock];
+            fast_serial_printf("coalesce:%d instructions:%u slots:%u saved:%u\r\n", state->enabled, state->next_addr, state->next_slot, state->next_addr - state->next_slot);
         }
     }
     else if (strncmp(readstring, "setb ", 5) == 0)
@@ -1172,16 +2918,23 @@ void loop()
         unsigned int inst_count;
         unsigned int pseudoclock;
         int parsed = sscanf(readstring, "%*s %u %u %u", &pseudoclock, &start_addr, &inst_count);
-        int address_offset = pseudoclock * (max_instructions * 2 / num_pseudoclocks_in_use + 2);
         if (parsed < 3)
         {
             fast_serial_printf("invalid request\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
+        {
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
+        }
+        else if (coalesce[pseudoclock].enabled && start_addr != 0 && start_addr != coalesce[pseudoclock].next_addr)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("Instructions must be set in order while coalescing (expected address %u)\r\n", coalesce[pseudoclock].next_addr);
         }
-        else if (start_addr + inst_count >= max_instructions)
+        else if ((uint64_t)start_addr + inst_count > instructions_per_pseudoclock() && !coalesce[pseudoclock].enabled)
         {
             fast_serial_printf("Invalid address and/or too many instructions (%d + %d).\r\n", start_addr, inst_count);
         }
@@ -1193,130 +2946,170 @@ void loop()
             unsigned int addr = start_addr;
 
             // Variables to track errors
-            uint32_t reps_error_count = 0;
-            uint32_t last_reps_error_idx = 0;
-            uint32_t half_period_error_count = 0;
-            uint32_t last_half_period_error_idx = 0;
-
-            while(inst_count > inst_per_buffer){
-                fast_serial_read(readstring, 8*inst_per_buffer);
-                for (int i = 0; i < inst_per_buffer; i++)
-                {
-                    uint32_t reps = ((readstring[8*i + 7] << 24)
-                                     | (readstring[8*i + 6] << 16)
-                                     | (readstring[8*i + 5] << 8)
-                                     | (readstring[8*i + 4]));
-                    uint32_t half_period = ((readstring[8*i + 3] << 24)
-                                            | (readstring[8*i + 2] << 16)
-                                            | (readstring[8*i + 1] << 8)
-                                            | (readstring[8*i + 0]));
-
-                    if (reps == 0)
-                    {
-                        // This indicates either a stop or a wait instruction
-                        instructions[address_offset + addr * 2] = 0;
-                        if (half_period == 0)
-                        {
-                            // It's a stop instruction
-                            instructions[address_offset + addr * 2 + 1] = 0;
-                            addr++;
-                        }
-                        else if (half_period >= 6)
-                        {
-                            // It's a wait instruction. See "set" command for why we do this.
-                            instructions[address_offset + addr * 2 + 1] = (half_period - 4) / 2;
-                            addr++;
-                        }
-                    else
-                        {
-                            reps_error_count++;
-                            last_reps_error_idx = (address_offset + addr * 2 + 1) / 2;
-                        }
-                    }
-                    else if (half_period < (non_loop_path_length))
-                    {
-                        fast_serial_printf("half-period too short\r\n");
-                        half_period_error_count++;
-                        last_half_period_error_idx = (address_offset + addr * 2 + 1) / 2;
-                    }
-                    else
-                    {
-                        instructions[address_offset + addr * 2] = reps;
-                        instructions[address_offset + addr * 2 + 1] = half_period - non_loop_path_length;
-                        addr++;
-                    }
-                }
-                inst_count -= inst_per_buffer;
+            setb_errors errors = {};
+
+            setb_instructions = inst_count;
+            setb_decode_cycles = 0;
+            setb_total_cycles = 0;
+            while (inst_count > 0)
+            {
+                uint32_t inst_in_buffer = inst_count > inst_per_buffer ? inst_per_buffer : inst_count;
+                uint32_t read_start = cycle_counter_read();
+                fast_serial_read(readstring, 8 * inst_in_buffer);
+                uint32_t decode_start = cycle_counter_read();
+                addr = decode_instructions((const uint8_t *)readstring, inst_in_buffer, pseudoclock, addr, &errors);
+                uint32_t decode_end = cycle_counter_read();
+                // Added up per block, as the counter wraps after 2^24 cycles
+                setb_decode_cycles += cycle_counter_elapsed(decode_start, decode_end);
+                setb_total_cycles += cycle_counter_elapsed(read_start, decode_end);
+                inst_count -= inst_in_buffer;
+            }
+            cycle_stat_record(&stats[STAT_SETB_DECODE], setb_decode_cycles);
+            if (errors.reps_count == 0 && errors.half_period_count == 0 && errors.no_slot_count == 0)
+            {
+                fast_serial_printf("ok\r\n");
             }
-            // In this if statement, we read a final serial buffer and load it into instructions.
-            if(inst_count > 0)
+            else
             {
-                fast_serial_read(readstring, 8*inst_count);
-                for(int i = 0; i < inst_count; i++)
+                if (errors.reps_count > 0)
                 {
-                    uint32_t reps = ((readstring[8*i + 7] << 24)
-                                     | (readstring[8*i + 6] << 16)
-                                     | (readstring[8*i + 5] << 8)
-                                     | (readstring[8*i + 4]));
-                    uint32_t half_period = ((readstring[8*i + 3] << 24)
-                                            | (readstring[8*i + 2] << 16)
-                                            | (readstring[8*i + 1] << 8)
-                                            | (readstring[8*i + 0]));
-
-                    if (reps == 0)
-                    {
-                        // This indicates either a stop or a wait instruction
-                        instructions[address_offset + addr * 2] = 0;
-                        if (half_period == 0)
-                        {
-                            // It's a stop instruction
-                            instructions[address_offset + addr * 2 + 1] = 0;
-                            addr++;
-                        }
-                        else if (half_period >= 6)
-                        {
-                            // It's a wait instruction. See "set" command for why we do this.
-                            instructions[address_offset + addr * 2 + 1] = (half_period - 4) / 2;
-                            addr++;
-                        }
-                        else
-                        {
-                            reps_error_count++;
-                            last_reps_error_idx = (address_offset + addr * 2 + 1) / 2;
-                        }
-                    }
-                    else if (half_period < (non_loop_path_length))
-                    {
-                        half_period_error_count++;
-                        last_half_period_error_idx = (address_offset + addr * 2 + 1) / 2;
-                        fast_serial_printf("half-period too short\r\n");
-                    }
-                    else
-                    {
-                        instructions[address_offset + addr * 2] = reps;
-                        instructions[address_offset + addr * 2 + 1] = half_period - non_loop_path_length;
-                        addr++;
-                    }
+                    fast_serial_printf("Invalid half-period for wait in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", errors.reps_count, errors.last_reps_idx);
+                }
+                if (errors.half_period_count > 0)
+                {
+                    fast_serial_printf("Too short half-period in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", errors.half_period_count, errors.last_half_period_idx);
+
+                }
+                if (errors.no_slot_count > 0)
+                {
+                    fast_serial_printf("No free instruction slots for %d instructions. Skipping these instructions.\r\n", errors.no_slot_count);
                 }
             }
-            if (reps_error_count == 0 && half_period_error_count == 0)
+        }
+    }
+    else if (strncmp(readstring, "setb64 ", 7) == 0)
+    {
+        // As setb, but with 64 bit half periods and reps, which are split into as many
+        // instructions as needed. Replies with the address after the last of them.
+        unsigned int start_addr;
+        unsigned int inst_count;
+        unsigned int pseudoclock;
+        int parsed = sscanf(readstring, "%*s %u %u %u", &pseudoclock, &start_addr, &inst_count);
+        if (parsed < 3)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
+        {
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
+        }
+        else if (coalesce[pseudoclock].enabled && start_addr != 0 && start_addr != coalesce[pseudoclock].next_addr)
+        {
+            fast_serial_printf("Instructions must be set in order while coalescing (expected address %u)\r\n", coalesce[pseudoclock].next_addr);
+        }
+        else if (start_addr >= instructions_per_pseudoclock() && !coalesce[pseudoclock].enabled)
+        {
+            fast_serial_printf("invalid address\r\n");
+        }
+        else
+        {
+            fast_serial_printf("ready\r\n");
+            // It takes 16 bytes to describe an instruction: 8 bytes for half period, 8 bytes for reps
+            uint32_t inst_per_buffer = SERIAL_BUFFER_SIZE / 16;
+            unsigned int addr = start_addr;
+            setb_errors errors = {};
+            while (inst_count > 0)
             {
-                fast_serial_printf("ok\r\n");
+                uint32_t inst_in_buffer = inst_count > inst_per_buffer ? inst_per_buffer : inst_count;
+                fast_serial_read(readstring, 16 * inst_in_buffer);
+                addr = decode_extended_instructions((const uint8_t *)readstring, inst_in_buffer, pseudoclock, addr, &errors);
+                inst_count -= inst_in_buffer;
+            }
+            if (errors.reps_count == 0 && errors.half_period_count == 0 && errors.no_slot_count == 0 && errors.too_long_count == 0)
+            {
+                fast_serial_printf("ok %u\r\n", addr);
             }
             else
             {
-                if (reps_error_count > 0)
+                if (errors.reps_count > 0)
                 {
-                    fast_serial_printf("Invalid half-period for wait in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", reps_error_count, last_reps_error_idx);
+                    fast_serial_printf("Invalid half-period for wait in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", errors.reps_count, errors.last_reps_idx);
                 }
-                if (reps_error_count > 0)
+                if (errors.half_period_count > 0)
                 {
-                    fast_serial_printf("Too short half-period in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", half_period_error_count, last_half_period_error_idx);
-
+                    fast_serial_printf("Too short half-period in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", errors.half_period_count, errors.last_half_period_idx);
+                }
+                if (errors.too_long_count > 0)
+                {
+                    fast_serial_printf("Too long half-period in %d instructions, most recent error at instruction %d. Skipping these instructions.\r\n", errors.too_long_count, errors.last_too_long_idx);
+                }
+                if (errors.no_slot_count > 0)
+                {
+                    fast_serial_printf("No free instruction slots for %d instructions. Skipping these instructions.\r\n", errors.no_slot_count);
                 }
             }
         }
     }
+    else if (strncmp(readstring, "chirp ", 6) == 0)
+    {
+        // A frequency sweep, expanded into one instruction per clock pulse on the device.
+        // Replies with the address after the last of them.
+        unsigned int pseudoclock;
+        unsigned int start_addr;
+        unsigned int half_period;
+        int delta;
+        unsigned int count;
+        int parsed = sscanf(readstring, "%*s %u %u %u %d %u", &pseudoclock, &start_addr, &half_period, &delta, &count);
+        // Half period of the last pulse (the chirp is linear, so the first and last are the extremes)
+        int64_t last_half_period = parsed < 5 ? 0 : (int64_t)half_period + (int64_t)delta * ((int64_t)count - 1);
+        if (parsed < 5 || count == 0)
+        {
+            fast_serial_printf("invalid request\r\n");
+        }
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
+        {
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
+        }
+        else if (pseudoclock >= num_pseudoclocks_in_use)
+        {
+            fast_serial_printf("Pseudoclock %u is not in use (see setnumpseudoclocks)\r\n", pseudoclock);
+        }
+        else if (coalesce[pseudoclock].enabled && start_addr != 0 && start_addr != coalesce[pseudoclock].next_addr)
+        {
+            fast_serial_printf("Instructions must be set in order while coalescing (expected address %u)\r\n", coalesce[pseudoclock].next_addr);
+        }
+        else if ((uint64_t)start_addr + count > instructions_per_pseudoclock() && !coalesce[pseudoclock].enabled)
+        {
+            fast_serial_printf("Invalid address and/or too many instructions (%d + %d).\r\n", start_addr, count);
+        }
+        else if (last_half_period < 0 || last_half_period > UINT32_MAX)
+        {
+            fast_serial_printf("The half-period of the last pulse (%lld) does not fit in 32 bits\r\n", (long long)last_half_period);
+        }
+        else
+        {
+            uint32_t addr = start_addr;
+            switch (store_chirp(pseudoclock, &addr, half_period, delta, count, instruction_table(pseudoclock)))
+            {
+            case PSEUDOCLOCK_ENCODE_OK:
+                fast_serial_printf("ok %u\r\n", addr);
+                break;
+            case PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT:
+                fast_serial_printf("half-period too short at instruction %u\r\n", addr);
+                break;
+            case COALESCE_NO_FREE_SLOTS:
+                fast_serial_printf("no free instruction slots at instruction %u\r\n", addr);
+                break;
+            default:
+                fast_serial_printf("invalid request\r\n");
+                break;
+            }
+        }
+    }
     else if (strncmp(readstring, "go high", 7) == 0)
     {
         unsigned int pseudoclock;
@@ -1325,9 +3118,9 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
         else
         {
@@ -1344,9 +3137,9 @@ void loop()
         {
             fast_serial_printf("invalid request\r\n");
         }
-        else if (pseudoclock < 0 || pseudoclock > 3)
+        else if (pseudoclock < 0 || pseudoclock >= MAX_PSEUDOCLOCKS)
         {
-            fast_serial_printf("The specified pseudoclock must be between 0 and 3 (inclusive)\r\n");
+            fast_serial_printf("The specified pseudoclock must be between 0 and %d (inclusive)\r\n", MAX_PSEUDOCLOCKS - 1);
         }
         else
         {
@@ -1369,19 +3162,26 @@ int main()
 {
     DEBUG = 0;
     // Initial config for output pins and number of processed waits
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < MAX_PSEUDOCLOCKS; i++)
     {
         OUT_PINS[i] = INVALID_PIN_NUMBER;
         IN_PINS[i] = INVALID_PIN_NUMBER;
+        clock_dividers[i] = PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
         num_waits_processed[i] = 0;
+        coalesce[i].enabled = false;
+        coalesce[i].open_entry = -1;
+        health[i].first_instruction = -1;
     }
+    num_coalesced_slots = 0;
     // start with only one in use
     num_pseudoclocks_in_use = 1;
+    clear_instructions();
     pio_to_use = pio0;
 
-    // initialise the status mutex
-    mutex_init(&status_mutex);
-    mutex_init(&wait_mutex);
+    // claim the spinlock that serialises status changes
+    status_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    event_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    events_enabled = 0;
 
     // configure resus callback that will reconfigure the clock for us
     // either when we change clock settings or when the clock fails (if external)
@@ -1395,12 +3195,21 @@ int main()
 
     fast_serial_init();
 
+    // for timing aborts (core1 starts its own)
+    cycle_counter_init();
+
     multicore_launch_core1(core1_entry);
     multicore_fifo_pop_blocking();
 
+    for (int i = 0; i < STAT_ID_COUNT; i++)
+    {
+        cycle_stat_reset(&stats[i]);
+    }
+
     while (true)
     {
         loop();
+        cycle_stat_record(&stats[STAT_COMMAND], time_us_32() - command_start_us);
     }
     return 0;
 }
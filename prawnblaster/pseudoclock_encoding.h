@@ -0,0 +1,271 @@
+/*
+#######################################################################
+#                                                                     #
+# pseudoclock_encoding.h                                              #
+#                                                                     #
+# Copyright 2021, Philip Starkey                                      #
+#                                                                     #
+# This file is used to flash a Raspberry Pi Pico microcontroller      #
+# prototyping board to create a PrawnBlaster (see readme.txt and      #
+# http://hardware.labscriptsuite.org).                                #
+# This file is licensed under the 3-clause BSD License.               #
+# See the license.txt file for the full license.                      #
+#                                                                     #
+#######################################################################
+*/
+
+/*
+  Conversion between user facing instructions and the words consumed by pseudoclock.pio
+
+  Every instruction is stored as two 32 bit words, in the order they are pulled by the
+  PIO program: reps first, then the (encoded) half period.
+
+  These functions have no dependencies on the pico SDK so that they can also be used by
+  the host side tools (see host/).
+ */
+#ifndef _PSEUDOCLOCK_ENCODING_H_
+#define _PSEUDOCLOCK_ENCODING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// This contains the number of clock cycles for a half period, which is currently 5 (there are 5 ASM instructions)
+#define PSEUDOCLOCK_NON_LOOP_PATH_LENGTH 5
+// There are 4 clock cycles of delay between ending the previous instruction and being
+// ready to detect the trigger to end a wait.
+#define PSEUDOCLOCK_WAIT_SETUP_LENGTH 4
+// The wait loop contains two ASM instructions
+#define PSEUDOCLOCK_WAIT_LOOP_LENGTH 2
+// Shortest wait timeout that can be encoded
+#define PSEUDOCLOCK_MIN_WAIT_LENGTH 6
+// A wait with this half period (too short for a timed wait) is an explicit indefinite wait,
+// which waits for the trigger without a timeout
+#define PSEUDOCLOCK_INDEFINITE_WAIT 1
+// The PIO program tells an indefinite wait apart from a stop by bit 31 of its number of
+// wait loops, which no timed wait has
+#define PSEUDOCLOCK_INDEFINITE_WAIT_WORD 0x80000000u
+
+// Latencies of pseudoclock.pio (in clock cycles). These define the golden timeline of the
+// host tools (see host/pio_emulator/pseudoclock_harness.h) and are used by the firmware to
+// reconstruct when waits started, so any change to the PIO program that alters them must
+// be deliberate.
+//
+// From the state machine being enabled (or jumping to "start") to the first rising edge
+#define PSEUDOCLOCK_START_LATENCY 4
+// From the state machine being enabled (or jumping to "start") to the first check of the
+// trigger in an indefinite wait (including the hardware start)
+#define PSEUDOCLOCK_INDEFINITE_WAIT_ARM_LATENCY 4
+// From the trigger being detected to the next rising edge
+#define PSEUDOCLOCK_RESUME_LATENCY 8
+// From the end of the previous instruction to the first check of the trigger in a wait
+#define PSEUDOCLOCK_WAIT_FIRST_CHECK 3
+// The same for an explicit indefinite wait, and from the trigger being detected in one to the
+// next rising edge
+#define PSEUDOCLOCK_INDEFINITE_WAIT_FIRST_CHECK 5
+#define PSEUDOCLOCK_INDEFINITE_WAIT_RESUME_LATENCY 12
+// From the end of the previous instruction to a stop pushing its (0) value
+#define PSEUDOCLOCK_STOP_LATENCY 5
+// Clock cycles between a GPIO changing and the PIO seeing it (the input synchroniser)
+#define PSEUDOCLOCK_INPUT_SYNC_LENGTH 2
+
+enum pseudoclock_encode_result
+{
+    PSEUDOCLOCK_ENCODE_OK = 0,
+    PSEUDOCLOCK_ENCODE_INVALID_WAIT,
+    PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT,
+};
+
+// Encode a user instruction (as sent to "set") into the two words sent to the PIO.
+// words is only written to if the instruction is valid.
+static inline enum pseudoclock_encode_result pseudoclock_encode(uint32_t half_period, uint32_t reps, uint32_t *words)
+{
+    if (reps == 0)
+    {
+        // This indicates either a stop or a wait instruction
+        if (half_period == 0)
+        {
+            // It's a stop instruction
+            words[0] = 0;
+            words[1] = 0;
+            return PSEUDOCLOCK_ENCODE_OK;
+        }
+        else if (half_period == PSEUDOCLOCK_INDEFINITE_WAIT)
+        {
+            words[0] = 0;
+            words[1] = PSEUDOCLOCK_INDEFINITE_WAIT_WORD;
+            return PSEUDOCLOCK_ENCODE_OK;
+        }
+        else if (half_period >= PSEUDOCLOCK_MIN_WAIT_LENGTH)
+        {
+            // It's a wait instruction:
+            // The half period contains the number of ASM wait loops to wait for before continuing.
+            // We subtract off the setup cycles to ensure the timeout is accurate, and divide by
+            // the length of the wait loop.
+            words[0] = 0;
+            words[1] = (half_period - PSEUDOCLOCK_WAIT_SETUP_LENGTH) / PSEUDOCLOCK_WAIT_LOOP_LENGTH;
+            return PSEUDOCLOCK_ENCODE_OK;
+        }
+        return PSEUDOCLOCK_ENCODE_INVALID_WAIT;
+    }
+    else if (half_period < PSEUDOCLOCK_NON_LOOP_PATH_LENGTH)
+    {
+        return PSEUDOCLOCK_ENCODE_HALF_PERIOD_TOO_SHORT;
+    }
+    words[0] = reps;
+    words[1] = half_period - PSEUDOCLOCK_NON_LOOP_PATH_LENGTH;
+    return PSEUDOCLOCK_ENCODE_OK;
+}
+
+// Inverse of pseudoclock_encode (as reported by "get")
+static inline void pseudoclock_decode(const uint32_t *words, uint32_t *half_period, uint32_t *reps)
+{
+    *reps = words[0];
+    *half_period = words[1];
+    if (*reps != 0)
+    {
+        *half_period += PSEUDOCLOCK_NON_LOOP_PATH_LENGTH;
+    }
+    else if (*half_period == PSEUDOCLOCK_INDEFINITE_WAIT_WORD)
+    {
+        *half_period = PSEUDOCLOCK_INDEFINITE_WAIT;
+    }
+    else
+    {
+        // account for wait loop being 2 ASM instructions long
+        *half_period *= PSEUDOCLOCK_WAIT_LOOP_LENGTH;
+        // If not a stop instruction
+        if (*half_period != 0)
+        {
+            // acount for 4 ASM instructions between end of previous pseudoclock instruction and start of wait loop
+            *half_period += PSEUDOCLOCK_WAIT_SETUP_LENGTH;
+        }
+    }
+}
+
+// Clock dividers are in 1/256ths of a clock cycle (the format of the PIO CLKDIV register)
+#define PSEUDOCLOCK_CLOCK_DIVIDER_ONE 256
+
+// Convert system clock cycles into cycles of a state machine whose clock is divided by
+// divider (rounded to the nearest). Instructions are encoded in these cycles. A non zero
+// number stays non zero, so that a short instruction is rejected as too short rather than
+// turning into a stop.
+static inline uint32_t pseudoclock_divide_cycles(uint32_t cycles, uint32_t divider)
+{
+    uint32_t divided;
+    if (divider == PSEUDOCLOCK_CLOCK_DIVIDER_ONE)
+    {
+        return cycles;
+    }
+    else if (divider % PSEUDOCLOCK_CLOCK_DIVIDER_ONE == 0)
+    {
+        // Integer dividers avoid the (slow on the RP2040) 64 bit division
+        uint32_t div_int = divider / PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
+        divided = cycles / div_int + (2 * (cycles % div_int) >= div_int);
+    }
+    else
+    {
+        divided = (uint32_t)(((uint64_t)cycles * PSEUDOCLOCK_CLOCK_DIVIDER_ONE + divider / 2) / divider);
+    }
+    return divided == 0 && cycles != 0 ? 1 : divided;
+}
+
+// As pseudoclock_divide_cycles, for the 64 bit half periods of "setb64"
+static inline uint64_t pseudoclock_divide_cycles64(uint64_t cycles, uint32_t divider)
+{
+    if (divider == PSEUDOCLOCK_CLOCK_DIVIDER_ONE)
+    {
+        return cycles;
+    }
+    // Divide first so that the result can't overflow (the remainder is less than 2^24)
+    uint64_t whole = cycles / divider;
+    uint64_t divided = whole * PSEUDOCLOCK_CLOCK_DIVIDER_ONE + ((cycles % divider) * PSEUDOCLOCK_CLOCK_DIVIDER_ONE + divider / 2) / divider;
+    return divided == 0 && cycles != 0 ? 1 : divided;
+}
+
+// Convert the half period of a user instruction with pseudoclock_divide_cycles(64). The half
+// period of an explicit indefinite wait is a marker rather than a length, so it is kept as it
+// is. Returns false for a timed wait that the divider would turn into that marker (which is
+// too short to be a timed wait anyway).
+static inline bool pseudoclock_divide_half_period(uint32_t half_period, uint32_t reps, uint32_t divider, uint32_t *divided)
+{
+    if (reps == 0 && half_period == PSEUDOCLOCK_INDEFINITE_WAIT)
+    {
+        *divided = half_period;
+        return true;
+    }
+    *divided = pseudoclock_divide_cycles(half_period, divider);
+    return !(reps == 0 && *divided == PSEUDOCLOCK_INDEFINITE_WAIT);
+}
+
+static inline bool pseudoclock_divide_half_period64(uint64_t half_period, uint64_t reps, uint32_t divider, uint64_t *divided)
+{
+    if (reps == 0 && half_period == PSEUDOCLOCK_INDEFINITE_WAIT)
+    {
+        *divided = half_period;
+        return true;
+    }
+    *divided = pseudoclock_divide_cycles64(half_period, divider);
+    return !(reps == 0 && *divided == PSEUDOCLOCK_INDEFINITE_WAIT);
+}
+
+// Inverse of pseudoclock_divide_cycles (the result only fits in 32 bits without a divider)
+static inline uint64_t pseudoclock_multiply_cycles(uint32_t cycles, uint32_t divider)
+{
+    return ((uint64_t)cycles * divider + PSEUDOCLOCK_CLOCK_DIVIDER_ONE / 2) / PSEUDOCLOCK_CLOCK_DIVIDER_ONE;
+}
+
+// Largest reps of a single instruction. Instructions with more (sent with "setb64") are
+// split into as many instructions with this many reps as needed, followed by one with the
+// rest. Waits and stops (reps of 0) are never split.
+#define PSEUDOCLOCK_MAX_REPS UINT32_MAX
+
+// Number of instructions an instruction with the given (64 bit) reps is split into
+static inline uint64_t pseudoclock_split_count(uint64_t reps)
+{
+    return reps == 0 ? 1 : reps / PSEUDOCLOCK_MAX_REPS + (reps % PSEUDOCLOCK_MAX_REPS != 0);
+}
+
+// Scan an encoded instruction table (up to and including the first stop instruction).
+// Returns the number of words to send to the PIO (including the stop instruction) or
+// 0 if no stop instruction was found within max_words. If wait_count is not NULL, it is
+// set to the number of words the PIO will push back (one per wait plus one for the stop).
+static inline int pseudoclock_scan(const uint32_t *words, int max_words, int *wait_count)
+{
+    int waits = 1; // We always receive a stop message
+    // The PIO program treats a wait at the very start of the table like the second wait
+    // of an indefinite wait (it never reports its length), so start as if following a wait
+    bool previous_instruction_was_wait = true;
+    for (int i = 0; i + 1 < max_words; i += 2)
+    {
+        if (words[i] == 0 && words[i + 1] == 0)
+        {
+            if (wait_count)
+            {
+                *wait_count = waits;
+            }
+            return i + 2;
+        }
+        else if (words[i] == 0)
+        {
+            // Only count the first wait in a set of sequential waits. This applies to
+            // explicit indefinite waits too: one after a pulse reports a value (like a timed
+            // wait), but one after a wait is run as the second wait of an indefinite wait.
+            if (!previous_instruction_was_wait)
+            {
+                waits += 1;
+            }
+            previous_instruction_was_wait = true;
+        }
+        else
+        {
+            previous_instruction_was_wait = false;
+        }
+    }
+    if (wait_count)
+    {
+        *wait_count = waits;
+    }
+    return 0;
+}
+
+#endif